@@ -8,10 +8,13 @@ if not exist build mkdir build
 :: Compile all source files
 gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/main.c -o build/main.o
 gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_utils.c -o build/tftp_utils.o
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_packet.c -o build/tftp_packet.o
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_timing.c -o build/tftp_timing.o
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_netascii.c -o build/tftp_netascii.o
 gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_handlers.c -o build/tftp_handlers.o
 
 :: Link to create executable
-gcc build/main.o build/tftp_utils.o build/tftp_handlers.o -o tftp_server.exe -lws2_32
+gcc build/main.o build/tftp_utils.o build/tftp_packet.o build/tftp_timing.o build/tftp_netascii.o build/tftp_handlers.o -o tftp_server.exe -lws2_32
 
 if exist tftp_server.exe (
     echo Build successful! Executable: tftp_server.exe
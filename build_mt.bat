@@ -5,7 +5,7 @@ REM Create build directory if not exists
 if not exist build mkdir build
 
 REM Compile multi-threaded TFTP server
-gcc -Wall -Wextra -O2 src/tftp_server_mt.c src/tftp_utils.c -o tftp_server_mt.exe -lws2_32
+gcc -Wall -Wextra -O2 src/tftp_server_mt.c src/tftp_engine.c src/tftp_timer.c src/tftp_batch.c src/tftp_cache.c src/tftp_writer.c src/tftp_fileio.c src/tftp_session_table.c src/tftp_socket_pool.c src/tftp_multicast.c src/tftp_pool.c src/tftp_packet.c src/tftp_timing.c src/tftp_netascii.c src/tftp_utils.c src/tftp_log.c src/tftp_metrics.c -o tftp_server_mt.exe -lws2_32
 
 if %ERRORLEVEL% EQU 0 (
     echo.
@@ -20,7 +20,7 @@ if %ERRORLEVEL% EQU 0 (
     echo Features:
     echo   - Multi-client concurrent access
     echo   - Thread-safe logging
-    echo   - Automatic thread creation
+    echo   - Event-driven transfer engine
     echo   - Complete error handling
     echo ========================================
 ) else (
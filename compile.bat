@@ -11,6 +11,15 @@ gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/main.c -o build/main.o
 echo Compiling tftp_utils.c...
 gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_utils.c -o build/tftp_utils.o
 
+echo Compiling tftp_packet.c...
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_packet.c -o build/tftp_packet.o
+
+echo Compiling tftp_timing.c...
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_timing.c -o build/tftp_timing.o
+
+echo Compiling tftp_netascii.c...
+gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_netascii.c -o build/tftp_netascii.o
+
 echo Compiling tftp_handlers.c...
 gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/tftp_handlers.c -o build/tftp_handlers.o
 
@@ -19,7 +28,7 @@ gcc -Wall -Wextra -std=c99 -g -Iinclude -c src/gui_app.c -o build/gui_app.o
 
 :: Link to create executable
 echo Linking...
-gcc build/main.o build/tftp_utils.o build/tftp_handlers.o -o tftp_server.exe -lws2_32
+gcc build/main.o build/tftp_utils.o build/tftp_packet.o build/tftp_timing.o build/tftp_netascii.o build/tftp_handlers.o -o tftp_server.exe -lws2_32
 
 echo Linking GUI...
 gcc build/gui_app.o -o tftp_gui.exe -mwindows -lcomctl32 -lshlwapi -lcomdlg32
@@ -1,21 +1,84 @@
 #ifndef TFTP_H
 #define TFTP_H
 
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600     // WSAPoll、GetTickCount64需要Vista及以上版本
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mswsock.h>
 #include <time.h>
 
 // TFTP协议常量定义
 #define TFTP_PORT 69            // TFTP默认端口
-#define BUFFER_SIZE 516         // TFTP数据包最大大小（512字节数据 + 4字节头部）
-#define DATA_SIZE 512           // TFTP数据块大小
+#define BUFFER_SIZE 516         // 默认TFTP数据包大小（512字节数据 + 4字节头部），也是请求包的接收缓冲区大小
+#define DATA_SIZE 512           // 默认TFTP数据块大小（未协商blksize时）
+#define TFTP_HEADER_SIZE 4      // DATA包头部大小（操作码 + 块号）
+#define MIN_BLOCK_SIZE 8        // blksize选项允许的最小值（RFC 2348）
+#define MAX_BLOCK_SIZE 65464    // blksize选项允许的最大值（RFC 2348），以太网常用1428
 #define MAX_FILENAME_LEN 255    // 最大文件名长度
 #define MAX_MODE_LEN 10         // 最大模式名长度
 #define MAX_RETRIES 5           // 最大重传次数
 #define TIMEOUT_SECONDS 5       // 超时时间（秒）
+#define RTO_INITIAL_MS 1000     // 尚无RTT样本时的重传超时（毫秒）
+#define RTO_MIN_MS 100          // 自适应重传超时下限（毫秒）
+#define RTO_MAX_MS 60000        // 重传超时上限，指数退避不超过该值（毫秒）
+#define GIVE_UP_MS (MAX_RETRIES * TIMEOUT_SECONDS * 1000) // 连续无进展超过该时间才放弃传输（毫秒）
+#define MIN_TIMEOUT_OPTION 1    // timeout选项允许的最小值（RFC 2349，秒）
+#define MAX_TIMEOUT_OPTION 255  // timeout选项允许的最大值（RFC 2349，秒）
+#define MAX_WINDOW_SIZE 64      // 服务器接受的最大窗口大小（RFC 7440 windowsize选项）
+#define MAX_WINDOW_BYTES (1024 * 1024) // 单个会话窗口缓冲区上限（blksize × windowsize）
+#define OPTION_BUFFER_SIZE 512  // OACK包缓冲区大小
+#define SEND_BATCH_SIZE 256     // 引擎发送队列容量（每轮事件循环批量发送的数据包数）
+#define USO_MAX_SEND_BYTES 65000 // UDP分段卸载时单次发送的最大字节数
+#define FILE_CACHE_BUCKETS 64   // 文件缓存哈希表桶数
+#define FILE_CACHE_DEFAULT_MB 256 // 文件缓存默认内存预算（MB）
+#define WRITE_RING_BYTES (256 * 1024) // 每个上传会话的写缓冲环大小（字节）
+#define WRITE_RING_MIN_SLOTS 4  // 写缓冲环最少槽位数（大块时）
+#define WRITE_RING_MAX_SLOTS 512 // 写缓冲环最多槽位数（小块时）
+#define PREFETCH_CHUNK_BYTES (256 * 1024) // 下载预读的读取块大小上限（字节，按块大小向下取整，至少容纳一个窗口）
+#define SESSION_SLAB_SIZE 64    // 每个slab包含的会话数
+#define SESSION_TABLE_MIN_CAPACITY 256 // 会话表初始槽位数（2的幂，装载率超过1/2时翻倍）
+#define SESSION_CACHE_SIZE 64   // 每个引擎缓存的空闲会话数上限（超过时一半交回进程级空闲链表）
+#define SOCKET_POOL_PREBIND 64  // 未指定端口范围时启动时预先绑定的传输套接字数
+#define SOCKET_POOL_CAPACITY 1024 // 未指定端口范围时池中保留的空闲传输套接字数上限（超过时关闭）
+#define SOCKET_POOL_DRAIN_LIMIT 64 // 借出套接字时最多丢弃的残留数据报数
+#define NETASCII_READ_SIZE (16 * 1024) // netascii下载每次从文件读取的字节数
+#define FILE_TSIZE_CACHE_SIZE 64 // 缓存netascii编码后长度（tsize选项）的文件数
+#define MULTICAST_MAX_GROUPS 16 // 同时进行的组播传输数上限（组地址从基地址起依次分配）
+#define MULTICAST_MAX_MEMBERS 256 // 每个组播组的客户端数上限（超过时新客户端改用单播）
+#define MULTICAST_DEFAULT_PORT 1758 // 组播数据包的目的端口（-mcast未指定端口时）
+#define MULTICAST_TTL 1         // 组播数据包的TTL（只在本网段内传播）
+#define MULTICAST_PROMOTE_RETRIES 3 // 新的主客户端不响应OACK时，放弃它之前的重发次数
+#define POOL_MIN_SHIFT 6        // 缓冲池最小尺寸级别（2^6 = 64字节）
+#define POOL_CLASS_COUNT 15     // 缓冲池尺寸级别数（64字节到1MB，覆盖MAX_WINDOW_BYTES）
+#define POOL_CACHE_BYTES (4 * 1024 * 1024) // 每个引擎每个尺寸级别缓存的空闲块字节数上限
+#define POOL_CACHE_MAX_BLOCKS 256 // 每个引擎每个尺寸级别缓存的空闲块数上限
+#define POOL_DEPOT_BYTES (64 * 1024 * 1024) // 进程级仓库保留的空闲块字节数上限，超过时还给堆
+#define LOG_FILE_MT "logs/tftp_server_mt.log" // 多线程版本日志文件
+#define LOG_RING_RECORDS 256    // 每个线程日志环的记录数（2的幂，环满时丢弃新日志）
+#define LOG_RECORD_TEXT 496     // 每条日志记录的参数区大小和消息长度上限（超出截断）
+#define LOG_FLUSH_INTERVAL_MS 50 // 后台日志线程的写出间隔（毫秒）
+#define LOG_BATCH_BYTES (64 * 1024) // 后台日志线程每次写入的批缓冲区大小
+#define LOG_EVENT_BURST 10      // 每个会话每类热路径日志允许的突发条数（令牌桶容量）
+#define LOG_EVENT_RATE 2        // 每个会话每类热路径日志的持续速率（条/秒）
+#define LOG_GLOBAL_BURST 200    // 全进程热路径日志允许的突发条数
+#define LOG_GLOBAL_RATE 100     // 全进程热路径日志的持续速率（条/秒）
+#define METRICS_DEFAULT_PORT 9169 // 指标端点默认监听端口（只监听127.0.0.1）
+#define METRICS_MAX_ENGINES 64  // 指标端点最多汇总的引擎数
+#define HISTOGRAM_SUB_BITS 4    // 延迟直方图每个2的幂区间再分为2^4个桶（相对误差不超过1/16）
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 36   // 延迟直方图的量程（2^36纳秒，约68秒，更大的值计入最后一个桶）
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+#ifndef UDP_SEND_MSG_SIZE
+#define UDP_SEND_MSG_SIZE 2     // UDP分段卸载（USO）套接字选项，较旧的SDK未定义
+#endif
 
 // TFTP操作码定义
 typedef enum {
@@ -23,7 +86,8 @@ typedef enum {
     TFTP_WRQ = 2,      // 写请求（上传）
     TFTP_DATA = 3,     // 数据包
     TFTP_ACK = 4,      // 确认包
-    TFTP_ERROR = 5     // 错误包
+    TFTP_ERROR = 5,    // 错误包
+    TFTP_OACK = 6      // 选项确认包（RFC 2347）
 } tftp_opcode_t;
 
 // TFTP错误码定义
@@ -35,78 +99,515 @@ typedef enum {
     TFTP_ERROR_ILLEGAL_OPERATION = 4,    // 非法操作
     TFTP_ERROR_UNKNOWN_TID = 5,         // 未知传输ID
     TFTP_ERROR_FILE_EXISTS = 6,         // 文件已存在
-    TFTP_ERROR_NO_SUCH_USER = 7         // 用户不存在
+    TFTP_ERROR_NO_SUCH_USER = 7,        // 用户不存在
+    TFTP_ERROR_OPTION_NEGOTIATION = 8   // 选项协商失败（RFC 2347）
 } tftp_error_code_t;
 
+// 日志级别（低于最低级别的日志不格式化、不写出）
+typedef enum {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+} tftp_log_level_t;
+
+// 热路径日志事件类别：每个会话按类别分别限速，摘要中按类别报告被抑制的条数
+typedef enum {
+    LOG_EVENT_RETRANSMIT = 0,           // 超时重传
+    LOG_EVENT_DUPLICATE,                // 重复或乱序的数据包、重复的请求
+    LOG_EVENT_INVALID,                  // 无效或意外的数据包
+    LOG_EVENT_COUNT
+} tftp_log_event_t;
+
+// 日志令牌桶：每条日志消耗一个令牌，令牌按固定速率补充，没有令牌时日志被抑制并计数
+typedef struct {
+    DWORD refill_time;                  // 上次补充令牌的时间（GetTickCount，0表示尚未使用）
+    int tokens;                         // 剩余令牌数
+    int suppressed;                     // 上次输出以来被抑制的日志条数
+} tftp_log_limiter_t;
+
 // TFTP传输模式
 typedef enum {
     MODE_NETASCII = 0,  // ASCII模式
     MODE_OCTET = 1      // 二进制模式
 } tftp_mode_t;
 
-// TFTP数据包结构
+// TFTP选项扩展（RFC 2347），值为0表示客户端未请求该选项
+typedef struct {
+    int blksize;                        // 数据块大小（RFC 2348）
+    int windowsize;                     // 窗口大小（RFC 7440）
+    int timeout;                        // 重传超时秒数（RFC 2349）
+    int multicast;                      // 请求中出现了multicast选项（RFC 2090，值为空）
+    char multicast_value[32];           // OACK中multicast选项的值"组地址,端口,mc"（空串表示不写入）
+    int tsize;                          // 请求中出现了tsize选项（RFC 2349，文件大小可以为0，单独记录）
+    ULONGLONG tsize_value;              // 文件大小：WRQ为客户端声明的大小，OACK中为回复的大小
+} tftp_options_t;
+
+// 解析后的TFTP数据包（零复制视图）：字符串和数据都指向接收缓冲区，只设置该操作码用到的字段
 typedef struct {
     unsigned short opcode;              // 操作码
-    union {
-        struct {                        // RRQ/WRQ请求包
-            char filename[MAX_FILENAME_LEN];
-            char mode[MAX_MODE_LEN];
-        } request;
-        
-        struct {                        // 数据包
-            unsigned short block_num;
-            char data[DATA_SIZE];
-        } data;
-        
-        struct {                        // ACK包
-            unsigned short block_num;
-        } ack;
-        
-        struct {                        // 错误包
-            unsigned short error_code;
-            char error_msg[512];
-        } error;
-    };
-} tftp_packet_t;
+    unsigned short block_num;           // DATA/ACK：块号；ERROR：错误码
+    const char* payload;                // DATA：数据；ERROR：错误消息（不一定以null结尾）
+    int payload_len;                    // DATA：数据长度；ERROR：错误消息长度
+    const char* filename;               // RRQ/WRQ：文件名（在接收缓冲区中以null结尾）
+    const char* mode;                   // RRQ/WRQ：传输模式（在接收缓冲区中以null结尾）
+    tftp_options_t options;             // RRQ/WRQ：模式之后的选项
+} tftp_packet_view_t;
 
-// 客户端会话信息
+// netascii流式转换状态（跨数据块保存）
+typedef struct {
+    int cr_seen;                        // 最后一个输入字节是CR，其含义取决于下一个字节
+    char pending[2];                    // 编码：输出缓冲区已满而尚未输出的字节
+    int pending_len;                    // 编码：pending中的字节数
+    char* input;                        // 编码：netascii_read的读缓冲区（NETASCII_READ_SIZE字节）
+    size_t input_pos;                   // 编码：读缓冲区中下一个未转换的字节
+    size_t input_len;                   // 编码：读缓冲区中的有效字节数
+    int eof;                            // 编码：文件已读完
+} tftp_netascii_t;
+
+// HDR式延迟直方图（对数-线性分桶，纳秒），全零即为空直方图，可以直接相加
+typedef struct {
+    ULONG counts[HISTOGRAM_BUCKETS];    // 各桶的样本数
+    ULONGLONG count;                    // 样本总数
+    ULONGLONG sum_ns;                   // 样本之和
+    ULONGLONG min_ns;                   // 最小样本
+    ULONGLONG max_ns;                   // 最大样本
+} tftp_histogram_t;
+
+// 传输统计信息
+typedef struct {
+    size_t bytes_transferred;           // 传输字节数
+    ULONGLONG start_ns;                 // 开始时间（单调时钟，纳秒）
+    ULONGLONG end_ns;                   // 结束时间（单调时钟，纳秒）
+    int blocks_sent;                    // 发送的数据块数
+    int retransmissions;                // 重传次数
+    int rtt_samples;                    // RTT样本数（重传过的包不采样）
+    int rtt_min_ms;                     // 最小RTT（毫秒）
+    int rtt_max_ms;                     // 最大RTT（毫秒）
+    int srtt_ms;                        // 平滑RTT（毫秒）
+    tftp_histogram_t ack_latency;       // 每个块从发出到收到对应回复（ACK或下一个DATA）的延迟
+} tftp_stats_t;
+
+// RTT估计器（Jacobson/Karels算法，整数定点运算）
+typedef struct {
+    int srtt;                           // 平滑RTT（毫秒×8），0表示尚无样本
+    int rttvar;                         // RTT平均偏差（毫秒×4）
+    int rto;                            // 当前重传超时（毫秒，含退避）
+    int fixed;                          // 是否使用协商的timeout选项（不做自适应调整）
+} tftp_rtt_t;
+
+// 时间轮参数：1毫秒刻度，4层×256槽位，覆盖约49天
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// 定时器节点（嵌入在所属结构中，插入和取消不分配内存）
+typedef struct tftp_timer {
+    struct tftp_timer* next;            // 槽位链表后继（NULL表示不在时间轮中）
+    struct tftp_timer* prev;            // 槽位链表前驱
+    ULONGLONG expires;                  // 到期时间（GetTickCount64毫秒）
+    void* owner;                        // 所属对象（引擎中为会话）
+} tftp_timer_t;
+
+// 分层时间轮
+typedef struct {
+    tftp_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // 各层槽位的链表哨兵
+    ULONGLONG current;                  // 下一个待处理的刻度
+    ULONGLONG now;                      // 本轮事件循环读取的当前时间
+    ULONGLONG now_ns;                   // 本轮事件循环读取的高精度时间（纳秒，用于延迟测量）
+    int count;                          // 轮中定时器数量
+} tftp_timer_wheel_t;
+
+// 发送队列中的一个数据包
+typedef struct {
+    SOCKET sock;                        // 已connect到客户端的传输套接字
+    char* packet;                       // 完整数据包（含头部），或分散发送时的头部，刷新前保持有效
+    int length;                         // packet的长度
+    const char* payload;                // 分散发送时的数据部分（NULL表示packet就是完整数据包）
+    int payload_length;                 // 数据部分长度
+    int segment_size;                   // 套接字的USO分段大小（0表示未启用分段卸载）
+    int* pending;                       // 所属会话的待发送计数，刷新后清零
+} tftp_send_entry_t;
+
+// 批量发送队列：每轮事件循环收集所有会话的DATA包，按套接字合并为TransmitPackets调用
+typedef struct {
+    tftp_send_entry_t entries[SEND_BATCH_SIZE];              // 待发送数据包
+    TRANSMIT_PACKETS_ELEMENT elements[SEND_BATCH_SIZE * 2];  // TransmitPackets元素数组（分散发送时每包两个元素）
+    int count;                          // 待发送数据包数
+    LPFN_TRANSMITPACKETS transmit_packets; // TransmitPackets扩展函数（NULL表示逐包发送）
+    int uso_enabled;                    // 是否对新会话启用UDP分段卸载
+    ULONGLONG packets_sent;             // 统计：已发送数据包数
+    ULONGLONG send_calls;               // 统计：发送系统调用次数
+} tftp_send_queue_t;
+
+// 文件缓存条目：一个文件某一版本的完整只读内容，所有下载会话共享
+typedef struct tftp_cache_entry {
+    struct tftp_cache_entry* hash_next; // 哈希桶链表
+    struct tftp_cache_entry* lru_prev;  // LRU链表前驱（靠近最近使用端）
+    struct tftp_cache_entry* lru_next;  // LRU链表后继（靠近淘汰端）
+    char path[512];                     // 文件路径（缓存键）
+    ULONGLONG mtime;                    // 最后修改时间（FILETIME，缓存键）
+    ULONGLONG size;                     // 文件大小（缓存键）
+    char* data;                         // 文件内容，加载后不再修改
+    int refcount;                       // 正在使用该条目的会话数（加载期间加载线程持有一个引用）
+    int stale;                          // 文件已变化或已被淘汰，最后一个引用释放时删除
+    int loading;                        // 加载线程尚未读完，不能借出
+    struct tftp_cache_entry* load_next; // 加载队列
+} tftp_cache_entry_t;
+
+// 上传写缓冲环：事件循环线程写入数据块，后台I/O线程合并写入磁盘
+typedef struct tftp_write_ring {
+    struct tftp_write_ring* next_pending; // I/O线程待处理链表
+    FILE* file;                         // 目标文件（由I/O线程写入和关闭）
+    char path[512];                     // 文件路径（放弃上传时由I/O线程删除）
+    char* buffer;                       // slots个槽位，每个槽位slot_size字节，相邻槽位首尾相接
+    int* lengths;                       // 各槽位的数据长度
+    int slot_size;                      // 槽位大小（协商的块大小）
+    int slots;                          // 槽位数
+    unsigned long head;                 // 下一个待写入磁盘的块序号（I/O线程推进）
+    unsigned long tail;                 // 下一个空闲槽位的块序号（事件循环推进）
+    int fill;                           // 按字节追加时tail处槽位已填入、尚未入队的字节数
+    int pending;                        // 是否已在I/O线程待处理链表中
+    int closing;                        // 最后一块已入队，写完后关闭文件
+    int finished;                       // 文件已关闭（所有数据已写入或已出错）
+    int error;                          // 写入失败
+    int released;                       // 会话已放弃该写缓冲环，I/O线程处理完后释放
+    int remove_file;                    // 释放时删除文件（上传未完成）
+} tftp_write_ring_t;
+
+// 只读文件映射（CreateFileMapping + MapViewOfFile）
+typedef struct {
+    HANDLE file;                        // 文件句柄（INVALID_HANDLE_VALUE表示未打开）
+    HANDLE mapping;                     // 文件映射对象（空文件为NULL）
+    const char* data;                   // 映射视图起始地址（空文件指向空字符串）
+    ULONGLONG size;                     // 文件大小
+} tftp_file_map_t;
+
+// 文件I/O后端类型
+typedef enum {
+    FILE_IO_SYNC = 0,                   // 同步后端：文件映射到内存，读请求立即完成
+    FILE_IO_IOCP                        // 异步后端：重叠ReadFile，完成通知经I/O完成端口送回事件循环
+} tftp_file_io_kind_t;
+
+// 文件I/O后端中打开的一个只读文件
+typedef struct {
+    HANDLE handle;                      // 以FILE_FLAG_OVERLAPPED打开的文件句柄（异步后端）
+    tftp_file_map_t map;                // 文件映射（同步后端）
+    ULONGLONG size;                     // 文件大小
+    int skip_port_on_success;           // 立即完成的读请求不再投递完成通知（异步后端）
+} tftp_io_file_t;
+
+// 文件读请求：由会话提交，完成后由事件循环取回
+typedef struct tftp_io_request {
+    OVERLAPPED overlapped;              // 重叠I/O结构（必须是第一个成员，完成通知据此找回请求）
+    struct tftp_io_request* next_done;  // 完成链表
+    tftp_io_file_t* file;               // 读取的文件
+    ULONGLONG offset;                   // 文件偏移
+    char* buffer;                       // 目标缓冲区
+    int length;                         // 请求读取的字节数
+    const char* data;                   // 完成后数据所在位置（buffer或文件映射中，同步后端不复制）
+    int result;                         // 完成后实际读取的字节数（-1表示失败）
+    void* owner;                        // 提交请求的会话
+    unsigned long seq;                  // 请求编号（下载预读时为读取块编号）
+    int in_flight;                      // 是否已提交且尚未被取回
+} tftp_io_request_t;
+
+typedef struct tftp_file_io tftp_file_io_t;
+
+// 文件I/O后端操作表
+typedef struct {
+    const char* name;                                               // 后端名称（日志用）
+    int needs_buffer;                                               // 读请求需要目标缓冲区（同步后端直接返回映射地址）
+    int (*init)(tftp_file_io_t* io);                                // 初始化后端资源
+    int (*open)(tftp_file_io_t* io, const char* path, tftp_io_file_t* file); // 打开只读文件
+    int (*read)(tftp_file_io_t* io, tftp_io_request_t* request);    // 提交读请求：1已完成，0进行中，-1失败
+    void (*cancel)(tftp_file_io_t* io, tftp_io_file_t* file);       // 取消文件上所有进行中的读请求
+    void (*close)(tftp_file_io_t* io, tftp_io_file_t* file);        // 关闭文件
+    void (*cleanup)(tftp_file_io_t* io);                            // 释放后端资源
+} tftp_file_io_ops_t;
+
+// 文件I/O后端实例（每个引擎一个）
+struct tftp_file_io {
+    const tftp_file_io_ops_t* ops;      // 后端操作表
+    CRITICAL_SECTION lock;              // 保护完成链表
+    tftp_io_request_t* done_head;       // 已完成、等待事件循环取回的请求
+    tftp_io_request_t* done_tail;       // 完成链表尾
+    HANDLE port;                        // I/O完成端口（异步后端）
+    HANDLE thread;                      // 完成线程（异步后端）
+    SOCKET wake_sock;                   // 唤醒套接字：完成线程向它发一个字节，使WSAPoll返回（INVALID_SOCKET表示不需要）
+    int wake_pending;                   // 已发送唤醒字节且事件循环尚未取回完成链表
+};
+
+// 下载预读器：两个读取块轮流使用，发送一个块的数据时另一个块已在读取
+typedef struct {
+    tftp_io_request_t requests[2];      // 两个读取块各自的读请求
+    char* buffers[2];                   // 读取块缓冲区（后端不需要缓冲区时为NULL）
+    unsigned long chunk_blocks;         // 每个读取块包含的数据块数（不少于窗口大小）
+    unsigned long next_chunk;           // 下一个待提交的读取块编号（读取块k包含第k * chunk_blocks + 1块起的数据块）
+    unsigned long encode_chunk;         // netascii：正在编码的读取块编号（读取块按文件偏移划分，与数据块编号无关）
+    size_t encode_pos;                  // netascii：该读取块中下一个未编码的字节
+    size_t block_fill;                  // netascii：正在填充的数据块已编码的字节数（等待读取块时保留）
+} tftp_prefetch_t;
+
+// 每个引擎（工作线程）一个的分配缓存：空闲会话和各尺寸级别的空闲缓冲区，访问不加锁
 typedef struct {
+    struct tftp_session* free_sessions; // 空闲会话
+    int free_session_count;             // 空闲会话数
+    union tftp_pool_block* free_lists[POOL_CLASS_COUNT]; // 各尺寸级别的空闲缓冲区
+    int free_counts[POOL_CLASS_COUNT];  // 各尺寸级别的空闲缓冲区数
+} tftp_pool_cache_t;
+
+// 会话状态（事件驱动引擎中每个传输是一个状态机）
+typedef enum {
+    SESSION_WAIT_OACK_ACK = 0,          // 下载：已发送OACK，等待ACK(0)
+    SESSION_SENDING,                    // 下载：窗口发送中，等待累计ACK
+    SESSION_RECEIVING,                  // 上传：等待下一个DATA包
+    SESSION_FLUSHING,                   // 上传：最后一块已入写缓冲环，等待全部写入磁盘后再确认
+    SESSION_DALLY,                      // 上传：已确认最后一块，短暂保留以重发最终ACK
+    SESSION_DONE                        // 传输结束，等待引擎回收
+} tftp_session_state_t;
+
+// 引擎的传输计数器：只由所属工作线程更新，指标端点线程汇总时读取（不加锁，读到的值可能略有滞后）
+// 按方向的数组下标为is_upload：[0]下载，[1]上传
+typedef struct {
+    ULONGLONG transfers_started[2];     // 已开始的传输数
+    ULONGLONG transfers_completed[2];   // 成功完成的传输数
+    ULONGLONG transfers_ended[2];       // 已结束的传输数（含失败，失败数 = 结束数 - 完成数）
+    ULONGLONG bytes_sent;               // 下载：已确认的数据字节数
+    ULONGLONG bytes_received;           // 上传：已接收的数据字节数
+    ULONGLONG data_packets_sent;        // 发出的DATA包数（含重传）
+    ULONGLONG retransmissions;          // 重传次数（DATA、ACK）
+    ULONGLONG timeouts;                 // 重传超时次数
+    ULONGLONG invalid_packets;          // 无效或意外的数据包数
+    tftp_histogram_t ack_latency;       // 本引擎所有传输的ACK延迟分布
+} tftp_metrics_t;
+
+// 组播传输组（RFC 2090）：同一文件、同一块大小的组播下载共用一个组，每个数据块按组发送一次
+typedef struct {
+    int in_use;                         // 槽位是否在用
+    int accepting;                      // 是否接受新客户端加入（组结束时清零）
+    char filepath[512];                 // 文件路径（组的键）
+    int block_size;                     // 块大小（组的键）
+    struct sockaddr_in group_addr;      // 组播地址和端口
+    SOCKET sock;                        // 组的传输套接字（服务器端TID，未连接，所有客户端的ACK都发到这里）
+    tftp_cache_entry_t* cache_entry;    // 文件内容来自共享缓存时的缓存条目
+    tftp_file_map_t map;                // 文件超过缓存预算时的文件映射
+    const char* data;                   // 文件内容
+    ULONGLONG size;                     // 文件大小
+    struct sockaddr_in members[MULTICAST_MAX_MEMBERS]; // 组内客户端，members[0]为主客户端（master client）
+    int member_count;                   // 组内客户端数
+    int served;                         // 已收齐文件的客户端数
+} tftp_multicast_group_t;
+
+// 客户端会话信息
+typedef struct tftp_session {
+    struct tftp_session* next_free;     // slab空闲链表（会话空闲时使用）
     struct sockaddr_in client_addr;     // 客户端地址
     int client_addr_len;                // 客户端地址长度
+    SOCKET sock;                        // 会话专用传输套接字（服务器端TID）
+    unsigned short server_port;         // 传输套接字的本地端口（网络字节序，会话表键的一部分，0表示尚未确定）
+    int registered;                     // 是否已登记到会话表（含只占位、尚未确定服务器端口的）
     FILE* file_handle;                  // 文件句柄
+    tftp_cache_entry_t* cache_entry;    // 下载：共享文件缓存条目
+    tftp_write_ring_t* write_ring;      // 上传：写缓冲环（NULL表示直接fwrite）
+    tftp_file_io_t* file_io;            // 下载：所属引擎的文件I/O后端
+    tftp_io_file_t io_file;             // 下载：通过文件I/O后端打开的文件
+    tftp_prefetch_t* prefetch;          // 下载：预读器（NULL表示不经过文件I/O后端）
+    int reads_in_flight;                // 下载：已提交但尚未取回的读请求数（非0时不能释放预读缓冲区）
+    const char* file_data;              // 下载：缓存中的文件内容（NULL表示通过预读器或file_handle读取）
+    ULONGLONG file_size;                // 下载：文件大小（缓存命中或经过预读器时有效）
+    int zero_copy;                      // 下载：窗口槽位只存头部，数据直接从缓存内容或预读缓冲区分散发送
     tftp_mode_t transfer_mode;          // 传输模式
-    unsigned short current_block;       // 当前块号
+    tftp_netascii_t netascii;           // netascii模式的转换状态（下载的读缓冲区从分配缓存分配）
+    unsigned short current_block;       // 当前块号（上传时为期望的下一块）
     char filename[MAX_FILENAME_LEN];    // 文件名
+    char filepath[512];                 // 完整文件路径
     int is_upload;                      // 是否为上传操作
     time_t last_activity;               // 最后活动时间
+    tftp_session_state_t state;         // 状态机当前状态
+    tftp_options_t options;             // 协商后的选项（OACK内容）
+    int block_size;                     // 协商后的块大小
+    int window_size;                    // 协商后的窗口大小
+    unsigned long base;                 // 下载：最早未确认的块序号
+    unsigned long next;                 // 下载：下一个待发送的块序号
+    unsigned long read_upto;            // 下载：已读入窗口缓冲区（或已首次发送）的最大块序号
+    unsigned long last_block;           // 下载：最后一块序号（0表示尚未读到文件末尾）
+    char* buffer;                       // 下载窗口缓冲区（每槽位含4字节头部，零复制时只有头部）
+    int* window_lens;                   // 窗口中各槽位的数据长度
+    ULONGLONG* send_times;              // 窗口中各槽位的首次发送时间（纳秒，0表示已重传，不采样RTT）
+    ULONGLONG ack_sent_at;              // 上传/组播：最近一个ACK/OACK/DATA的发送时间（纳秒，0表示已重传）
+    ULONGLONG last_progress;            // 最近一次传输有进展的时间
+    tftp_rtt_t rtt;                     // RTT估计与重传超时
+    int retries;                        // 连续超时次数
+    tftp_timer_t retransmit_timer;      // 重传定时器（窗口最早未确认块的截止时间）
+    tftp_timer_wheel_t* timers;         // 所属引擎的时间轮
+    tftp_send_queue_t* send_queue;      // 所属引擎的发送队列
+    tftp_pool_cache_t* pool;            // 所属引擎的分配缓存（窗口缓冲区、预读器从这里分配）
+    tftp_metrics_t* metrics;            // 所属引擎的传输计数器
+    tftp_multicast_group_t* multicast;  // 组播下载：会话驱动的组（client_addr为创建组的客户端）
+    int queued_packets;                 // 已入队但尚未发出的数据包数（非0时不能改写窗口缓冲区）
+    int segment_size;                   // 传输套接字的USO分段大小（0表示逐包发送）
+    int completed;                      // 传输是否成功完成
+    tftp_stats_t stats;                 // 传输统计
+    tftp_log_limiter_t log_limits[LOG_EVENT_COUNT]; // 热路径日志的按类别限速
 } tftp_session_t;
 
-// 传输统计信息
+// 传输引擎配置
 typedef struct {
-    size_t bytes_transferred;           // 传输字节数
-    time_t start_time;                  // 开始时间
-    time_t end_time;                    // 结束时间
-    int blocks_sent;                    // 发送的数据块数
-    int retransmissions;                // 重传次数
-} tftp_stats_t;
+    int use_uso;                        // 下载窗口使用UDP分段卸载（USO）整块发送
+    size_t cache_budget;                // 进程级文件缓存的内存预算（字节，0表示禁用）
+    tftp_file_io_kind_t file_io;        // 未进入缓存的下载使用的文件I/O后端
+} tftp_engine_config_t;
+
+// 事件驱动传输引擎：单线程通过WSAPoll复用监听套接字和所有会话套接字
+typedef struct {
+    SOCKET listen_sock;                 // 69端口监听套接字
+    tftp_session_t** sessions;          // 活动会话数组
+    int session_count;                  // 活动会话数
+    int session_capacity;               // 会话数组容量
+    WSAPOLLFD* poll_fds;                // poll数组：[0]为监听套接字，[i + 1]对应sessions[i]，末尾为文件I/O唤醒套接字
+    char* recv_buffer;                  // 共享接收缓冲区（按最大块大小分配）
+    int recv_buffer_size;               // 接收缓冲区大小
+    tftp_timer_wheel_t timers;          // 所有会话共享的重传时间轮
+    tftp_send_queue_t send_queue;       // 所有会话共享的批量发送队列
+    tftp_timer_t stats_timer;           // 定期输出发送批量统计的定时器
+    tftp_file_io_t file_io;             // 文件I/O后端
+    tftp_pool_cache_t pool;             // 会话和缓冲区的线程分配缓存
+    tftp_log_limiter_t log_limits[LOG_EVENT_COUNT]; // 监听套接字热路径日志的按类别限速
+    tftp_metrics_t metrics;             // 本引擎的传输计数器
+    volatile int running;               // 运行标志
+} tftp_engine_t;
 
 // 函数声明
 void init_winsock(void);
 void cleanup_winsock(void);
 int create_tftp_socket(void);
 void log_message(const char* level, const char* message, ...);
+void log_set_redirect(void (*redirect)(const char* level, const char* message, va_list args));
+void log_message_limited(tftp_log_limiter_t* limits, tftp_log_event_t event,
+                         const char* level, const char* message, ...);
+void log_limits_report(tftp_log_limiter_t* limits, const struct sockaddr_in* client_addr);
+unsigned long log_suppressed_count(void);
 int send_error_packet(SOCKET sock, struct sockaddr_in* client_addr, 
                      tftp_error_code_t error_code, const char* error_msg);
 int send_ack_packet(SOCKET sock, struct sockaddr_in* client_addr, 
                    unsigned short block_num);
 int send_data_packet(SOCKET sock, struct sockaddr_in* client_addr, 
                     unsigned short block_num, char* data, int data_len);
-void handle_rrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr);
-void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr);
-void handle_data(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr);
-void handle_ack(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr);
+int send_data_block(SOCKET sock, struct sockaddr_in* client_addr, 
+                   unsigned short block_num, char* packet, int data_len);
+void write_data_header(char* packet, unsigned short block_num);
+int parse_tftp_options(const char* buffer, int buffer_len, tftp_options_t* options);
+int negotiate_options(const tftp_options_t* requested, int is_upload, tftp_options_t* accepted);
+int send_oack_packet(SOCKET sock, struct sockaddr_in* client_addr, 
+                    const tftp_options_t* options);
+void netascii_init(tftp_netascii_t* state, char* input);
+size_t netascii_encode(tftp_netascii_t* state, const char* in, size_t in_len, size_t* consumed,
+                       char* out, size_t out_size);
+void netascii_encode_end(tftp_netascii_t* state);
+size_t netascii_read(tftp_netascii_t* state, FILE* file, char* out, size_t out_size);
+size_t netascii_decode(tftp_netascii_t* state, const char* in, size_t in_len, char* out);
+size_t netascii_decode_end(tftp_netascii_t* state, char* out);
+int netascii_file_size(FILE* file, ULONGLONG* size);
+int upload_space_available(ULONGLONG size);
+void reserve_file_space(FILE* file, ULONGLONG size);
+void rtt_init(tftp_rtt_t* rtt, int timeout_option);
+void rtt_update(tftp_rtt_t* rtt, tftp_stats_t* stats, int sample_ms);
+void rtt_backoff(tftp_rtt_t* rtt);
+void handle_rrq(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr);
+void handle_wrq(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr);
+void handle_data(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr);
+void handle_ack(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr);
+int parse_tftp_packet(const char* buffer, int buffer_len, tftp_packet_view_t* packet);
+void thread_safe_log(const char* level, const char* message, ...);
+void thread_safe_vlog(const char* level, const char* message, va_list args);
+int log_init(const char* path, tftp_log_level_t min_level);
+void log_cleanup(void);
+tftp_log_level_t log_parse_level(const char* level);
+unsigned long log_dropped_count(void);
+void timer_wheel_init(tftp_timer_wheel_t* wheel, ULONGLONG now);
+void timer_wheel_set_time(tftp_timer_wheel_t* wheel, ULONGLONG now);
+void timer_wheel_schedule(tftp_timer_wheel_t* wheel, tftp_timer_t* timer, ULONGLONG delay_ms);
+void timer_wheel_cancel(tftp_timer_wheel_t* wheel, tftp_timer_t* timer);
+void timer_wheel_advance(tftp_timer_wheel_t* wheel,
+                         void (*on_expire)(tftp_timer_t* timer, void* context), void* context);
+int timer_wheel_next_timeout(tftp_timer_wheel_t* wheel, int max_wait_ms);
+void file_cache_init(size_t budget_bytes);
+tftp_cache_entry_t* file_cache_acquire(const char* path);
+void file_cache_release(tftp_cache_entry_t* entry);
+int file_cache_tsize(const char* path, int netascii, ULONGLONG* tsize);
+void file_cache_cleanup(void);
+int write_behind_init(void);
+void write_behind_cleanup(void);
+tftp_write_ring_t* write_ring_create(tftp_pool_cache_t* cache, FILE* file, const char* path, int block_size);
+int write_ring_full(tftp_write_ring_t* ring);
+int write_ring_push(tftp_write_ring_t* ring, const char* data, int length);
+int write_ring_append(tftp_write_ring_t* ring, const char* data, int length);
+void write_ring_close(tftp_write_ring_t* ring);
+int write_ring_status(tftp_write_ring_t* ring);
+void write_ring_release(tftp_write_ring_t* ring, int remove_file);
+int file_map_open(const char* path, tftp_file_map_t* map);
+void file_map_close(tftp_file_map_t* map);
+void session_table_init(void);
+void session_table_cleanup(void);
+tftp_session_t* session_table_alloc(tftp_pool_cache_t* cache);
+void session_table_free(tftp_pool_cache_t* cache, tftp_session_t* session);
+void session_table_release_cache(tftp_pool_cache_t* cache);
+int session_table_claim(tftp_session_t* session);
+int session_table_insert(tftp_session_t* session);
+void session_table_remove(tftp_session_t* session);
+int session_table_contains(const struct sockaddr_in* client_addr, unsigned short server_port);
+int session_table_count(void);
+void session_table_foreach(void (*visit)(const tftp_session_t* session, void* context), void* context);
+int socket_pool_init(int port_low, int port_high);
+SOCKET socket_pool_acquire(const struct sockaddr_in* client_addr);
+void socket_pool_release(SOCKET sock, int reusable);
+int socket_pool_idle_count(void);
+void socket_pool_cleanup(void);
+int multicast_init(const char* base_addr, int port);
+int multicast_enabled(void);
+int multicast_start(const char* filepath, int block_size, const struct sockaddr_in* client_addr,
+                    tftp_options_t* accepted, tftp_multicast_group_t** created);
+void multicast_option_value(const tftp_multicast_group_t* group, int master, tftp_options_t* options);
+int multicast_master(tftp_multicast_group_t* group, struct sockaddr_in* master);
+int multicast_leave(tftp_multicast_group_t* group, const struct sockaddr_in* client_addr, int served);
+void multicast_release(tftp_multicast_group_t* group);
+void multicast_cleanup(void);
+void pool_init(void);
+void pool_cleanup(void);
+void* pool_alloc(tftp_pool_cache_t* cache, size_t size);
+void* pool_calloc(tftp_pool_cache_t* cache, size_t size);
+void pool_free(tftp_pool_cache_t* cache, void* ptr);
+void pool_cache_release(tftp_pool_cache_t* cache);
+void pool_get_stats(size_t* heap_bytes, unsigned long* heap_allocs);
+int metrics_init(int port);
+void metrics_register(tftp_metrics_t* metrics);
+void metrics_cleanup(void);
+int file_io_init(tftp_file_io_t* io, tftp_file_io_kind_t kind);
+int file_io_open(tftp_file_io_t* io, const char* path, tftp_io_file_t* file);
+int file_io_read(tftp_file_io_t* io, tftp_io_request_t* request);
+void file_io_cancel(tftp_file_io_t* io, tftp_io_file_t* file);
+void file_io_close(tftp_file_io_t* io, tftp_io_file_t* file);
+int file_io_reap(tftp_file_io_t* io, void (*on_complete)(tftp_io_request_t* request, void* context),
+                 void* context);
+void file_io_cleanup(tftp_file_io_t* io);
+void send_queue_init(tftp_send_queue_t* queue, SOCKET probe_sock);
+int send_queue_enable_uso(tftp_send_queue_t* queue, SOCKET sock, int segment_size);
+int send_queue_disable_uso(SOCKET sock);
+void send_queue_push(tftp_send_queue_t* queue, SOCKET sock, char* packet, int length,
+                     int segment_size, int* pending);
+void send_queue_push_gather(tftp_send_queue_t* queue, SOCKET sock, char* header, int header_length,
+                            const char* payload, int payload_length, int* pending);
+void send_queue_flush(tftp_send_queue_t* queue);
+int tftp_engine_init(tftp_engine_t* engine, SOCKET listen_sock, const tftp_engine_config_t* config);
+void tftp_engine_run(tftp_engine_t* engine);
+void tftp_engine_cleanup(tftp_engine_t* engine);
 tftp_mode_t parse_mode(const char* mode_str);
 const char* get_error_message(tftp_error_code_t error_code);
 void print_throughput(tftp_stats_t* stats);
+ULONGLONG timing_now_ns(void);
+void histogram_record(tftp_histogram_t* histogram, ULONGLONG value_ns);
+void histogram_merge(tftp_histogram_t* target, const tftp_histogram_t* source);
+ULONGLONG histogram_percentile(const tftp_histogram_t* histogram, double quantile);
 
 #endif // TFTP_H
\ No newline at end of file
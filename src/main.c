@@ -1,121 +1,5 @@
 #include "../include/tftp.h"
 
-/**
- * 解析接收到的TFTP协议数据包
- * 
- * 功能说明：
- * - 解析UDP数据包中的TFTP协议内容
- * - 根据操作码解析不同类型的TFTP包
- * - 验证数据包格式的完整性和合法性
- * - 提取文件名、传输模式、数据块等信息
- * 
- * TFTP数据包类型：
- * - RRQ/WRQ: 读/写请求包
- * - DATA: 数据包
- * - ACK: 确认包
- * - ERROR: 错误包
- * 
- * 参数：
- * - buffer: 原始数据缓冲区
- * - buffer_len: 缓冲区长度
- * - packet: 解析后的TFTP包结构指针
- * 
- * 返回值：
- * - 成功：0
- * - 失败：-1（包格式错误或长度不足）
- */
-int parse_tftp_packet(char* buffer, int buffer_len, tftp_packet_t* packet) {
-    // 检查数据包最小长度（至少包含2字节操作码）
-    if (buffer_len < 2) {
-        return -1; // 包长度不足
-    }
-    
-    // 提取操作码（网络字节序转主机字节序）
-    packet->opcode = ntohs(*(unsigned short*)buffer);
-    
-    // 根据操作码解析不同类型的数据包
-    switch (packet->opcode) {
-        case TFTP_RRQ:              // 读请求（客户端下载文件）
-        case TFTP_WRQ: {            // 写请求（客户端上传文件）
-            // RRQ/WRQ包格式：操作码(2) + 文件名(变长) + 0 + 模式(变长) + 0
-            char* ptr = buffer + 2;                      // 跳过操作码
-            int remaining = buffer_len - 2;              // 剩余数据长度
-            
-            // 解析文件名（以null结尾的字符串）
-            int filename_len = strnlen(ptr, remaining);
-            if (filename_len >= remaining || filename_len >= MAX_FILENAME_LEN) {
-                return -1; // 文件名长度非法
-            }
-            
-            strcpy(packet->request.filename, ptr);       // 复制文件名
-            ptr += filename_len + 1;                     // 跳过文件名和null终止符
-            remaining -= filename_len + 1;
-            
-            // 解析传输模式（"netascii"或"octet"）
-            int mode_len = strnlen(ptr, remaining);
-            if (mode_len >= remaining || mode_len >= MAX_MODE_LEN) {
-                return -1; // 模式字符串格式错误
-            }
-            
-            strcpy(packet->request.mode, ptr);           // 复制传输模式
-            break;
-        }
-        
-        case TFTP_DATA: {           // 数据包
-            // DATA包格式：操作码(2) + 块号(2) + 数据(0-512字节)
-            if (buffer_len < 4) {
-                return -1; // 数据包头部不完整
-            }
-            
-            // 提取数据块号
-            packet->data.block_num = ntohs(*(unsigned short*)(buffer + 2));
-            
-            // 提取数据内容
-            int data_len = buffer_len - 4;
-            if (data_len > DATA_SIZE) {
-                return -1; // 数据长度超出TFTP协议限制
-            }
-            memcpy(packet->data.data, buffer + 4, data_len);
-            break;
-        }
-        
-        case TFTP_ACK: {            // 确认包
-            // ACK包格式：操作码(2) + 块号(2)，固定4字节长度
-            if (buffer_len != 4) {
-                return -1; // ACK包大小必须是4字节
-            }
-            // 提取确认的数据块号
-            packet->ack.block_num = ntohs(*(unsigned short*)(buffer + 2));
-            break;
-        }
-        
-        case TFTP_ERROR: {          // 错误包
-            // ERROR包格式：操作码(2) + 错误码(2) + 错误消息(变长) + 0
-            if (buffer_len < 4) {
-                return -1; // 错误包头部至少4字节
-            }
-            
-            // 提取错误码
-            packet->error.error_code = ntohs(*(unsigned short*)(buffer + 2));
-            
-            // 提取错误消息
-            int msg_len = buffer_len - 4;
-            if (msg_len > 0 && msg_len < 512) {
-                memcpy(packet->error.error_msg, buffer + 4, msg_len);
-                packet->error.error_msg[msg_len] = '\0'; // 确保字符串正确结束
-            } else {
-                packet->error.error_msg[0] = '\0';       // 空错误消息
-            }
-            break;
-        }
-        
-        default:
-            return -1; // 未知的TFTP操作码
-    }
-    
-    return 0;      // 解析成功
-}
-
 /**
  * 显示TFTP服务器使用帮助和配置信息
  * 
@@ -134,6 +18,10 @@ void show_help(void) {
     printf("  - File upload (WRQ)\n");                     // 支持文件上传
     printf("  - netascii and octet transfer modes\n");     // 支持两种传输模式
     printf("  - Error handling and retransmission\n");     // 错误处理和重传机制
+    printf("  - windowsize option (RFC 7440) for downloads\n"); // 滑动窗口下载
+    printf("  - blksize option (RFC 2348), up to %d bytes\n", MAX_BLOCK_SIZE); // 大数据块
+    printf("  - timeout option (RFC 2349), %d-%d seconds\n", MIN_TIMEOUT_OPTION, MAX_TIMEOUT_OPTION); // 协商超时
+    printf("  - tsize option (RFC 2349)\n");               // 传输大小
     printf("  - Transfer statistics and logging\n\n");     // 传输统计和日志功能
     
     printf("Server configuration:\n");
@@ -248,6 +136,8 @@ int main(int argc, char* argv[]) {
     char buffer[BUFFER_SIZE];                            // UDP数据接收缓冲区
     struct sockaddr_in client_addr;                      // 客户端地址信息
     int client_addr_len = sizeof(client_addr);           // 地址结构长度
+    tftp_log_limiter_t log_limits[LOG_EVENT_COUNT];      // 监听套接字上无效数据包日志的限速
+    memset(log_limits, 0, sizeof(log_limits));
     
     // 主服务循环：持续监听和处理客户端请求
     while (1) {
@@ -267,14 +157,14 @@ int main(int argc, char* argv[]) {
         
         // 检查是否收到空数据包
         if (recv_result == 0) {
-            log_message("WARNING", "Received empty packet");
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING", "Received empty packet");
             continue;
         }
         
         // 解析接收到的TFTP协议数据包
-        tftp_packet_t packet;
+        tftp_packet_view_t packet;
         if (parse_tftp_packet(buffer, recv_result, &packet) < 0) {
-            log_message("WARNING", "Received invalid TFTP packet");
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING", "Received invalid TFTP packet");
             // 发送错误包通知客户端数据包格式有误
             send_error_packet(server_sock, &client_addr, 
                             TFTP_ERROR_ILLEGAL_OPERATION, "Invalid packet format");
@@ -303,20 +193,20 @@ int main(int argc, char* argv[]) {
             case TFTP_ACK:
                 // DATA和ACK包不应该发送到主服务器端口（69端口）
                 // 这些包应该发送到数据传输端口
-                log_message("WARNING", "Received unexpected %s packet", 
-                           (packet.opcode == TFTP_DATA) ? "DATA" : "ACK");
+                log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING", "Received unexpected %s packet",
+                                    (packet.opcode == TFTP_DATA) ? "DATA" : "ACK");
                 send_error_packet(server_sock, &client_addr, 
                                 TFTP_ERROR_UNKNOWN_TID, "Unknown transfer ID");
                 break;
                 
             case TFTP_ERROR:
                 // 记录客户端发送的错误信息
-                log_message("INFO", "Client reported error: %s", packet.error.error_msg);
+                log_message("INFO", "Client reported error: %.*s", packet.payload_len, packet.payload);
                 break;
                 
             default:
                 // 处理未知的操作码
-                log_message("WARNING", "Received unknown opcode: %d", packet.opcode);
+                log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING", "Received unknown opcode: %d", packet.opcode);
                 send_error_packet(server_sock, &client_addr, 
                                 TFTP_ERROR_ILLEGAL_OPERATION, "Unsupported operation");
                 break;
@@ -0,0 +1,287 @@
+#include "../include/tftp.h"
+
+/*
+ * 批量发送队列（事件驱动引擎使用）
+ *
+ * 设计思路：
+ * - 会话发送窗口时不再逐块调用sendto，而是把数据包追加到引擎的发送队列，
+ *   每轮事件循环结束时统一刷新
+ * - 刷新时同一套接字上连续的数据包合并为一次TransmitPackets调用，
+ *   每个元素带TP_ELEMENT_EOP标志，保证一个元素对应一个UDP数据报
+ * - TransmitPackets要求数据报套接字已connect，传输套接字创建时已连接到客户端
+ * - TransmitPackets不可用或调用失败时回退为逐包send，不影响正确性
+ * - 可选的UDP分段卸载（USO，Windows上对应Linux的GSO）：传输套接字设置
+ *   UDP_SEND_MSG_SIZE后，窗口缓冲区中内存连续的整块数据包直接作为一个大缓冲区
+ *   一次send，由协议栈或网卡切分为数据报，无需复制
+ * - 分散发送（零复制）：数据包可以由头部和数据两部分组成，数据部分直接指向
+ *   文件缓存或文件映射，TransmitPackets用两个元素（第二个带EOP）组成一个数据报，
+ *   逐包发送时用两个WSABUF的WSASend
+ */
+
+/**
+ * 初始化发送队列并获取TransmitPackets扩展函数指针
+ *
+ * 参数：
+ * - queue: 发送队列
+ * - probe_sock: 用于查询扩展函数的任一UDP套接字
+ */
+void send_queue_init(tftp_send_queue_t* queue, SOCKET probe_sock) {
+    GUID transmit_packets_guid = WSAID_TRANSMITPACKETS;
+    DWORD bytes_returned = 0;
+
+    memset(queue, 0, sizeof(*queue));
+    if (WSAIoctl(probe_sock, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &transmit_packets_guid, sizeof(transmit_packets_guid),
+                 &queue->transmit_packets, sizeof(queue->transmit_packets),
+                 &bytes_returned, NULL, NULL) == SOCKET_ERROR) {
+        queue->transmit_packets = NULL;
+        thread_safe_log("WARNING", "TransmitPackets unavailable (%d), sending DATA packets one by one",
+                       WSAGetLastError());
+    }
+}
+
+/**
+ * 为传输套接字启用UDP分段卸载
+ *
+ * 功能说明：
+ * - 设置UDP_SEND_MSG_SIZE后，该套接字上超过segment_size的发送被切分为
+ *   segment_size大小的数据报（最后一个可以更短），不超过的照常作为一个数据报
+ * - 协议栈不支持时关闭整个队列的USO，之后的会话不再尝试
+ *
+ * 参数：
+ * - queue: 发送队列
+ * - sock: 传输套接字
+ * - segment_size: 分段大小（即一个完整DATA包的长度）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（调用者按逐包发送处理）
+ */
+int send_queue_enable_uso(tftp_send_queue_t* queue, SOCKET sock, int segment_size) {
+    DWORD size = (DWORD)segment_size;
+
+    if (!queue->uso_enabled) {
+        return -1;
+    }
+    if (setsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*)&size, sizeof(size)) == SOCKET_ERROR) {
+        thread_safe_log("WARNING", "UDP segmentation offload unavailable (%d), sending DATA packets individually",
+                       WSAGetLastError());
+        queue->uso_enabled = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 关闭传输套接字的UDP分段卸载（套接字还回套接字池之前调用）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（调用者不应再复用该套接字）
+ */
+int send_queue_disable_uso(SOCKET sock) {
+    DWORD size = 0;
+    return (setsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*)&size, sizeof(size)) == SOCKET_ERROR) ? -1 : 0;
+}
+
+/**
+ * 逐包发送队列中的一段数据包（TransmitPackets不可用或失败时使用）
+ */
+static void send_queue_send_each(tftp_send_queue_t* queue, int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        tftp_send_entry_t* entry = &queue->entries[i];
+        int result;
+
+        if (entry->payload != NULL) {
+            WSABUF buffers[2];
+            DWORD bytes_sent = 0;
+            buffers[0].buf = entry->packet;
+            buffers[0].len = (ULONG)entry->length;
+            buffers[1].buf = (char*)entry->payload;
+            buffers[1].len = (ULONG)entry->payload_length;
+            result = WSASend(entry->sock, buffers, 2, &bytes_sent, 0, NULL, NULL);
+        } else {
+            result = send(entry->sock, entry->packet, entry->length, 0);
+        }
+
+        if (result == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK && error != WSAECONNRESET) {
+                thread_safe_log("ERROR", "Failed to send data packet: %d", error);
+            }
+            // 发送缓冲区满时丢弃，由重传定时器恢复
+        }
+        queue->send_calls++;
+    }
+}
+
+/**
+ * 用一次TransmitPackets发送同一套接字上的一段数据包
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（调用者回退为逐包发送）
+ */
+static int send_queue_transmit(tftp_send_queue_t* queue, int first, int count) {
+    int element_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        tftp_send_entry_t* entry = &queue->entries[first + i];
+        TRANSMIT_PACKETS_ELEMENT* element = &queue->elements[element_count++];
+
+        element->dwElFlags = TP_ELEMENT_MEMORY | TP_ELEMENT_EOP;   // 带EOP的元素结束一个数据报
+        element->cLength = (ULONG)entry->length;
+        element->pBuffer = entry->packet;
+
+        if (entry->payload != NULL) {
+            // 头部和数据合成一个数据报：只有数据元素带EOP
+            element->dwElFlags = TP_ELEMENT_MEMORY;
+            element = &queue->elements[element_count++];
+            element->dwElFlags = TP_ELEMENT_MEMORY | TP_ELEMENT_EOP;
+            element->cLength = (ULONG)entry->payload_length;
+            element->pBuffer = (PVOID)entry->payload;
+        }
+    }
+
+    queue->send_calls++;
+    if (!queue->transmit_packets(queue->entries[first].sock, queue->elements, (DWORD)element_count, 0, NULL, 0)) {
+        int error = WSAGetLastError();
+        if (error == WSAEOPNOTSUPP || error == WSAEINVAL) {
+            // 协议栈不支持时不再尝试，之后一律逐包发送
+            thread_safe_log("WARNING", "TransmitPackets failed (%d), falling back to per-packet sends", error);
+            queue->transmit_packets = NULL;
+        }
+        // 其他错误（发送缓冲区满、客户端已离开时的WSAECONNRESET等）只属于这个套接字，
+        // 这一段改为逐包发送，其他会话仍批量发送
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 用UDP分段卸载发送同一套接字上的一段数据包
+ *
+ * 功能说明：
+ * - 在内存中首尾相接、且除最后一个外长度都等于分段大小的数据包合并为一次send
+ * - 窗口缓冲区是环形的，回绕处无法拼接，拆成两次发送
+ * - 合并发送失败时该段回退为逐包发送
+ */
+static void send_queue_send_segmented(tftp_send_queue_t* queue, int first, int count) {
+    int end = first + count;
+    int i = first;
+
+    while (i < end) {
+        tftp_send_entry_t* head = &queue->entries[i];
+        int segment_size = head->segment_size;
+        int total = head->length;
+        int j = i + 1;
+
+        while (j < end &&
+               queue->entries[j - 1].length == segment_size &&
+               queue->entries[j].packet == queue->entries[j - 1].packet + segment_size &&
+               total + queue->entries[j].length <= USO_MAX_SEND_BYTES) {
+            total += queue->entries[j].length;
+            j++;
+        }
+
+        if (j - i == 1) {
+            send_queue_send_each(queue, i, 1);
+        } else {
+            queue->send_calls++;
+            if (send(head->sock, head->packet, total, 0) == SOCKET_ERROR) {
+                int error = WSAGetLastError();
+                if (error != WSAEWOULDBLOCK && error != WSAECONNRESET) {
+                    thread_safe_log("WARNING", "Segmented send of %d bytes failed (%d), resending packets individually",
+                                   total, error);
+                    send_queue_send_each(queue, i, j - i);
+                }
+            }
+        }
+        i = j;
+    }
+}
+
+/**
+ * 发送队列中的所有数据包并清空队列
+ *
+ * 功能说明：
+ * - 同一套接字上连续的数据包只需一次系统调用（单个数据包直接send），
+ *   启用了USO的套接字按内存连续的段合并发送
+ * - 发送后把各会话的待发送计数清零，会话可以安全地复用窗口缓冲区
+ */
+void send_queue_flush(tftp_send_queue_t* queue) {
+    int first = 0;
+
+    while (first < queue->count) {
+        int count = 1;
+        while (first + count < queue->count &&
+               queue->entries[first + count].sock == queue->entries[first].sock) {
+            count++;
+        }
+
+        if (queue->entries[first].segment_size > 0) {
+            send_queue_send_segmented(queue, first, count);
+        } else if (count == 1 || queue->transmit_packets == NULL ||
+                   send_queue_transmit(queue, first, count) < 0) {
+            send_queue_send_each(queue, first, count);
+        }
+
+        for (int i = first; i < first + count; i++) {
+            *queue->entries[i].pending = 0;
+        }
+        queue->packets_sent += (ULONGLONG)count;
+        first += count;
+    }
+
+    queue->count = 0;
+}
+
+/**
+ * 把一个完整的数据包（含头部）加入发送队列，队列满时先刷新
+ *
+ * 参数：
+ * - queue: 发送队列
+ * - sock: 已connect到客户端的传输套接字
+ * - packet: 数据包，刷新前必须保持有效且内容不变
+ * - length: 数据包长度
+ * - segment_size: 套接字的USO分段大小（0表示未启用）
+ * - pending: 所属会话的待发送计数（加1，刷新后清零）
+ */
+void send_queue_push(tftp_send_queue_t* queue, SOCKET sock, char* packet, int length,
+                     int segment_size, int* pending) {
+    if (queue->count == SEND_BATCH_SIZE) {
+        send_queue_flush(queue);
+    }
+
+    tftp_send_entry_t* entry = &queue->entries[queue->count++];
+    entry->sock = sock;
+    entry->packet = packet;
+    entry->length = length;
+    entry->payload = NULL;
+    entry->payload_length = 0;
+    entry->segment_size = segment_size;
+    entry->pending = pending;
+    (*pending)++;
+}
+
+/**
+ * 把由头部和数据两部分组成的数据包加入发送队列（零复制发送）
+ *
+ * 参数：
+ * - queue: 发送队列
+ * - sock: 已connect到客户端的传输套接字
+ * - header: 数据包头部，刷新前必须保持有效且内容不变
+ * - header_length: 头部长度
+ * - payload: 数据部分（指向只读的文件内容），刷新前必须保持有效
+ * - payload_length: 数据部分长度（0表示只发送头部）
+ * - pending: 所属会话的待发送计数（加1，刷新后清零）
+ */
+void send_queue_push_gather(tftp_send_queue_t* queue, SOCKET sock, char* header, int header_length,
+                            const char* payload, int payload_length, int* pending) {
+    send_queue_push(queue, sock, header, header_length, 0, pending);
+    if (payload_length > 0) {
+        tftp_send_entry_t* entry = &queue->entries[queue->count - 1];
+        entry->payload = payload;
+        entry->payload_length = payload_length;
+    }
+}
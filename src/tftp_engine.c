@@ -0,0 +1,1739 @@
+#include "../include/tftp.h"
+#include <io.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * 事件驱动的TFTP传输引擎（多线程版本服务器使用）
+ *
+ * 设计思路：
+ * - 不再为每个请求创建线程，而是由一个事件循环通过WSAPoll同时等待
+ *   69端口监听套接字和所有会话的传输套接字
+ * - 每个传输是一个小型状态机（块号、重试次数、重传截止时间），
+ *   收到数据包或超时时推进状态，任何操作都不会阻塞事件循环
+ * - 重传截止时间统一挂在分层时间轮上（tftp_timer.c），每轮循环只推进一次，
+ *   不再逐个会话扫描截止时间
+ * - DATA包进入批量发送队列（tftp_batch.c），每轮循环结束时统一发出
+ * - 下载按窗口提前向文件I/O后端（tftp_fileio.c）提交读请求，读完成后才发送，
+ *   上传数据交给写后台化I/O线程（tftp_writer.c），事件循环不等待磁盘读写
+ * - 会话结构和会话的各类缓冲区从本引擎的分配缓存中取用（tftp_pool.c），
+ *   稳定运行时接纳和结束传输都不再调用malloc/free
+ * - 并发传输数只受内存限制，不再受线程数和线程栈大小限制
+ */
+
+#define ENGINE_MAX_POLL_WAIT_MS 1000    // 单次WSAPoll最长等待时间（毫秒）
+#define ENGINE_RECV_BURST 64            // 每次就绪事件最多连续接收的数据包数
+#define ENGINE_STATS_INTERVAL_MS 10000  // 发送批量统计的输出间隔（毫秒）
+#define ENGINE_WRITE_POLL_MS 2          // 有上传等待磁盘写入时WSAPoll的最长等待时间（毫秒）
+
+/**
+ * 按当前重传超时（RTO）重置会话的重传截止时间
+ *
+ * 说明：
+ * - 回退重传总是从最早未确认的块开始，因此每个会话只需一个定时器，
+ *   跟踪窗口中最早未确认块的截止时间
+ */
+static void session_set_deadline(tftp_session_t* session) {
+    timer_wheel_schedule(session->timers, &session->retransmit_timer, (ULONGLONG)session->rtt.rto);
+}
+
+/**
+ * 记录一个RTT样本（样本为本轮的高精度时间 - sent_at，sent_at为0表示包已重传，按Karn算法不采样）
+ * 样本按纳秒计入会话和引擎的延迟直方图，按毫秒更新RTT估计器
+ */
+static void session_sample_rtt(tftp_session_t* session, ULONGLONG sent_at) {
+    ULONGLONG now_ns = session->timers->now_ns;
+
+    session->last_progress = session->timers->now;
+    if (sent_at != 0 && now_ns >= sent_at) {
+        ULONGLONG latency_ns = now_ns - sent_at;
+        rtt_update(&session->rtt, &session->stats, (int)(latency_ns / 1000000));
+        histogram_record(&session->stats.ack_latency, latency_ns);
+        histogram_record(&session->metrics->ack_latency, latency_ns);
+    }
+}
+
+/**
+ * 以（客户端地址，客户端端口，服务器端口）把会话登记到会话表（session->sock必须已设置）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（已向客户端回复错误）
+ */
+static int session_register(tftp_session_t* session) {
+    struct sockaddr_in local_addr;
+    int local_addr_len = sizeof(local_addr);
+
+    if (getsockname(session->sock, (struct sockaddr*)&local_addr, &local_addr_len) == SOCKET_ERROR) {
+        thread_safe_log("ERROR", "Failed to query transfer socket port: %d", WSAGetLastError());
+        send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return -1;
+    }
+    session->server_port = local_addr.sin_port;
+    if (session_table_insert(session) < 0) {
+        session->server_port = 0;
+        thread_safe_log("ERROR", "Failed to register session");
+        send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 从套接字池借出传输套接字（已连接到客户端），并登记到会话表
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（已向客户端回复错误）
+ */
+static int session_open_socket(tftp_engine_t* engine, tftp_session_t* session) {
+    session->sock = socket_pool_acquire(&session->client_addr);
+    if (session->sock == INVALID_SOCKET) {
+        thread_safe_log("ERROR", "No data transfer socket available");
+        send_error_packet(engine->listen_sock, &session->client_addr, TFTP_ERROR_NOT_DEFINED, "Server busy");
+        return -1;
+    }
+    return session_register(session);
+}
+
+/**
+ * 为新传输分配会话并加入引擎
+ *
+ * 返回值：
+ * - 成功：新会话指针（各字段已清零，套接字为INVALID_SOCKET）
+ * - 失败：NULL（内存不足）
+ */
+static tftp_session_t* engine_add_session(tftp_engine_t* engine) {
+    if (engine->session_count == engine->session_capacity) {
+        int new_capacity = engine->session_capacity * 2;
+        tftp_session_t** sessions = (tftp_session_t**)realloc(engine->sessions,
+                                        (size_t)new_capacity * sizeof(tftp_session_t*));
+        if (sessions == NULL) {
+            return NULL;
+        }
+        engine->sessions = sessions;
+
+        WSAPOLLFD* poll_fds = (WSAPOLLFD*)realloc(engine->poll_fds,
+                                  (size_t)(new_capacity + 2) * sizeof(WSAPOLLFD));
+        if (poll_fds == NULL) {
+            return NULL;
+        }
+        engine->poll_fds = poll_fds;
+        engine->session_capacity = new_capacity;
+    }
+
+    tftp_session_t* session = session_table_alloc(&engine->pool);
+    if (session == NULL) {
+        return NULL;
+    }
+    session->sock = INVALID_SOCKET;
+    session->timers = &engine->timers;
+    session->send_queue = &engine->send_queue;
+    session->pool = &engine->pool;
+    session->metrics = &engine->metrics;
+    session->file_io = &engine->file_io;
+    session->retransmit_timer.owner = session;
+
+    engine->sessions[engine->session_count++] = session;
+    return session;
+}
+
+/**
+ * 为新的单播传输分配会话，并按客户端TID在会话表中占位
+ *
+ * 功能说明：
+ * - 在打开文件之前占位：初始化会话期间，
+ *   客户端重发的请求被另一个工作线程取到时也会占位失败，不会开始第二个传输
+ *
+ * 返回值：
+ * - 成功：新会话指针（client_addr已设置）
+ * - 失败：NULL（同一客户端TID已有传输时忽略该请求，内存不足时已回复错误）
+ */
+static tftp_session_t* engine_claim_session(tftp_engine_t* engine, struct sockaddr_in* client_addr) {
+    tftp_session_t* session = engine_add_session(engine);
+    if (session == NULL) {
+        thread_safe_log("ERROR", "Failed to allocate session");
+        send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return NULL;
+    }
+    session->client_addr = *client_addr;
+    session->client_addr_len = sizeof(*client_addr);
+
+    int result = session_table_claim(session);
+    if (result != 0) {
+        // 会话还没有占用任何资源，直接撤销engine_add_session
+        engine->session_count--;
+        session_table_free(&engine->pool, session);
+        if (result > 0) {
+            log_message_limited(engine->log_limits, LOG_EVENT_DUPLICATE, "WARNING",
+                                "Ignoring duplicate request from %s:%d, transfer already in progress",
+                                inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
+        } else {
+            thread_safe_log("ERROR", "Failed to register session");
+            send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        }
+        return NULL;
+    }
+    return session;
+}
+
+/**
+ * 释放预读器（调用前所有读请求必须已取回）
+ */
+static void prefetch_free(tftp_pool_cache_t* pool, tftp_prefetch_t* prefetch) {
+    pool_free(pool, prefetch->buffers[0]);
+    pool_free(pool, prefetch->buffers[1]);
+    pool_free(pool, prefetch);
+}
+
+/**
+ * 结束会话：记录统计信息和被限速抑制的日志条数，释放文件、套接字和缓冲区
+ * 失败的上传会删除不完整的文件
+ */
+static void session_close(tftp_session_t* session) {
+    session_table_remove(session);
+    session->metrics->transfers_ended[session->is_upload]++;
+    timer_wheel_cancel(session->timers, &session->retransmit_timer);
+    session->stats.end_ns = timing_now_ns();
+
+    if (session->stats.end_ns > session->stats.start_ns) {
+        double duration = (double)(session->stats.end_ns - session->stats.start_ns) / 1e9;
+        double throughput = session->stats.bytes_transferred / duration;
+        thread_safe_log("INFO", "Client %s:%d: Transfer statistics - Bytes: %zu, Duration: %.3fs, Throughput: %.2f bytes/s, Retransmissions: %d",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       session->stats.bytes_transferred, duration, throughput, session->stats.retransmissions);
+    }
+
+    if (session->file_handle != NULL) {
+        fclose(session->file_handle);
+        session->file_handle = NULL;
+    }
+    if (session->write_ring != NULL) {
+        // 文件由I/O线程关闭；上传未完成时也由它在关闭后删除文件
+        write_ring_release(session->write_ring, !session->completed);
+        session->write_ring = NULL;
+        session->completed = 1;
+    }
+    if (session->cache_entry != NULL) {
+        file_cache_release(session->cache_entry);
+        session->cache_entry = NULL;
+    }
+    if (session->prefetch != NULL) {
+        // 引擎保证回收前所有读请求都已取回
+        file_io_close(session->file_io, &session->io_file);
+        prefetch_free(session->pool, session->prefetch);
+        session->prefetch = NULL;
+    }
+    if (session->multicast != NULL) {
+        // 组的套接字和文件内容属于组，不还回套接字池
+        multicast_release(session->multicast);
+        session->multicast = NULL;
+        session->sock = INVALID_SOCKET;
+    }
+    session->file_data = NULL;
+    if (session->sock != INVALID_SOCKET) {
+        // USO分段大小是套接字属性，还回套接字池之前恢复为逐包发送
+        int reusable = (session->segment_size == 0 || send_queue_disable_uso(session->sock) == 0);
+        socket_pool_release(session->sock, reusable);
+        session->sock = INVALID_SOCKET;
+    }
+
+    if (session->stats.rtt_samples > 0) {
+        thread_safe_log("INFO", "Client %s:%d: RTT - samples: %d, min: %d ms, max: %d ms, smoothed: %d ms, final RTO: %d ms",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       session->stats.rtt_samples, session->stats.rtt_min_ms, session->stats.rtt_max_ms,
+                       session->stats.srtt_ms, session->rtt.rto);
+    }
+    if (session->stats.ack_latency.count > 0) {
+        const tftp_histogram_t* latency = &session->stats.ack_latency;
+        thread_safe_log("INFO", "Client %s:%d: ACK latency - samples: %llu, p50: %.3f ms, p99: %.3f ms, p99.9: %.3f ms, max: %.3f ms",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       latency->count, histogram_percentile(latency, 0.50) / 1e6,
+                       histogram_percentile(latency, 0.99) / 1e6, histogram_percentile(latency, 0.999) / 1e6,
+                       latency->max_ns / 1e6);
+    }
+
+    log_limits_report(session->log_limits, &session->client_addr);
+
+    if (session->is_upload && !session->completed) {
+        remove(session->filepath);
+        thread_safe_log("INFO", "Deleted incomplete file: %s", session->filepath);
+    }
+
+    pool_free(session->pool, session->buffer);
+    pool_free(session->pool, session->netascii.input);
+    pool_free(session->pool, session->window_lens);
+    pool_free(session->pool, session->send_times);
+    session_table_free(session->pool, session);
+}
+
+/**
+ * 窗口缓冲区每个槽位的大小：零复制时只存头部，否则为头部加一个数据块
+ */
+static size_t session_slot_size(tftp_session_t* session) {
+    return session->zero_copy ? TFTP_HEADER_SIZE : TFTP_HEADER_SIZE + (size_t)session->block_size;
+}
+
+/**
+ * 读取文件失败：通知客户端并结束会话
+ */
+static void session_abort_read(tftp_session_t* session) {
+    thread_safe_log("ERROR", "Failed to read file: %s", session->filepath);
+    send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_NOT_DEFINED, "File read error");
+    session->state = SESSION_DONE;
+}
+
+/**
+ * 创建下载预读器
+ *
+ * 功能说明：
+ * - 读取块为PREFETCH_CHUNK_BYTES按块大小向下取整（正好落在缓冲池的一个尺寸级别内），
+ *   但不少于一个窗口；窗口因此最多跨两个读取块，两个缓冲区轮流使用即可
+ * - 整个文件不足一个读取块时按文件大小分配
+ * - 后端直接返回文件映射地址时不分配缓冲区
+ *
+ * 返回值：
+ * - 成功：预读器
+ * - 失败：NULL（内存不足）
+ */
+static tftp_prefetch_t* prefetch_create(tftp_session_t* session) {
+    unsigned long block_size = (unsigned long)session->block_size;
+    unsigned long chunk_blocks = PREFETCH_CHUNK_BYTES / block_size;
+    unsigned long data_blocks = (unsigned long)((session->file_size + block_size - 1) / block_size);
+
+    if (chunk_blocks < (unsigned long)session->window_size) {
+        chunk_blocks = (unsigned long)session->window_size;
+    }
+    if (chunk_blocks > data_blocks) {
+        chunk_blocks = (data_blocks > 0) ? data_blocks : 1;
+    }
+
+    tftp_prefetch_t* prefetch = (tftp_prefetch_t*)pool_calloc(session->pool, sizeof(tftp_prefetch_t));
+    if (prefetch == NULL) {
+        return NULL;
+    }
+    prefetch->chunk_blocks = chunk_blocks;
+
+    if (session->file_io->ops->needs_buffer) {
+        for (int i = 0; i < 2; i++) {
+            prefetch->buffers[i] = (char*)pool_alloc(session->pool, (size_t)chunk_blocks * block_size);
+            if (prefetch->buffers[i] == NULL) {
+                prefetch_free(session->pool, prefetch);
+                return NULL;
+            }
+        }
+    }
+    return prefetch;
+}
+
+/**
+ * 检查完成的读请求：实际读取的字节数必须等于该读取块应有的长度，
+ * 否则文件在传输期间被截断或读取出错
+ */
+static int prefetch_read_ok(tftp_session_t* session, tftp_io_request_t* read) {
+    ULONGLONG remaining = session->file_size - read->offset;
+    ULONGLONG expected = (remaining < (ULONGLONG)read->length) ? remaining : (ULONGLONG)read->length;
+
+    return read->result >= 0 && (ULONGLONG)read->result == expected;
+}
+
+/**
+ * 提交预读请求（经过文件I/O后端的下载）
+ *
+ * 功能说明：
+ * - 最多同时保持两个读取块：发送读取块k中的数据块时，读取块k + 1已在读取
+ * - 读取块k + 2复用读取块k的缓冲区，必须等读取块k的所有数据块都被确认
+ *   （窗口之后可能还要从中重传）；netascii的数据块编码后已复制到窗口缓冲区，
+ *   读取块k编码完即可复用
+ * - 每个读取块一次读请求，同步后端同时提示系统预读该段映射
+ * - 立即完成的读请求（同步后端、命中系统缓存）当场可以发送，
+ *   其余的由事件循环取回后再发送
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（调用者结束会话）
+ */
+static int session_prefetch(tftp_session_t* session) {
+    tftp_prefetch_t* prefetch = session->prefetch;
+    ULONGLONG chunk_bytes = (ULONGLONG)prefetch->chunk_blocks * (ULONGLONG)session->block_size;
+
+    while ((ULONGLONG)prefetch->next_chunk * chunk_bytes < session->file_size) {
+        unsigned long chunk = prefetch->next_chunk;
+        tftp_io_request_t* read = &prefetch->requests[chunk % 2];
+
+        if (chunk >= 2 && (session->transfer_mode == MODE_NETASCII ?
+                           prefetch->encode_chunk < chunk - 1 :
+                           session->base <= (chunk - 1) * prefetch->chunk_blocks)) {
+            break;                                       // 缓冲区中的上上个读取块还未全部确认（或编码完）
+        }
+
+        read->file = &session->io_file;
+        read->offset = (ULONGLONG)chunk * chunk_bytes;
+        read->buffer = prefetch->buffers[chunk % 2];
+        read->length = (int)chunk_bytes;
+        read->data = read->buffer;
+        read->result = 0;
+        read->owner = session;
+        read->seq = chunk;
+
+        int result = file_io_read(session->file_io, read);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            session->reads_in_flight++;
+        } else if (!prefetch_read_ok(session, read)) {
+            return -1;
+        }
+        prefetch->next_chunk++;
+    }
+    return 0;
+}
+
+/**
+ * 取得预读器中某个数据块的数据
+ *
+ * 返回值：
+ * - 数据地址
+ * - NULL：所在读取块还在读取（或尚未提交）
+ */
+static const char* prefetch_block_data(tftp_session_t* session, unsigned long seq) {
+    tftp_prefetch_t* prefetch = session->prefetch;
+    unsigned long chunk = (seq - 1) / prefetch->chunk_blocks;
+    tftp_io_request_t* read = &prefetch->requests[chunk % 2];
+
+    if (chunk >= prefetch->next_chunk || read->seq != chunk || read->in_flight) {
+        return NULL;
+    }
+    return read->data + (size_t)((seq - 1) % prefetch->chunk_blocks) * (size_t)session->block_size;
+}
+
+/**
+ * 把预读器中的文件内容编码为netascii，填满一个数据块（经过文件I/O后端的netascii下载）
+ *
+ * 功能说明：
+ * - 按文件偏移依次编码各读取块，编码后的长度与文件偏移不再对应，数据块总是复制到窗口缓冲区
+ * - 需要的读取块还在读取时保留已编码的部分，读完后接着填充
+ * - 一个读取块编码完后立即用它的缓冲区提交后面的读取块
+ *
+ * 返回值：
+ * - 数据块长度，小于块大小说明文件已全部编码完（即最后一块）
+ * - -1：所需读取块尚未读完
+ * - -2：提交预读请求失败（调用者结束会话）
+ */
+static int prefetch_netascii_block(tftp_session_t* session, char* out) {
+    tftp_prefetch_t* prefetch = session->prefetch;
+    tftp_netascii_t* state = &session->netascii;
+    ULONGLONG chunk_bytes = (ULONGLONG)prefetch->chunk_blocks * (ULONGLONG)session->block_size;
+    size_t block_size = (size_t)session->block_size;
+
+    while (prefetch->block_fill < block_size) {
+        ULONGLONG offset = (ULONGLONG)prefetch->encode_chunk * chunk_bytes;
+        const char* in = NULL;
+        size_t in_len = 0;
+
+        if (offset < session->file_size) {
+            tftp_io_request_t* read = &prefetch->requests[prefetch->encode_chunk % 2];
+            if (prefetch->encode_chunk >= prefetch->next_chunk || read->seq != prefetch->encode_chunk ||
+                read->in_flight) {
+                return -1;
+            }
+            in = read->data + prefetch->encode_pos;
+            in_len = (size_t)read->result - prefetch->encode_pos;
+        } else if (!state->eof) {
+            state->eof = 1;
+            netascii_encode_end(state);
+        } else if (state->pending_len == 0) {
+            break;
+        }
+
+        size_t consumed;
+        prefetch->block_fill += netascii_encode(state, in, in_len, &consumed, out + prefetch->block_fill,
+                                                block_size - prefetch->block_fill);
+        prefetch->encode_pos += consumed;
+        if (in != NULL && consumed == in_len) {
+            prefetch->encode_chunk++;
+            prefetch->encode_pos = 0;
+            if (session_prefetch(session) < 0) {
+                return -2;
+            }
+        }
+    }
+
+    int length = (int)prefetch->block_fill;
+    prefetch->block_fill = 0;
+    return length;
+}
+
+/**
+ * 发送窗口内尚未发送的数据块（下载）
+ *
+ * 功能说明：
+ * - 从base开始最多window_size块；经过预读器的会话遇到所在读取块尚未读完的块时停止，
+ *   读完后再继续发送
+ * - 数据在内存中（缓存内容或预读缓冲区）时，零复制会话的槽位只写头部，
+ *   数据部分直接指向内存中的文件内容；启用USO的会话首次发送时复制到槽位中头部之后
+ * - netascii模式首次发送时把预读器中的文件内容（打开文件I/O后端失败时从file_handle读取）
+ *   编码到窗口缓冲区，所需读取块尚未读完时停止
+ * - 回退重传时直接从窗口缓冲区（或文件内容）重发，不再读文件，并清除该块的发送时间（Karn算法）
+ * - 数据包加入引擎的发送队列，本轮事件循环结束时批量发出
+ * - 入队后重置重传截止时间
+ */
+static void session_send_window(tftp_session_t* session) {
+    size_t slot_size = session_slot_size(session);
+
+    while (session->next < session->base + session->window_size &&
+           (session->last_block == 0 || session->next <= session->last_block)) {
+        int slot = (int)((session->next - 1) % session->window_size);
+        char* block_packet = session->buffer + (size_t)slot * slot_size;
+        ULONGLONG offset = (ULONGLONG)(session->next - 1) * (ULONGLONG)session->block_size;
+        ULONGLONG remaining = (offset < session->file_size) ? session->file_size - offset : 0;
+        const char* block_data = NULL;                   // 数据在内存中的位置（NULL表示只在槽位中）
+
+        if (session->file_data != NULL) {
+            block_data = session->file_data + offset;
+        } else if (session->prefetch != NULL && session->transfer_mode == MODE_OCTET && remaining > 0) {
+            block_data = prefetch_block_data(session, session->next);
+            if (block_data == NULL) {
+                break;                                   // 读请求尚未完成
+            }
+        }
+
+        if (session->next > session->read_upto) {
+            // 首次发送该块；不足一个块大小（含0字节）说明是最后一块
+            if (session->transfer_mode == MODE_NETASCII && session->prefetch != NULL) {
+                int length = prefetch_netascii_block(session, block_packet + TFTP_HEADER_SIZE);
+                if (length == -2) {
+                    session_abort_read(session);
+                    return;
+                }
+                if (length < 0) {
+                    break;                               // 读请求尚未完成
+                }
+                session->window_lens[slot] = length;
+            } else if (session->file_data != NULL || session->prefetch != NULL) {
+                session->window_lens[slot] = (remaining < (ULONGLONG)session->block_size) ?
+                                             (int)remaining : session->block_size;
+                if (!session->zero_copy && block_data != NULL) {
+                    memcpy(block_packet + TFTP_HEADER_SIZE, block_data, (size_t)session->window_lens[slot]);
+                }
+            } else if (session->transfer_mode == MODE_NETASCII) {
+                session->window_lens[slot] = (int)netascii_read(&session->netascii, session->file_handle,
+                                                                block_packet + TFTP_HEADER_SIZE,
+                                                                (size_t)session->block_size);
+            } else {
+                session->window_lens[slot] = (int)fread(block_packet + TFTP_HEADER_SIZE, 1,
+                                                        session->block_size, session->file_handle);
+            }
+            session->read_upto = session->next;
+            if (session->window_lens[slot] < session->block_size) {
+                session->last_block = session->next;
+            }
+            session->send_times[slot] = session->timers->now_ns;
+        } else {
+            session->send_times[slot] = 0;
+            session->stats.retransmissions++;
+            session->metrics->retransmissions++;
+        }
+
+        write_data_header(block_packet, (unsigned short)session->next);
+        if (session->zero_copy) {
+            send_queue_push_gather(session->send_queue, session->sock, block_packet, TFTP_HEADER_SIZE,
+                                   block_data, session->window_lens[slot], &session->queued_packets);
+        } else {
+            send_queue_push(session->send_queue, session->sock, block_packet,
+                            TFTP_HEADER_SIZE + session->window_lens[slot], session->segment_size,
+                            &session->queued_packets);
+        }
+
+        session->stats.blocks_sent++;
+        session->metrics->data_packets_sent++;
+        session->next++;
+    }
+
+    session_set_deadline(session);
+}
+
+/**
+ * 文件读请求完成回调（事件循环取回完成链表时调用）
+ *
+ * 功能说明：
+ * - 已结束的会话只减少计数，读请求全部取回后才能回收
+ * - 读取失败或读到的长度与文件大小不符时向客户端回复错误
+ * - 窗口中等待发送的下一块正好在该读取块中（netascii：正等待编码该读取块）时继续发送
+ */
+static void engine_on_read_complete(tftp_io_request_t* request, void* context) {
+    tftp_session_t* session = (tftp_session_t*)request->owner;
+    (void)context;
+
+    session->reads_in_flight--;
+    if (session->state == SESSION_DONE) {
+        return;
+    }
+    if (!prefetch_read_ok(session, request)) {
+        session_abort_read(session);
+        return;
+    }
+    unsigned long waiting = (session->transfer_mode == MODE_NETASCII) ? session->prefetch->encode_chunk :
+                            (session->next - 1) / session->prefetch->chunk_blocks;
+    if (session->state == SESSION_SENDING && waiting == request->seq) {
+        session_send_window(session);
+    }
+}
+
+/**
+ * 处理带multicast选项的RRQ（RFC 2090）
+ *
+ * 功能说明：
+ * - 同一文件、同一块大小已有组时客户端加入该组（OACK由组注册表发送），不创建会话
+ * - 否则创建新组，本引擎新建一个会话驱动它：请求的客户端为主客户端，
+ *   先发送mc=1的OACK，收到ACK后逐块向组播地址发送
+ * - 组播下载逐块确认，不协商windowsize
+ *
+ * 返回值：
+ * - 成功：0（已加入或已创建组）
+ * - 失败：-1（调用者按普通单播下载处理）
+ */
+static int engine_start_multicast(tftp_engine_t* engine, tftp_packet_view_t* packet,
+                                  struct sockaddr_in* client_addr) {
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "tftp_root/%s", packet->filename);
+
+    tftp_options_t accepted;
+    negotiate_options(&packet->options, 0, &accepted);
+    accepted.windowsize = 0;
+    if (accepted.tsize && file_cache_tsize(filepath, 0, &accepted.tsize_value) < 0) {
+        accepted.tsize = 0;                              // 文件不存在时由multicast_start回退处理
+    }
+    int block_size = (accepted.blksize > 0) ? accepted.blksize : DATA_SIZE;
+
+    tftp_multicast_group_t* group = NULL;
+    int result = multicast_start(filepath, block_size, client_addr, &accepted, &group);
+    if (result != 0) {
+        return (result > 0) ? 0 : -1;                    // 已加入已有的组，或回退为单播
+    }
+
+    tftp_session_t* session = engine_add_session(engine);
+    if (session == NULL) {
+        multicast_release(group);
+        return -1;
+    }
+
+    session->client_addr = *client_addr;
+    session->client_addr_len = sizeof(*client_addr);
+    session->is_upload = 0;
+    session->transfer_mode = MODE_OCTET;
+    strcpy(session->filename, packet->filename);
+    strcpy(session->filepath, filepath);
+    time(&session->last_activity);
+    session->stats.start_ns = engine->timers.now_ns;
+    engine->metrics.transfers_started[0]++;
+    session->state = SESSION_DONE;                       // 初始化完成前出错时直接回收
+
+    session->multicast = group;
+    session->sock = group->sock;
+    session->file_data = group->data;
+    session->file_size = group->size;
+    session->options = accepted;
+    session->block_size = block_size;
+    session->window_size = 1;
+    session->last_block = (unsigned long)(group->size / (ULONGLONG)block_size) + 1;
+    rtt_init(&session->rtt, accepted.timeout);
+    session->last_progress = engine->timers.now;
+
+    if (session_register(session) < 0) {
+        return 0;
+    }
+    session->buffer = (char*)pool_alloc(session->pool, (size_t)(TFTP_HEADER_SIZE + block_size));
+    if (session->buffer == NULL) {
+        thread_safe_log("ERROR", "Failed to allocate multicast buffer");
+        send_error_packet(session->sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return 0;
+    }
+
+    // inet_ntoa返回共享缓冲区，同一条日志中的第二个地址先复制出来
+    char group_ip[16];
+    strcpy(group_ip, inet_ntoa(group->group_addr.sin_addr));
+    thread_safe_log("INFO", "Client %s:%d created multicast group %s:%d for %s (%lu blocks of %d bytes)",
+                   inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
+                   group_ip, ntohs(group->group_addr.sin_port), filepath, session->last_block, block_size);
+
+    if (send_oack_packet(session->sock, client_addr, &session->options) < 0) {
+        return 0;
+    }
+    session->state = SESSION_WAIT_OACK_ACK;
+    session->ack_sent_at = engine->timers.now_ns;
+    session_set_deadline(session);
+    return 0;
+}
+
+/**
+ * 处理RRQ：打开文件、创建传输套接字、协商选项并发出第一个窗口（或OACK）
+ */
+static void engine_start_rrq(tftp_engine_t* engine, tftp_packet_view_t* packet,
+                             struct sockaddr_in* client_addr) {
+    thread_safe_log("INFO", "Client %s:%d requests download file: %s, mode: %s",
+                   inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
+                   packet->filename, packet->mode);
+
+    // 请求组播且服务器启用了组播时，octet下载按组进行
+    if (packet->options.multicast && multicast_enabled() &&
+        parse_mode(packet->mode) == MODE_OCTET && engine_start_multicast(engine, packet, client_addr) == 0) {
+        return;
+    }
+
+    tftp_session_t* session = engine_claim_session(engine, client_addr);
+    if (session == NULL) {
+        return;
+    }
+
+    session->is_upload = 0;
+    session->transfer_mode = parse_mode(packet->mode);
+    strcpy(session->filename, packet->filename);
+    snprintf(session->filepath, sizeof(session->filepath), "tftp_root/%s", session->filename);
+    time(&session->last_activity);
+    session->stats.start_ns = engine->timers.now_ns;
+    engine->metrics.transfers_started[0]++;
+    session->state = SESSION_DONE;                       // 初始化完成前出错时直接回收
+
+    // octet模式优先从共享缓存读取，缓存未命中、正在加载或缓存不下的文件由预读器经文件I/O后端提前读取；
+    // netascii不使用缓存，同样经文件I/O后端读取后逐块编码；打开失败时才回退为stdio
+    int use_file_io = 0;
+    if (session->transfer_mode == MODE_OCTET) {
+        session->cache_entry = file_cache_acquire(session->filepath);
+        if (session->cache_entry != NULL) {
+            session->file_data = session->cache_entry->data;
+            session->file_size = session->cache_entry->size;
+        }
+    }
+    if (session->file_data == NULL &&
+        file_io_open(session->file_io, session->filepath, &session->io_file) == 0) {
+        session->file_size = session->io_file.size;
+        use_file_io = 1;
+    }
+    if (session->file_data == NULL && !use_file_io) {
+        session->file_handle = fopen(session->filepath, "rb");
+    }
+    if (session->file_data == NULL && !use_file_io && session->file_handle == NULL) {
+        thread_safe_log("ERROR", "Cannot open file: %s", session->filepath);
+        send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_FILE_NOT_FOUND, "File not found");
+        return;
+    }
+
+    // 协商选项，未请求windowsize时窗口为1（逐块确认）
+    int has_options = negotiate_options(&packet->options, 0, &session->options);
+    if (session->options.tsize) {
+        // tsize回复实际要发送的字节数：octet取已打开文件的大小，netascii取编码后的长度（按文件缓存，尚未算出时不回复）
+        if (session->transfer_mode == MODE_OCTET && (session->file_data != NULL || use_file_io)) {
+            session->options.tsize_value = session->file_size;
+        } else if (file_cache_tsize(session->filepath, session->transfer_mode == MODE_NETASCII,
+                                    &session->options.tsize_value) < 0) {
+            session->options.tsize = 0;
+            has_options--;
+        }
+    }
+    session->window_size = (session->options.windowsize > 0) ? session->options.windowsize : 1;
+    session->block_size = (session->options.blksize > 0) ? session->options.blksize : DATA_SIZE;
+    rtt_init(&session->rtt, session->options.timeout);
+    session->last_progress = engine->timers.now;
+
+    if (use_file_io) {
+        session->prefetch = prefetch_create(session);
+        if (session->prefetch == NULL) {
+            file_io_close(session->file_io, &session->io_file);
+            thread_safe_log("ERROR", "Failed to allocate prefetch buffers");
+            send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+            return;
+        }
+    }
+
+    if (session->transfer_mode == MODE_NETASCII && use_file_io) {
+        netascii_init(&session->netascii, NULL);
+    } else if (session->transfer_mode == MODE_NETASCII) {
+        char* input = (char*)pool_alloc(session->pool, NETASCII_READ_SIZE);
+        if (input == NULL) {
+            thread_safe_log("ERROR", "Failed to allocate netascii buffer");
+            send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+            return;
+        }
+        netascii_init(&session->netascii, input);
+    }
+
+    if (session_open_socket(engine, session) < 0) {
+        return;
+    }
+
+    // 窗口大于1时相邻块在缓冲区中首尾相接，可以交给USO一次发出
+    if (session->window_size > 1 &&
+        send_queue_enable_uso(session->send_queue, session->sock,
+                              TFTP_HEADER_SIZE + session->block_size) == 0) {
+        session->segment_size = TFTP_HEADER_SIZE + session->block_size;
+    }
+    // USO要求头部和数据连续，只有未启用USO时才从内存中的文件内容零复制发送
+    session->zero_copy = ((session->file_data != NULL || session->prefetch != NULL) &&
+                          session->transfer_mode == MODE_OCTET && session->segment_size == 0);
+
+    session->buffer = (char*)pool_alloc(session->pool, (size_t)session->window_size * session_slot_size(session));
+    session->window_lens = (int*)pool_alloc(session->pool, (size_t)session->window_size * sizeof(int));
+    session->send_times = (ULONGLONG*)pool_alloc(session->pool, (size_t)session->window_size * sizeof(ULONGLONG));
+    if (session->buffer == NULL || session->window_lens == NULL || session->send_times == NULL) {
+        thread_safe_log("ERROR", "Failed to allocate window buffer");
+        send_error_packet(session->sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return;
+    }
+
+    session->base = 1;
+    session->next = 1;
+
+    // 前两个读取块的读请求与OACK握手并行进行
+    if (session->prefetch != NULL && session_prefetch(session) < 0) {
+        session_abort_read(session);
+        return;
+    }
+
+    if (has_options) {
+        // 先完成OACK握手，收到ACK(0)后再发送数据
+        if (send_oack_packet(session->sock, client_addr, &session->options) < 0) {
+            return;
+        }
+        session->state = SESSION_WAIT_OACK_ACK;
+        session->ack_sent_at = engine->timers.now_ns;
+        session_set_deadline(session);
+    } else {
+        session->state = SESSION_SENDING;
+        session_send_window(session);
+    }
+}
+
+/**
+ * 以独占方式创建上传文件
+ *
+ * 功能说明：
+ * - 文件已存在时创建失败（_O_EXCL），"检查是否存在"和"创建"是同一个原子操作；
+ *   不同工作线程同时接受同名文件的WRQ时，只有一个能创建成功，
+ *   另一个收到"文件已存在"，不会截断或交错写入对方的数据
+ * - netascii模式也以二进制方式打开，换行由netascii_decode显式转换
+ *
+ * 返回值：
+ * - 成功：文件指针
+ * - 失败：NULL（errno为EEXIST表示文件已存在）
+ */
+static FILE* create_upload_file(const char* filepath) {
+    int fd = _open(filepath, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE* file = _fdopen(fd, "wb");
+    if (file == NULL) {
+        _close(fd);
+    }
+    return file;
+}
+
+/**
+ * 处理WRQ：创建文件和传输套接字，从新的TID回复ACK(0)或OACK
+ *
+ * 上传与下载一样拥有自己的传输套接字（服务器端TID），DATA包只从该套接字读取，
+ * 69端口只接收新请求；多个上传并行进行，互不读取对方的数据块
+ */
+static void engine_start_wrq(tftp_engine_t* engine, tftp_packet_view_t* packet,
+                             struct sockaddr_in* client_addr) {
+    thread_safe_log("INFO", "Client %s:%d requests upload file: %s, mode: %s",
+                   inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
+                   packet->filename, packet->mode);
+
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "tftp_root/%s", packet->filename);
+
+    tftp_session_t* session = engine_claim_session(engine, client_addr);
+    if (session == NULL) {
+        return;
+    }
+
+    session->is_upload = 1;
+    session->transfer_mode = parse_mode(packet->mode);
+    strcpy(session->filename, packet->filename);
+    strcpy(session->filepath, filepath);
+    time(&session->last_activity);
+    session->stats.start_ns = engine->timers.now_ns;
+    engine->metrics.transfers_started[1]++;
+    session->state = SESSION_DONE;
+    session->completed = 1;                              // 文件创建前出错时不删除任何文件
+
+    // 客户端通过tsize声明了文件大小时，剩余空间不足则在创建文件、传输数据之前拒绝
+    if (packet->options.tsize && !upload_space_available(packet->options.tsize_value)) {
+        thread_safe_log("ERROR", "Upload of %llu bytes exceeds free disk space: %s",
+                        packet->options.tsize_value, filepath);
+        send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_DISK_FULL,
+                          "File too large for available disk space");
+        return;
+    }
+
+    session->file_handle = create_upload_file(filepath);
+    if (session->file_handle == NULL && errno == EEXIST) {
+        thread_safe_log("ERROR", "File already exists: %s", filepath);
+        send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_FILE_EXISTS, "File already exists");
+        return;
+    }
+    if (session->file_handle == NULL) {
+        thread_safe_log("ERROR", "Cannot create file: %s", filepath);
+        send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_ACCESS_VIOLATION, "Cannot create file");
+        return;
+    }
+    session->completed = 0;
+
+    // 上传不协商windowsize
+    int has_options = negotiate_options(&packet->options, 1, &session->options);
+    session->block_size = (session->options.blksize > 0) ? session->options.blksize : DATA_SIZE;
+    if (session->options.tsize) {
+        reserve_file_space(session->file_handle, session->options.tsize_value);
+    }
+
+    // netascii解码的输出最多比输入多一个字节（上一块末尾的裸CR）；
+    // 解码后的块长度不定，按字节追加进写缓冲环，槽位仍为块大小
+    if (session->transfer_mode == MODE_NETASCII) {
+        netascii_init(&session->netascii, NULL);
+        session->buffer = (char*)pool_alloc(session->pool, (size_t)session->block_size + 1);
+        if (session->buffer == NULL) {
+            thread_safe_log("ERROR", "Failed to allocate netascii buffer");
+            send_error_packet(engine->listen_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+            return;
+        }
+    }
+
+    // 文件交给写后台化I/O线程；I/O线程不可用时仍在事件循环中直接写入
+    session->write_ring = write_ring_create(session->pool, session->file_handle, session->filepath,
+                                            session->block_size);
+    if (session->write_ring != NULL) {
+        session->file_handle = NULL;
+    }
+    session->window_size = 1;
+    rtt_init(&session->rtt, session->options.timeout);
+    session->last_progress = engine->timers.now;
+
+    if (session_open_socket(engine, session) < 0) {
+        return;
+    }
+
+    // 发送ACK(0)表示准备接收数据；接受了选项时以OACK代替
+    int ready_result = has_options ? send_oack_packet(session->sock, client_addr, &session->options)
+                                   : send_ack_packet(session->sock, client_addr, 0);
+    if (ready_result < 0) {
+        return;
+    }
+
+    session->current_block = 1;
+    session->state = SESSION_RECEIVING;
+    session->ack_sent_at = engine->timers.now_ns;
+    session_set_deadline(session);
+}
+
+/**
+ * 处理下载会话收到的数据包（ACK或错误包）
+ */
+static void session_on_rrq_packet(tftp_session_t* session, char* buffer, int length) {
+    tftp_packet_view_t packet;
+    if (parse_tftp_packet(buffer, length, &packet) < 0) {
+        session->metrics->invalid_packets++;
+        log_message_limited(session->log_limits, LOG_EVENT_INVALID, "WARNING", "Received invalid packet from %s:%d",
+                            inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port));
+        return;
+    }
+    unsigned short block = packet.block_num;
+
+    if (packet.opcode == TFTP_ERROR) {
+        thread_safe_log("ERROR", "Client %s:%d reported error (code:%d): %.*s",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       block, packet.payload_len, packet.payload);
+        session->state = SESSION_DONE;
+        return;
+    }
+    if (packet.opcode != TFTP_ACK) {
+        return;
+    }
+
+    if (session->state == SESSION_WAIT_OACK_ACK) {
+        if (block == 0) {
+            session_sample_rtt(session, session->ack_sent_at);
+            session->state = SESSION_SENDING;
+            session->retries = 0;
+            session_send_window(session);
+        }
+        return;
+    }
+
+    // 将16位块号还原为序号：有效ACK只可能落在[base-1, next-1]区间内
+    unsigned long ack_seq = (session->base - 1) +
+                            (unsigned short)(block - (unsigned short)(session->base - 1));
+    if (ack_seq < session->base || ack_seq >= session->next) {
+        return;                                          // 重复的旧ACK直接忽略
+    }
+
+    // 窗口槽位即将被新数据块复用，先发出仍在队列中引用这些槽位的数据包
+    if (session->queued_packets > 0) {
+        send_queue_flush(session->send_queue);
+    }
+
+    // 以被确认的块测量RTT，再累计确认，滑动窗口
+    session_sample_rtt(session, session->send_times[(ack_seq - 1) % session->window_size]);
+    while (session->base <= ack_seq) {
+        int acked = session->window_lens[(session->base - 1) % session->window_size];
+        session->stats.bytes_transferred += acked;
+        session->metrics->bytes_sent += (ULONGLONG)acked;
+        session->base++;
+    }
+    session->retries = 0;
+    session->next = session->base;                       // 部分确认时从确认点之后重发（RFC 7440）
+
+    if (session->last_block != 0 && session->base > session->last_block) {
+        session->completed = 1;
+        session->metrics->transfers_completed[0]++;
+        session->state = SESSION_DONE;
+        thread_safe_log("INFO", "File transfer completed for %s", session->filename);
+        return;
+    }
+
+    // 窗口离开一个读取块后，用它的缓冲区预读后面的读取块
+    if (session->prefetch != NULL && session_prefetch(session) < 0) {
+        session_abort_read(session);
+        return;
+    }
+    session_send_window(session);
+}
+
+/**
+ * 组播下载中数据块block的长度（最后一块可能不满甚至为0）
+ */
+static int multicast_block_length(tftp_session_t* session, unsigned long block) {
+    ULONGLONG offset = (ULONGLONG)(block - 1) * (ULONGLONG)session->block_size;
+    ULONGLONG remaining = session->file_size - offset;
+    return (int)((remaining < (ULONGLONG)session->block_size) ? remaining : (ULONGLONG)session->block_size);
+}
+
+/**
+ * 向组播地址发送一个数据块
+ * 组的套接字未连接，不经过批量发送队列，直接sendto到组地址
+ */
+static void session_send_multicast_block(tftp_session_t* session, unsigned long block) {
+    int data_len = multicast_block_length(session, block);
+
+    write_data_header(session->buffer, (unsigned short)block);
+    memcpy(session->buffer + TFTP_HEADER_SIZE,
+           session->file_data + (ULONGLONG)(block - 1) * (ULONGLONG)session->block_size, (size_t)data_len);
+    sendto(session->sock, session->buffer, TFTP_HEADER_SIZE + data_len, 0,
+           (struct sockaddr*)&session->multicast->group_addr, sizeof(session->multicast->group_addr));
+    session->stats.blocks_sent++;
+    session->metrics->data_packets_sent++;
+    session->current_block = block;
+    session->ack_sent_at = session->timers->now_ns;
+    session->state = SESSION_SENDING;
+    session_set_deadline(session);
+}
+
+/**
+ * 主客户端离开组后提升下一个客户端为主客户端
+ *
+ * 功能说明：
+ * - 新的主客户端收到mc=1的OACK后，以它已连续收到的最后一块的ACK作答，从下一块继续发送
+ * - 组内没有客户端时结束会话，至少一个客户端收齐文件才算传输完成
+ *
+ * 参数：
+ * - served: 离开的主客户端是否已收齐文件
+ */
+static void session_next_master(tftp_session_t* session, const struct sockaddr_in* master, int served) {
+    tftp_multicast_group_t* group = session->multicast;
+    struct sockaddr_in next_master;
+
+    if (multicast_leave(group, master, served) == 0 || multicast_master(group, &next_master) < 0) {
+        session->completed = (group->served > 0);
+        if (session->completed) {
+            session->metrics->transfers_completed[0]++;
+        }
+        session->state = SESSION_DONE;
+        thread_safe_log("INFO", "Multicast transfer of %s finished, %d client(s) served",
+                       session->filename, group->served);
+        return;
+    }
+
+    // 会话表以主客户端TID为键：先按旧键删除，换成新的主客户端后重新登记；
+    // 组的数据包经组的套接字到达，不依赖会话表，登记失败时不登记继续传输，组内其余客户端照常收到数据
+    session_table_remove(session);
+    session->client_addr = next_master;
+    if (session_table_insert(session) < 0) {
+        thread_safe_log("WARNING", "Failed to register multicast session for %s, continuing unregistered",
+                       session->filename);
+    }
+
+    memset(&session->options, 0, sizeof(session->options));
+    multicast_option_value(group, 1, &session->options);
+    send_oack_packet(session->sock, &session->client_addr, &session->options);
+    session->state = SESSION_WAIT_OACK_ACK;
+    session->ack_sent_at = session->timers->now_ns;
+    session->retries = 0;
+    rtt_init(&session->rtt, 0);
+    session->last_progress = session->timers->now;
+    session_set_deadline(session);
+    thread_safe_log("INFO", "Client %s:%d is now master client of multicast transfer %s",
+                   inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                   session->filename);
+}
+
+/**
+ * 处理组播下载会话收到的数据包
+ *
+ * 功能说明：
+ * - 组的套接字未连接，组内所有客户端的包都会到达这里
+ * - 非主客户端的ERROR表示它放弃了传输；它在主客户端之外收齐文件后发来的
+ *   最后一块的ACK表示它已完成，二者都使它离开组；其余的包忽略
+ * - 主客户端的ACK n使块n + 1发往组播地址，确认最后一块后它离开组
+ * - 发送中只接受对当前块的ACK；新的主客户端回复OACK时可以从任意一块继续。
+ *   其余ACK（重复、过时或回退到更早的块）直接丢弃，不重发、不回退组的进度，也不重置重试计数
+ */
+static void session_on_multicast_packet(tftp_session_t* session, char* buffer, int length,
+                                        const struct sockaddr_in* from_addr) {
+    tftp_packet_view_t packet;
+    if (parse_tftp_packet(buffer, length, &packet) < 0) {
+        session->metrics->invalid_packets++;
+        log_message_limited(session->log_limits, LOG_EVENT_INVALID, "WARNING", "Received invalid packet from %s:%d",
+                            inet_ntoa(from_addr->sin_addr), ntohs(from_addr->sin_port));
+        return;
+    }
+    unsigned short block = packet.block_num;
+
+    struct sockaddr_in master;
+    if (multicast_master(session->multicast, &master) < 0) {
+        return;
+    }
+    if (from_addr->sin_addr.s_addr != master.sin_addr.s_addr || from_addr->sin_port != master.sin_port) {
+        if (packet.opcode == TFTP_ERROR) {
+            multicast_leave(session->multicast, from_addr, 0);
+        } else if (packet.opcode == TFTP_ACK && block == session->last_block) {
+            multicast_leave(session->multicast, from_addr, 1);
+        }
+        return;
+    }
+
+    if (packet.opcode == TFTP_ERROR) {
+        thread_safe_log("ERROR", "Master client %s:%d reported error (code:%d): %.*s",
+                       inet_ntoa(master.sin_addr), ntohs(master.sin_port),
+                       block, packet.payload_len, packet.payload);
+        session_next_master(session, &master, 0);
+        return;
+    }
+    if (packet.opcode != TFTP_ACK || block > session->last_block) {
+        return;
+    }
+    if (session->state != SESSION_WAIT_OACK_ACK && block != session->current_block) {
+        return;
+    }
+
+    session_sample_rtt(session, session->ack_sent_at);
+    session->retries = 0;
+    if (session->state == SESSION_SENDING) {
+        session->stats.bytes_transferred += (size_t)multicast_block_length(session, block);
+    }
+
+    if (block == session->last_block) {
+        session_next_master(session, &master, 1);
+    } else {
+        session_send_multicast_block(session, (unsigned long)block + 1);
+    }
+}
+
+/**
+ * 上传完成：短暂保留会话以便重发丢失的最终ACK
+ * 保留时长按客户端的重传间隔（协商的timeout或默认值）而非本端RTO计算
+ */
+static void session_finish_upload(tftp_session_t* session) {
+    int dally_seconds = (session->options.timeout > 0) ? session->options.timeout : TIMEOUT_SECONDS;
+    timer_wheel_schedule(session->timers, &session->retransmit_timer, (ULONGLONG)dally_seconds * 1000);
+    session->completed = 1;
+    session->metrics->transfers_completed[1]++;
+    session->state = SESSION_DALLY;
+    thread_safe_log("INFO", "File upload completed for %s", session->filename);
+}
+
+/**
+ * 后台写入失败：通知客户端并结束会话（不完整的文件由I/O线程删除）
+ */
+static void session_abort_write(tftp_session_t* session) {
+    send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_DISK_FULL, "Disk full or write error");
+    session->state = SESSION_DONE;
+}
+
+/**
+ * 检查上传会话的后台写入进度（事件循环每轮调用）
+ *
+ * 功能说明：
+ * - 写入失败时立即终止上传
+ * - 最后一块已入队的会话在所有数据写入磁盘、文件关闭后发送最终ACK
+ */
+static void session_check_write(tftp_session_t* session) {
+    int status = write_ring_status(session->write_ring);
+
+    if (status < 0) {
+        session_abort_write(session);
+    } else if (status > 0 && session->state == SESSION_FLUSHING) {
+        send_ack_packet(session->sock, &session->client_addr, session->current_block);
+        session->ack_sent_at = session->timers->now_ns;
+        session->current_block++;
+        session_finish_upload(session);
+    }
+}
+
+/**
+ * 处理上传会话收到的数据包（DATA或错误包）
+ */
+static void session_on_wrq_packet(tftp_session_t* session, char* buffer, int length) {
+    tftp_packet_view_t packet;
+    if (parse_tftp_packet(buffer, length, &packet) < 0) {
+        session->metrics->invalid_packets++;
+        log_message_limited(session->log_limits, LOG_EVENT_INVALID, "WARNING", "Received invalid packet from %s:%d",
+                            inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port));
+        return;
+    }
+
+    if (packet.opcode == TFTP_ERROR) {
+        thread_safe_log("INFO", "Client %s:%d reported error: %.*s",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       packet.payload_len, packet.payload);
+        session->state = SESSION_DONE;
+        return;
+    }
+    if (packet.opcode != TFTP_DATA) {
+        return;
+    }
+
+    if (session->state == SESSION_RECEIVING && packet.block_num == session->current_block) {
+        if (packet.payload_len > session->block_size) {
+            send_error_packet(session->sock, &session->client_addr,
+                              TFTP_ERROR_ILLEGAL_OPERATION, "Block larger than negotiated blksize");
+            session->state = SESSION_DONE;
+            return;
+        }
+
+        size_t data_len = (size_t)packet.payload_len;
+        const char* write_data = packet.payload;
+        size_t write_len = data_len;
+        tftp_netascii_t netascii_before = session->netascii;
+        if (session->transfer_mode == MODE_NETASCII) {
+            // 解码到会话缓冲区，最后一块再补出末尾的裸CR
+            write_len = netascii_decode(&session->netascii, packet.payload, data_len, session->buffer);
+            if (data_len < (size_t)session->block_size) {
+                write_len += netascii_decode_end(&session->netascii, session->buffer + write_len);
+            }
+            write_data = session->buffer;
+        }
+
+        if (session->write_ring != NULL) {
+            // 数据复制进写缓冲环即可确认，磁盘写入由I/O线程完成
+            int pushed = (session->transfer_mode == MODE_NETASCII) ?
+                         write_ring_append(session->write_ring, write_data, (int)write_len) :
+                         write_ring_push(session->write_ring, write_data, (int)write_len);
+            if (pushed < 0) {
+                if (write_ring_status(session->write_ring) < 0) {
+                    session_abort_write(session);
+                }
+                session->netascii = netascii_before;    // 客户端重传该块时重新解码
+                return;                                  // 环满时丢弃，客户端会重传
+            }
+        } else if (fwrite(write_data, 1, write_len, session->file_handle) != write_len) {
+            thread_safe_log("ERROR", "Failed to write data to file: %s", session->filepath);
+            send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_DISK_FULL, "Disk full or write error");
+            session->state = SESSION_DONE;
+            return;
+        }
+
+        session_sample_rtt(session, session->ack_sent_at);
+        session->stats.bytes_transferred += data_len;
+        session->metrics->bytes_received += (ULONGLONG)data_len;
+        session->retries = 0;
+
+        // 最后一块要等所有数据写入磁盘后才确认，客户端收到最终ACK即可认为上传成功
+        if (session->write_ring != NULL && data_len < (size_t)session->block_size) {
+            write_ring_close(session->write_ring);
+            session->state = SESSION_FLUSHING;
+            session_set_deadline(session);
+            return;
+        }
+
+        send_ack_packet(session->sock, &session->client_addr, session->current_block);
+        session->ack_sent_at = session->timers->now_ns;
+        session->current_block++;
+        session_set_deadline(session);
+
+        // 数据长度小于块大小，上传完成
+        if (data_len < (size_t)session->block_size) {
+            fclose(session->file_handle);
+            session->file_handle = NULL;
+            session_finish_upload(session);
+        }
+    } else if (session->state != SESSION_FLUSHING &&
+               packet.block_num == (unsigned short)(session->current_block - 1)) {
+        // 重复的数据包，说明上一个ACK丢失，重新发送
+        log_message_limited(session->log_limits, LOG_EVENT_DUPLICATE, "WARNING",
+                            "Client %s:%d: received duplicate packet, block %d (expected %d)",
+                            inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                            packet.block_num, session->current_block);
+        send_ack_packet(session->sock, &session->client_addr, packet.block_num);
+        session->ack_sent_at = 0;
+        session->stats.retransmissions++;
+        session->metrics->retransmissions++;
+    }
+}
+
+/**
+ * 组播下载超时：主客户端不响应时重发，放弃它后提升下一个客户端
+ * 刚提升的主客户端只重发MULTICAST_PROMOTE_RETRIES次OACK，不让一个已离开的客户端拖住整个组
+ */
+static void session_on_multicast_timeout(tftp_session_t* session) {
+    struct sockaddr_in master;
+    if (multicast_master(session->multicast, &master) < 0) {
+        session->state = SESSION_DONE;
+        return;
+    }
+
+    if ((session->state == SESSION_WAIT_OACK_ACK && session->retries >= MULTICAST_PROMOTE_RETRIES) ||
+        (session->retries >= MAX_RETRIES && session->timers->now - session->last_progress >= GIVE_UP_MS)) {
+        thread_safe_log("WARNING", "Master client %s:%d of multicast transfer %s timed out after %d retries",
+                       inet_ntoa(master.sin_addr), ntohs(master.sin_port), session->filename, session->retries);
+        send_error_packet(session->sock, &master, TFTP_ERROR_NOT_DEFINED, "Transfer timed out");
+        session_next_master(session, &master, 0);
+        return;
+    }
+
+    if (session->state == SESSION_WAIT_OACK_ACK) {
+        send_oack_packet(session->sock, &master, &session->options);
+        session->ack_sent_at = 0;
+        session_set_deadline(session);
+    } else {
+        log_message_limited(session->log_limits, LOG_EVENT_RETRANSMIT, "WARNING",
+                            "Multicast transfer %s: waiting for ACK timed out, retransmitting data packet %lu (RTO %d ms)",
+                            session->filename, (unsigned long)session->current_block, session->rtt.rto);
+        session_send_multicast_block(session, session->current_block);
+        session->ack_sent_at = 0;
+        session->stats.retransmissions++;
+        session->metrics->retransmissions++;
+    }
+}
+
+/**
+ * 处理会话的重传超时
+ *
+ * 功能说明：
+ * - 等待OACK确认：重发OACK
+ * - 下载：回退到最后确认的块之后重发整个窗口
+ * - 上传：重发最后一个ACK，促使客户端重传DATA
+ * - 上传完成后的保留期结束：正常回收会话
+ * - 上传等待最后的磁盘写入：继续等待
+ * - 每次超时RTO翻倍（指数退避），重发的包不再参与RTT采样
+ * - 连续超时达到MAX_RETRIES次且超过GIVE_UP_MS没有进展才放弃传输，
+ *   RTO很小时不会因几次快速重传就过早放弃
+ */
+static void session_on_timeout(tftp_session_t* session) {
+    if (session->state == SESSION_DALLY) {
+        session->state = SESSION_DONE;
+        return;
+    }
+    if (session->state == SESSION_FLUSHING) {
+        session_set_deadline(session);                   // 等待磁盘写入，不算客户端超时
+        return;
+    }
+
+    session->retries++;
+    session->metrics->timeouts++;
+    rtt_backoff(&session->rtt);
+    if (session->multicast != NULL) {
+        session_on_multicast_timeout(session);
+        return;
+    }
+    if (session->retries >= MAX_RETRIES &&
+        session->timers->now - session->last_progress >= GIVE_UP_MS) {
+        thread_safe_log("ERROR", "Client %s:%d: transfer of %s timed out after %d retries",
+                       inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                       session->filename, session->retries);
+        send_error_packet(session->sock, &session->client_addr, TFTP_ERROR_NOT_DEFINED, "Transfer timed out");
+        session->state = SESSION_DONE;
+        return;
+    }
+
+    switch (session->state) {
+        case SESSION_WAIT_OACK_ACK:
+            send_oack_packet(session->sock, &session->client_addr, &session->options);
+            session->ack_sent_at = 0;
+            session_set_deadline(session);
+            break;
+
+        case SESSION_SENDING:
+            log_message_limited(session->log_limits, LOG_EVENT_RETRANSMIT, "WARNING",
+                                "Client %s:%d: waiting for ACK timed out, retransmitting from data packet %lu (RTO %d ms)",
+                                inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                                session->base, session->rtt.rto);
+            session->next = session->base;
+            session_send_window(session);
+            break;
+
+        case SESSION_RECEIVING:
+            log_message_limited(session->log_limits, LOG_EVENT_RETRANSMIT, "WARNING",
+                                "Client %s:%d: waiting for DATA timed out, resending ACK %d",
+                                inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                                (unsigned short)(session->current_block - 1));
+            send_ack_packet(session->sock, &session->client_addr, (unsigned short)(session->current_block - 1));
+            session->ack_sent_at = 0;
+            session->stats.retransmissions++;
+            session->metrics->retransmissions++;
+            session_set_deadline(session);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * 输出并清零本统计周期的发送批量统计（每次发送调用平均发出的数据包数），
+ * 附带进程的活动会话数、缓冲池的堆分配情况（稳定运行时不再增长）和本引擎累计的ACK延迟百分位数
+ */
+static void engine_report_send_stats(tftp_engine_t* engine) {
+    tftp_send_queue_t* queue = &engine->send_queue;
+
+    if (queue->send_calls > 0) {
+        size_t heap_bytes;
+        unsigned long heap_allocs;
+        pool_get_stats(&heap_bytes, &heap_allocs);
+        const tftp_histogram_t* latency = &engine->metrics.ack_latency;
+        thread_safe_log("INFO", "Send batching: %llu DATA packets in %llu send calls (%.2f packets/call), %d active sessions, buffer pool: %zu bytes in %lu heap allocations, ACK latency p50/p99/p99.9: %.3f/%.3f/%.3f ms",
+                       queue->packets_sent, queue->send_calls,
+                       (double)queue->packets_sent / (double)queue->send_calls, session_table_count(),
+                       heap_bytes, heap_allocs, histogram_percentile(latency, 0.50) / 1e6,
+                       histogram_percentile(latency, 0.99) / 1e6, histogram_percentile(latency, 0.999) / 1e6);
+        queue->packets_sent = 0;
+        queue->send_calls = 0;
+    }
+    timer_wheel_schedule(&engine->timers, &engine->stats_timer, ENGINE_STATS_INTERVAL_MS);
+}
+
+/**
+ * 时间轮到期回调：统计定时器输出统计，会话定时器交给所属会话处理超时
+ * 本轮已结束的会话还未回收，直接忽略
+ */
+static void engine_on_timer(tftp_timer_t* timer, void* context) {
+    tftp_engine_t* engine = (tftp_engine_t*)context;
+
+    if (timer == &engine->stats_timer) {
+        engine_report_send_stats(engine);
+        return;
+    }
+
+    tftp_session_t* session = (tftp_session_t*)timer->owner;
+    if (session->state != SESSION_DONE) {
+        session_on_timeout(session);
+    }
+}
+
+/**
+ * 读取会话套接字上所有已到达的数据包并交给状态机处理
+ */
+static void engine_drain_session(tftp_engine_t* engine, tftp_session_t* session) {
+    for (int i = 0; i < ENGINE_RECV_BURST && session->state != SESSION_DONE; i++) {
+        // 写缓冲环满时数据报留在内核缓冲区，等I/O线程腾出槽位（背压）
+        if (session->write_ring != NULL && write_ring_full(session->write_ring)) {
+            return;
+        }
+
+        struct sockaddr_in from_addr;
+        int from_addr_len = sizeof(from_addr);
+
+        int recv_result = recvfrom(session->sock, engine->recv_buffer, engine->recv_buffer_size, 0,
+                                 (struct sockaddr*)&from_addr, &from_addr_len);
+        if (recv_result == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK && error != WSAECONNRESET) {
+                thread_safe_log("ERROR", "Failed to receive on transfer socket: %d", error);
+            }
+            return;
+        }
+        if (recv_result < 4) {
+            continue;
+        }
+
+        time(&session->last_activity);
+        if (session->multicast != NULL) {
+            session_on_multicast_packet(session, engine->recv_buffer, recv_result, &from_addr);
+        } else if (session->is_upload) {
+            session_on_wrq_packet(session, engine->recv_buffer, recv_result);
+        } else {
+            session_on_rrq_packet(session, engine->recv_buffer, recv_result);
+        }
+    }
+}
+
+/**
+ * 读取69端口上所有已到达的请求并分发
+ * RRQ/WRQ创建新会话，其余数据包按原有方式回复错误
+ */
+static void engine_drain_listener(tftp_engine_t* engine) {
+    for (int i = 0; i < ENGINE_RECV_BURST; i++) {
+        struct sockaddr_in client_addr;
+        int client_addr_len = sizeof(client_addr);
+
+        int recv_result = recvfrom(engine->listen_sock, engine->recv_buffer, BUFFER_SIZE, 0,
+                                 (struct sockaddr*)&client_addr, &client_addr_len);
+        if (recv_result == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK && error != WSAECONNRESET && error != WSAEINTR) {
+                thread_safe_log("ERROR", "Failed to receive data: %d", error);
+            }
+            return;
+        }
+
+        if (recv_result == 0) {
+            engine->metrics.invalid_packets++;
+            log_message_limited(engine->log_limits, LOG_EVENT_INVALID, "WARNING", "Received empty packet");
+            continue;
+        }
+
+        tftp_packet_view_t packet;
+        if (parse_tftp_packet(engine->recv_buffer, recv_result, &packet) < 0) {
+            engine->metrics.invalid_packets++;
+            log_message_limited(engine->log_limits, LOG_EVENT_INVALID, "WARNING", "Received invalid TFTP packet from %s:%d",
+                                inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            send_error_packet(engine->listen_sock, &client_addr,
+                            TFTP_ERROR_ILLEGAL_OPERATION, "Invalid packet format");
+            continue;
+        }
+
+        // 同一客户端TID已有传输时，这是客户端因OACK/首个DATA丢失而重发的请求，
+        // 已有会话会自行重传，不再创建第二个会话（可能由另一个工作线程负责）；
+        // 这里只是提前过滤，与正在加载文件的会话的竞争由engine_claim_session中的占位排除
+        if ((packet.opcode == TFTP_RRQ || packet.opcode == TFTP_WRQ) &&
+            session_table_contains(&client_addr, 0)) {
+            log_message_limited(engine->log_limits, LOG_EVENT_DUPLICATE, "WARNING",
+                                "Ignoring duplicate request from %s:%d, transfer already in progress",
+                                inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            continue;
+        }
+
+        switch (packet.opcode) {
+            case TFTP_RRQ:
+                engine_start_rrq(engine, &packet, &client_addr);
+                break;
+
+            case TFTP_WRQ:
+                engine_start_wrq(engine, &packet, &client_addr);
+                break;
+
+            case TFTP_DATA:
+            case TFTP_ACK:
+                engine->metrics.invalid_packets++;
+                log_message_limited(engine->log_limits, LOG_EVENT_INVALID, "WARNING",
+                                    "Received unexpected packet type %d from %s:%d",
+                                    packet.opcode, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+                send_error_packet(engine->listen_sock, &client_addr,
+                                TFTP_ERROR_UNKNOWN_TID, "Unknown transfer ID");
+                break;
+
+            case TFTP_ERROR:
+                thread_safe_log("INFO", "Client %s:%d reported error: %.*s",
+                               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),
+                               packet.payload_len, packet.payload);
+                break;
+
+            default:
+                send_error_packet(engine->listen_sock, &client_addr,
+                                TFTP_ERROR_ILLEGAL_OPERATION, "Unsupported operation");
+                break;
+        }
+    }
+}
+
+/**
+ * 初始化传输引擎
+ *
+ * 参数：
+ * - engine: 引擎结构
+ * - listen_sock: 已绑定69端口的监听套接字（将被设置为非阻塞）
+ * - config: 引擎配置（NULL表示全部使用默认值）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+int tftp_engine_init(tftp_engine_t* engine, SOCKET listen_sock, const tftp_engine_config_t* config) {
+    memset(engine, 0, sizeof(*engine));
+    engine->listen_sock = listen_sock;
+    engine->session_capacity = 64;
+    engine->sessions = (tftp_session_t**)malloc((size_t)engine->session_capacity * sizeof(tftp_session_t*));
+    engine->poll_fds = (WSAPOLLFD*)malloc((size_t)(engine->session_capacity + 2) * sizeof(WSAPOLLFD));
+    engine->recv_buffer_size = TFTP_HEADER_SIZE + MAX_BLOCK_SIZE;
+    engine->recv_buffer = (char*)malloc((size_t)engine->recv_buffer_size);
+    timer_wheel_init(&engine->timers, GetTickCount64());
+    send_queue_init(&engine->send_queue, listen_sock);
+    engine->send_queue.uso_enabled = (config != NULL) ? config->use_uso : 0;
+
+    if (engine->sessions == NULL || engine->poll_fds == NULL || engine->recv_buffer == NULL) {
+        tftp_engine_cleanup(engine);
+        return -1;
+    }
+
+    if (file_io_init(&engine->file_io, (config != NULL) ? config->file_io : FILE_IO_SYNC) < 0) {
+        tftp_engine_cleanup(engine);
+        return -1;
+    }
+
+    unsigned long non_blocking = 1;
+    if (ioctlsocket(listen_sock, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+        tftp_engine_cleanup(engine);
+        return -1;
+    }
+
+    engine->stats_timer.owner = engine;
+    timer_wheel_schedule(&engine->timers, &engine->stats_timer, ENGINE_STATS_INTERVAL_MS);
+
+    engine->running = 1;
+    return 0;
+}
+
+/**
+ * 运行事件循环，直到running被清零
+ *
+ * 每轮循环：
+ * 1. 由时间轮给出最近的重传截止时间，作为WSAPoll等待时长
+ * 2. 等待监听套接字和所有会话套接字就绪
+ * 3. 读取一次时钟，处理新请求和会话数据包
+ * 4. 取回完成的文件读请求，检查上传的后台写入，推进时间轮，处理到期的重传超时
+ * 5. 批量发出本轮产生的DATA包
+ * 6. 回收已结束的会话（仍有读请求未取回的会话先取消读请求，下一轮再回收）
+ */
+void tftp_engine_run(tftp_engine_t* engine) {
+    while (engine->running) {
+        int wait_ms = timer_wheel_next_timeout(&engine->timers, ENGINE_MAX_POLL_WAIT_MS);
+
+        // 构建poll数组；写缓冲环已满的上传暂不读取，等待磁盘的上传缩短等待时间以便及时恢复；
+        // 已结束、只等读请求取回的会话不再读取
+        engine->poll_fds[0].fd = engine->listen_sock;
+        engine->poll_fds[0].events = POLLRDNORM;
+        engine->poll_fds[0].revents = 0;
+        for (int i = 0; i < engine->session_count; i++) {
+            tftp_session_t* session = engine->sessions[i];
+            engine->poll_fds[i + 1].fd = session->sock;
+            engine->poll_fds[i + 1].events = (session->state == SESSION_DONE) ? 0 : POLLRDNORM;
+            engine->poll_fds[i + 1].revents = 0;
+            if (session->write_ring != NULL &&
+                (session->state == SESSION_FLUSHING || write_ring_full(session->write_ring))) {
+                if (session->state != SESSION_FLUSHING) {
+                    engine->poll_fds[i + 1].events = 0;
+                }
+                if (wait_ms > ENGINE_WRITE_POLL_MS) {
+                    wait_ms = ENGINE_WRITE_POLL_MS;
+                }
+            }
+        }
+
+        int poll_count = engine->session_count + 1;
+        if (engine->file_io.wake_sock != INVALID_SOCKET) {
+            // 异步文件I/O的完成线程通过唤醒套接字打断等待
+            engine->poll_fds[poll_count].fd = engine->file_io.wake_sock;
+            engine->poll_fds[poll_count].events = POLLRDNORM;
+            engine->poll_fds[poll_count].revents = 0;
+            poll_count++;
+        }
+        int ready = WSAPoll(engine->poll_fds, (ULONG)poll_count, wait_ms);
+        if (ready == SOCKET_ERROR) {
+            thread_safe_log("ERROR", "WSAPoll failed: %d", WSAGetLastError());
+            Sleep(10);
+            continue;
+        }
+
+        // 本轮所有会话设置截止时间都以这次读取的时间为基准
+        timer_wheel_set_time(&engine->timers, GetTickCount64());
+        engine->timers.now_ns = timing_now_ns();
+
+        // 先处理已有会话，再接纳新请求（新会话追加在数组末尾，不影响本轮遍历）
+        int existing_count = engine->session_count;
+        for (int i = 0; i < existing_count && ready > 0; i++) {
+            if (engine->poll_fds[i + 1].revents != 0) {
+                engine_drain_session(engine, engine->sessions[i]);
+            }
+        }
+        if (engine->poll_fds[0].revents != 0) {
+            engine_drain_listener(engine);
+        }
+
+        // 取回完成的文件读请求，发送等待这些数据的块
+        file_io_reap(&engine->file_io, engine_on_read_complete, engine);
+
+        // 检查上传的后台写入：写入失败的终止，写完的发送最终ACK
+        for (int i = 0; i < engine->session_count; i++) {
+            tftp_session_t* session = engine->sessions[i];
+            if (session->write_ring != NULL && session->state != SESSION_DONE) {
+                session_check_write(session);
+            }
+        }
+
+        // 处理到期的重传超时
+        timer_wheel_advance(&engine->timers, engine_on_timer, engine);
+
+        // 发出本轮所有会话排队的DATA包（会话回收前必须完成，队列引用会话的窗口缓冲区）
+        send_queue_flush(&engine->send_queue);
+
+        // 回收已结束的会话，保持数组紧凑；读请求未全部取回的会话取消读请求后保留到下一轮
+        int kept = 0;
+        for (int i = 0; i < engine->session_count; i++) {
+            tftp_session_t* session = engine->sessions[i];
+            if (session->state == SESSION_DONE && session->reads_in_flight > 0) {
+                file_io_cancel(session->file_io, &session->io_file);
+                engine->sessions[kept++] = session;
+            } else if (session->state == SESSION_DONE) {
+                session_close(session);
+            } else {
+                engine->sessions[kept++] = session;
+            }
+        }
+        engine->session_count = kept;
+    }
+}
+
+/**
+ * 释放引擎资源，关闭所有未完成的会话
+ */
+void tftp_engine_cleanup(tftp_engine_t* engine) {
+    if (engine->sessions != NULL) {
+        send_queue_flush(&engine->send_queue);
+    }
+
+    // 取消并取回所有进行中的读请求，之后才能释放会话的窗口缓冲区
+    int reads_in_flight = 1;
+    while (engine->file_io.ops != NULL && reads_in_flight) {
+        reads_in_flight = 0;
+        for (int i = 0; i < engine->session_count; i++) {
+            tftp_session_t* session = engine->sessions[i];
+            session->state = SESSION_DONE;
+            if (session->reads_in_flight > 0) {
+                file_io_cancel(session->file_io, &session->io_file);
+                reads_in_flight = 1;
+            }
+        }
+        if (reads_in_flight && file_io_reap(&engine->file_io, engine_on_read_complete, engine) == 0) {
+            Sleep(1);
+        }
+    }
+
+    for (int i = 0; i < engine->session_count; i++) {
+        session_close(engine->sessions[i]);
+    }
+    engine->session_count = 0;
+    log_limits_report(engine->log_limits, NULL);
+    file_io_cleanup(&engine->file_io);
+    session_table_release_cache(&engine->pool);
+    pool_cache_release(&engine->pool);
+
+    free(engine->sessions);
+    free(engine->poll_fds);
+    free(engine->recv_buffer);
+    engine->sessions = NULL;
+    engine->poll_fds = NULL;
+    engine->recv_buffer = NULL;
+}
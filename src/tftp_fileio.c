@@ -0,0 +1,414 @@
+#include "../include/tftp.h"
+#include <process.h>
+
+/*
+ * 可插拔的文件I/O后端（事件驱动引擎下载使用）
+ *
+ * 设计思路：
+ * - 会话提前提交读请求，读完成后再发送对应的数据块，
+ *   事件循环线程从不等待磁盘：磁盘慢或页缓存未命中时只有该会话等待，
+ *   其他会话的收发照常进行
+ * - 后端通过操作表选择：
+ *   同步后端把文件映射到内存，读请求立即完成，数据直接指向映射视图；
+ *   异步后端用FILE_FLAG_OVERLAPPED打开文件，重叠ReadFile直接读入会话的预读缓冲区，
+ *   完成通知投递到每个引擎自己的I/O完成端口
+ * - 完成线程阻塞在GetQueuedCompletionStatus上，把完成的请求挂到完成链表，
+ *   并向回环唤醒套接字发一个字节，使事件循环的WSAPoll立即返回取回结果
+ * - 文件设置FILE_SKIP_COMPLETION_PORT_ON_SUCCESS，命中系统缓存而立即完成的读
+ *   不经过完成线程，提交时直接得到结果
+ * - 预读提示：文件以FILE_FLAG_SEQUENTIAL_SCAN打开（顺序访问）；同步后端的读请求
+ *   调用PrefetchVirtualMemory让系统提前换入该段映射，发送时不再在事件循环中缺页，
+ *   异步后端的读请求本身就是提前读取
+ * - 异步后端初始化失败时回退为同步后端
+ */
+
+#define FILE_IO_QUIT_KEY 1              // 通知完成线程退出的完成键
+
+#ifndef FILE_SKIP_COMPLETION_PORT_ON_SUCCESS
+#define FILE_SKIP_COMPLETION_PORT_ON_SUCCESS 0x1
+#endif
+
+/**
+ * 计算读请求实际可读的字节数（不超过文件末尾）
+ */
+static int file_io_clamp(tftp_io_request_t* request) {
+    ULONGLONG size = request->file->size;
+    ULONGLONG remaining = (request->offset < size) ? size - request->offset : 0;
+    return (remaining < (ULONGLONG)request->length) ? (int)remaining : request->length;
+}
+
+/**
+ * 把完成的请求挂到完成链表，必要时唤醒事件循环（完成线程调用）
+ */
+static void file_io_complete(tftp_file_io_t* io, tftp_io_request_t* request) {
+    int wake = 0;
+
+    EnterCriticalSection(&io->lock);
+    request->next_done = NULL;
+    if (io->done_tail != NULL) {
+        io->done_tail->next_done = request;
+    } else {
+        io->done_head = request;
+    }
+    io->done_tail = request;
+    if (!io->wake_pending) {
+        io->wake_pending = 1;
+        wake = 1;
+    }
+    LeaveCriticalSection(&io->lock);
+
+    if (wake) {
+        send(io->wake_sock, "", 1, 0);
+    }
+}
+
+/* ---------------- 同步后端：文件映射 ---------------- */
+
+// PrefetchVirtualMemory需要Windows 8及以上版本，运行时查找
+typedef struct {
+    PVOID address;
+    SIZE_T length;
+} tftp_memory_range_t;
+typedef BOOL (WINAPI *tftp_prefetch_memory_fn)(HANDLE process, ULONG_PTR count,
+                                               tftp_memory_range_t* ranges, ULONG flags);
+
+static tftp_prefetch_memory_fn prefetch_virtual_memory;
+
+static int sync_init(tftp_file_io_t* io) {
+    (void)io;
+    HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+    if (kernel32 != NULL) {
+        prefetch_virtual_memory = (tftp_prefetch_memory_fn)(void (*)(void))
+                                  GetProcAddress(kernel32, "PrefetchVirtualMemory");
+    }
+    return 0;
+}
+
+static int sync_open(tftp_file_io_t* io, const char* path, tftp_io_file_t* file) {
+    (void)io;
+    if (file_map_open(path, &file->map) < 0) {
+        return -1;
+    }
+    file->size = file->map.size;
+    return 0;
+}
+
+static int sync_read(tftp_file_io_t* io, tftp_io_request_t* request) {
+    (void)io;
+    request->result = file_io_clamp(request);
+    request->data = request->file->map.data + request->offset;
+
+    // 只是提示，系统不支持或失败时发送时照常缺页读入
+    if (prefetch_virtual_memory != NULL && request->result > 0) {
+        tftp_memory_range_t range;
+        range.address = (PVOID)request->data;
+        range.length = (SIZE_T)request->result;
+        prefetch_virtual_memory(GetCurrentProcess(), 1, &range, 0);
+    }
+    return 1;
+}
+
+static void sync_cancel(tftp_file_io_t* io, tftp_io_file_t* file) {
+    (void)io;
+    (void)file;
+}
+
+static void sync_close(tftp_file_io_t* io, tftp_io_file_t* file) {
+    (void)io;
+    file_map_close(&file->map);
+}
+
+static void sync_cleanup(tftp_file_io_t* io) {
+    (void)io;
+}
+
+static const tftp_file_io_ops_t sync_ops = {
+    "sync", 0, sync_init, sync_open, sync_read, sync_cancel, sync_close, sync_cleanup
+};
+
+/* ---------------- 异步后端：I/O完成端口 ---------------- */
+
+/**
+ * 完成线程：取出完成通知并转交事件循环
+ */
+static unsigned __stdcall iocp_thread(void* param) {
+    tftp_file_io_t* io = (tftp_file_io_t*)param;
+
+    for (;;) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        LPOVERLAPPED overlapped = NULL;
+
+        BOOL ok = GetQueuedCompletionStatus(io->port, &bytes, &key, &overlapped, INFINITE);
+        if (overlapped == NULL) {
+            if (key == FILE_IO_QUIT_KEY || !ok) {
+                break;                                   // 退出通知或完成端口已关闭
+            }
+            continue;
+        }
+
+        // OVERLAPPED是请求的第一个成员
+        tftp_io_request_t* request = (tftp_io_request_t*)overlapped;
+        if (ok) {
+            request->result = (int)bytes;
+        } else {
+            request->result = (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;   // 被取消的读也按失败处理
+        }
+        file_io_complete(io, request);
+    }
+    return 0;
+}
+
+/**
+ * 创建唤醒套接字：绑定回环地址并连接到自身，完成线程向它发送即可唤醒WSAPoll
+ */
+static SOCKET iocp_create_wake_socket(void) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    struct sockaddr_in addr;
+    int addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    unsigned long non_blocking = 1;
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(sock, (struct sockaddr*)&addr, &addr_len) == SOCKET_ERROR ||
+        connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        ioctlsocket(sock, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+static int iocp_init(tftp_file_io_t* io) {
+    io->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (io->port == NULL) {
+        return -1;
+    }
+
+    io->wake_sock = iocp_create_wake_socket();
+    if (io->wake_sock == INVALID_SOCKET) {
+        CloseHandle(io->port);
+        io->port = NULL;
+        return -1;
+    }
+
+    io->thread = (HANDLE)_beginthreadex(NULL, 0, iocp_thread, io, 0, NULL);
+    if (io->thread == 0) {
+        closesocket(io->wake_sock);
+        io->wake_sock = INVALID_SOCKET;
+        CloseHandle(io->port);
+        io->port = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int iocp_open(tftp_file_io_t* io, const char* path, tftp_io_file_t* file) {
+    LARGE_INTEGER size;
+
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if (!GetFileSizeEx(handle, &size) || CreateIoCompletionPort(handle, io->port, 0, 0) == NULL) {
+        CloseHandle(handle);
+        return -1;
+    }
+
+    file->handle = handle;
+    file->size = (ULONGLONG)size.QuadPart;
+    file->skip_port_on_success =
+        SetFileCompletionNotificationModes(handle, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS) ? 1 : 0;
+    return 0;
+}
+
+static int iocp_read(tftp_file_io_t* io, tftp_io_request_t* request) {
+    DWORD bytes = 0;
+    (void)io;
+
+    memset(&request->overlapped, 0, sizeof(request->overlapped));
+    request->overlapped.Offset = (DWORD)(request->offset & 0xFFFFFFFF);
+    request->overlapped.OffsetHigh = (DWORD)(request->offset >> 32);
+    request->data = request->buffer;
+
+    if (ReadFile(request->file->handle, request->buffer, (DWORD)file_io_clamp(request),
+                 &bytes, &request->overlapped)) {
+        if (!request->file->skip_port_on_success) {
+            return 0;                                    // 立即完成也会投递通知，等待取回
+        }
+        request->result = (int)bytes;
+        return 1;
+    }
+
+    DWORD error = GetLastError();
+    if (error == ERROR_IO_PENDING) {
+        return 0;
+    }
+    if (error == ERROR_HANDLE_EOF) {
+        request->result = 0;
+        return 1;
+    }
+    thread_safe_log("ERROR", "ReadFile failed (%lu) at offset %llu", (unsigned long)error, request->offset);
+    return -1;
+}
+
+static void iocp_cancel(tftp_file_io_t* io, tftp_io_file_t* file) {
+    (void)io;
+    CancelIoEx(file->handle, NULL);
+}
+
+static void iocp_close(tftp_file_io_t* io, tftp_io_file_t* file) {
+    (void)io;
+    CloseHandle(file->handle);
+    file->handle = INVALID_HANDLE_VALUE;
+}
+
+static void iocp_cleanup(tftp_file_io_t* io) {
+    PostQueuedCompletionStatus(io->port, 0, FILE_IO_QUIT_KEY, NULL);
+    WaitForSingleObject(io->thread, INFINITE);
+    CloseHandle(io->thread);
+    CloseHandle(io->port);
+    closesocket(io->wake_sock);
+    io->wake_sock = INVALID_SOCKET;
+}
+
+static const tftp_file_io_ops_t iocp_ops = {
+    "iocp", 1, iocp_init, iocp_open, iocp_read, iocp_cancel, iocp_close, iocp_cleanup
+};
+
+/* ---------------- 通用接口 ---------------- */
+
+/**
+ * 初始化文件I/O后端
+ *
+ * 参数：
+ * - io: 后端实例
+ * - kind: 期望的后端类型，异步后端不可用时回退为同步后端
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+int file_io_init(tftp_file_io_t* io, tftp_file_io_kind_t kind) {
+    memset(io, 0, sizeof(*io));
+    InitializeCriticalSection(&io->lock);
+    io->wake_sock = INVALID_SOCKET;
+
+    io->ops = (kind == FILE_IO_IOCP) ? &iocp_ops : &sync_ops;
+    if (io->ops->init(io) < 0) {
+        if (io->ops == &sync_ops) {
+            DeleteCriticalSection(&io->lock);
+            io->ops = NULL;
+            return -1;
+        }
+        thread_safe_log("WARNING", "File I/O backend %s unavailable (%lu), falling back to %s",
+                       io->ops->name, (unsigned long)GetLastError(), sync_ops.name);
+        io->ops = &sync_ops;
+        io->ops->init(io);
+    }
+    return 0;
+}
+
+/**
+ * 打开只读文件
+ *
+ * 返回值：
+ * - 成功：0（file->size为文件大小）
+ * - 失败：-1
+ */
+int file_io_open(tftp_file_io_t* io, const char* path, tftp_io_file_t* file) {
+    memset(file, 0, sizeof(*file));
+    file->handle = INVALID_HANDLE_VALUE;
+    file->map.file = INVALID_HANDLE_VALUE;
+    return io->ops->open(io, path, file);
+}
+
+/**
+ * 提交读请求
+ *
+ * 参数：
+ * - io: 后端实例
+ * - request: 已填好file、offset、buffer、length的读请求，完成前必须保持有效
+ *
+ * 返回值：
+ * - 1：已立即完成（result和data已填好）
+ * - 0：进行中，完成后由file_io_reap取回
+ * - -1：提交失败
+ */
+int file_io_read(tftp_file_io_t* io, tftp_io_request_t* request) {
+    int result = io->ops->read(io, request);
+    request->in_flight = (result == 0);
+    return result;
+}
+
+/**
+ * 取消文件上所有进行中的读请求（被取消的请求仍会以失败结果取回）
+ */
+void file_io_cancel(tftp_file_io_t* io, tftp_io_file_t* file) {
+    io->ops->cancel(io, file);
+}
+
+/**
+ * 关闭文件（调用前该文件上的读请求必须已全部取回）
+ */
+void file_io_close(tftp_file_io_t* io, tftp_io_file_t* file) {
+    io->ops->close(io, file);
+}
+
+/**
+ * 取回所有已完成的读请求（事件循环每轮调用）
+ *
+ * 参数：
+ * - io: 后端实例
+ * - on_complete: 每个完成的请求调用一次
+ * - context: 传给on_complete的上下文
+ *
+ * 返回值：
+ * - 取回的请求数
+ */
+int file_io_reap(tftp_file_io_t* io, void (*on_complete)(tftp_io_request_t* request, void* context),
+                 void* context) {
+    // 先清空唤醒套接字再取链表：之后完成的请求一定会重新发送唤醒字节
+    if (io->wake_sock != INVALID_SOCKET) {
+        char byte;
+        while (recv(io->wake_sock, &byte, 1, 0) > 0) {
+        }
+    }
+
+    EnterCriticalSection(&io->lock);
+    tftp_io_request_t* request = io->done_head;
+    io->done_head = NULL;
+    io->done_tail = NULL;
+    io->wake_pending = 0;
+    LeaveCriticalSection(&io->lock);
+
+    int count = 0;
+    while (request != NULL) {
+        tftp_io_request_t* next = request->next_done;
+        request->in_flight = 0;
+        on_complete(request, context);
+        request = next;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * 停止完成线程并释放后端资源
+ */
+void file_io_cleanup(tftp_file_io_t* io) {
+    if (io->ops == NULL) {
+        return;
+    }
+    io->ops->cleanup(io);
+    DeleteCriticalSection(&io->lock);
+    io->ops = NULL;
+}
@@ -1,5 +1,71 @@
 #include "../include/tftp.h"
 
+/**
+ * 发送OACK并等待客户端的ACK(0)确认
+ * 
+ * 功能说明：
+ * - RFC 2347规定：下载时服务器以OACK回应带选项的RRQ，
+ *   客户端以块号为0的ACK确认后，服务器才开始发送数据
+ * - 超时后重发OACK，最多重试MAX_RETRIES次
+ * - 客户端以错误包拒绝选项时放弃传输
+ * 
+ * 参数：
+ * - data_sock: 数据传输套接字
+ * - client_addr: 客户端地址信息
+ * - accepted: 服务器接受的选项
+ * 
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+static int send_oack_and_wait(SOCKET data_sock, struct sockaddr_in* client_addr, 
+                              const tftp_options_t* accepted) {
+    for (int retries = 0; retries < MAX_RETRIES; retries++) {
+        if (send_oack_packet(data_sock, client_addr, accepted) < 0) {
+            return -1;
+        }
+        
+        char buffer[BUFFER_SIZE];
+        struct sockaddr_in recv_addr;
+        int recv_addr_len = sizeof(recv_addr);
+        
+        int recv_result = recvfrom(data_sock, buffer, sizeof(buffer), 0,
+                                 (struct sockaddr*)&recv_addr, &recv_addr_len);
+        
+        if (recv_result == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error == WSAETIMEDOUT) {
+                log_message("WARNING", "Waiting for OACK acknowledgement timed out, retransmitting OACK");
+                continue;
+            }
+            log_message("ERROR", "Failed to receive OACK acknowledgement: %d", error);
+            return -1;
+        }
+        
+        if (recv_result < 4) {
+            continue;
+        }
+        
+        unsigned short opcode = ntohs(*(unsigned short*)buffer);
+        unsigned short block = ntohs(*(unsigned short*)(buffer + 2));
+        
+        if (opcode == TFTP_ACK && block == 0) {
+            log_message("DEBUG", "Received ACK for OACK");
+            return 0;
+        }
+        if (opcode == TFTP_ERROR) {
+            // 错误消息不一定以NUL结尾，按收到的长度截断
+            log_message("ERROR", "Client rejected options (code:%d): %.*s", block,
+                       (int)strnlen(buffer + 4, (size_t)(recv_result - 4)), buffer + 4);
+            return -1;
+        }
+    }
+    
+    log_message("ERROR", "OACK was not acknowledged, reached maximum retry count");
+    send_error_packet(data_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Transfer timed out");
+    return -1;
+}
+
 /**
  * 处理TFTP读请求（RRQ）- 客户端下载文件
  * 
@@ -14,28 +80,20 @@
  * TFTP读请求流程：
  * 1. 客户端发送RRQ包（包含文件名和传输模式）
  * 2. 服务器打开文件并验证
- * 3. 服务器创建新端口用于数据传输
- * 4. 服务器发送数据包，等待ACK确认
- * 5. 重复步骤4直到文件传输完成
+ * 3. 服务器创建新端口用于数据传输，请求带有选项时先以OACK确认
+ * 4. 服务器连续发送一个窗口的数据包（默认1块，可由windowsize选项协商），等待累计ACK确认
+ * 5. 重复步骤4直到文件传输完成，超时则从最后确认的块之后回退重传
  * 
  * 参数：
  * - sock: 服务器主监听套接字
  * - packet: 解析后的RRQ请求包
  * - client_addr: 客户端地址信息
  */
-void handle_rrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr) {
-    char* ptr = (char*)packet + 2;                       // 跳过2字节操作码
-    char filename[MAX_FILENAME_LEN];                     // 存储文件名
-    char mode[MAX_MODE_LEN];                             // 存储传输模式
+void handle_rrq(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr) {
+    const char* filename = packet->filename;             // 文件名（指向接收缓冲区，以null结尾）
+    const char* mode = packet->mode;                     // 传输模式（netascii或octet）
     char filepath[512];                                  // 存储完整文件路径
     
-    // 解析文件名（以null结尾的字符串）
-    strcpy(filename, ptr);
-    ptr += strlen(filename) + 1;                         // 移动指针到下一个字段
-    
-    // 解析传输模式（netascii或octet）
-    strcpy(mode, ptr);
-    
     // 记录客户端请求信息
     log_message("INFO", "Client %s:%d requests download file: %s, mode: %s", 
                inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port), 
@@ -44,23 +102,35 @@ void handle_rrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
     // 构造完整的文件路径（在tftp_root目录下）
     snprintf(filepath, sizeof(filepath), "tftp_root/%s", filename);
     
-    // 根据传输模式选择文件打开方式
-    // netascii模式用文本方式，octet模式用二进制方式
-    FILE* file = fopen(filepath, (parse_mode(mode) == MODE_NETASCII) ? "r" : "rb");
+    // 两种模式都以二进制方式打开，netascii模式读取时显式编码
+    FILE* file = fopen(filepath, "rb");
     if (file == NULL) {
         log_message("ERROR", "Cannot open file: %s", filepath);
         send_error_packet(sock, client_addr, TFTP_ERROR_FILE_NOT_FOUND, "File not found");
         return;
     }
     
-    // 初始化文件传输统计信息
-    tftp_stats_t stats = {0};
-    time(&stats.start_time);                             // 记录传输开始时间
-    
-    unsigned short block_num = 1;                        // 数据块号（从1开始）
-    char data_buffer[DATA_SIZE];                         // 数据缓冲区（512字节）
-    int bytes_read;                                      // 实际读取的字节数
-    int retries = 0;                                     // 重试次数
+    // 协商选项扩展，客户端未请求windowsize时按RFC 1350逐块确认（窗口为1）
+    tftp_options_t accepted;
+    int has_options = negotiate_options(&packet->options, 0, &accepted);
+    if (accepted.tsize) {
+        // tsize回复实际要发送的字节数：octet为文件大小，netascii为编码后的长度
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        int tsize_result = -1;
+        if (parse_mode(mode) == MODE_NETASCII) {
+            tsize_result = netascii_file_size(file, &accepted.tsize_value);
+        } else if (GetFileAttributesExA(filepath, GetFileExInfoStandard, &attributes)) {
+            accepted.tsize_value = ((ULONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+            tsize_result = 0;
+        }
+        if (tsize_result < 0) {
+            accepted.tsize = 0;
+            has_options--;
+        }
+    }
+    int window_size = (accepted.windowsize > 0) ? accepted.windowsize : 1;
+    int block_size = (accepted.blksize > 0) ? accepted.blksize : DATA_SIZE;
+    size_t slot_size = TFTP_HEADER_SIZE + (size_t)block_size;  // 每个槽位预留头部空间，原地发送
     
     // 创建新的UDP套接字用于数据传输
     // TFTP协议要求：数据传输使用服务器动态分配的新端口
@@ -88,81 +158,181 @@ void handle_rrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
     }
     
     // 设置套接字接收超时时间
-    // 用于处理网络延迟和丢包情况
-    int timeout = TIMEOUT_SECONDS * 1000;               // 转换为毫秒
+    // 用于处理网络延迟和丢包情况，客户端协商了timeout选项时按协商值
+    int timeout = ((accepted.timeout > 0) ? accepted.timeout : TIMEOUT_SECONDS) * 1000; // 转换为毫秒
     setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
     
-    // 开始文件数据传输循环
-    // 每次读取最多512字节数据，分块发送
-    while ((bytes_read = fread(data_buffer, 1, DATA_SIZE, file)) > 0) {
-        int ack_received = 0;                            // ACK接收标志
-        retries = 0;                                     // 重置重试计数器
+    // 窗口缓冲区：按协商的块大小分配，保存已发送但尚未确认的数据块，超时后从中回退重传
+    char* window_buffer = (char*)malloc((size_t)window_size * slot_size);
+    int* window_lens = (int*)malloc((size_t)window_size * sizeof(int));
+    ULONGLONG* send_ns = (ULONGLONG*)malloc((size_t)window_size * sizeof(ULONGLONG)); // 各槽位首次发送时间（0表示已重传）
+    if (window_buffer == NULL || window_lens == NULL || send_ns == NULL) {
+        log_message("ERROR", "Failed to allocate window buffer");
+        free(window_buffer);
+        free(window_lens);
+        free(send_ns);
+        closesocket(data_sock);
+        fclose(file);
+        send_error_packet(sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return;
+    }
+    
+    // netascii编码状态，读缓冲区在栈上
+    int netascii = (parse_mode(mode) == MODE_NETASCII);
+    char netascii_input[NETASCII_READ_SIZE];
+    tftp_netascii_t netascii_state;
+    netascii_init(&netascii_state, netascii_input);
+    
+    // 初始化文件传输统计信息
+    tftp_stats_t stats = {0};
+    stats.start_ns = timing_now_ns();                    // 记录传输开始时间（纳秒）
+    
+    // 重传、无效包等热路径日志按类别限速，异常客户端不会刷屏
+    tftp_log_limiter_t log_limits[LOG_EVENT_COUNT];
+    memset(log_limits, 0, sizeof(log_limits));
+    
+    // 接受了选项时先发送OACK，客户端以ACK(0)确认后才开始发送数据
+    if (has_options && send_oack_and_wait(data_sock, client_addr, &accepted) < 0) {
+        free(window_buffer);
+        free(window_lens);
+        free(send_ns);
+        closesocket(data_sock);
+        fclose(file);
+        return;
+    }
+    
+    // 块序号使用32位计数，发送时截断为16位块号，大文件块号回绕也能正确处理
+    unsigned long base = 1;                              // 最早未确认的块序号
+    unsigned long next = 1;                              // 下一个待发送的块序号
+    unsigned long read_upto = 0;                         // 已读入窗口缓冲区的最大块序号
+    unsigned long last_block = 0;                        // 最后一块的序号（0表示尚未读到文件末尾）
+    int retries = 0;                                     // 连续超时次数
+    int transfer_complete = 0;
+    
+    // 滑动窗口传输：连续发送窗口内的数据块，再等待累计确认
+    while (!transfer_complete) {
+        int send_failed = 0;
         
-        // 可靠传输机制：发送数据包并等待ACK确认
-        // 如果超时或收到错误ACK，则重传，最多重试MAX_RETRIES次
-        while (!ack_received && retries < MAX_RETRIES) {
-            // 发送当前数据块
-            if (send_data_packet(data_sock, client_addr, block_num, data_buffer, bytes_read) < 0) {
-                log_message("ERROR", "Failed to send data packet, block number: %d");
+        // 在窗口允许的范围内连续发送数据块
+        while (next < base + window_size && (last_block == 0 || next <= last_block)) {
+            int slot = (int)((next - 1) % window_size);
+            char* block_packet = window_buffer + (size_t)slot * slot_size;
+            
+            if (next > read_upto) {
+                // 首次发送该块，从文件读取（netascii模式读取并编码）；不足一个块大小（含0字节）说明是最后一块
+                window_lens[slot] = netascii ?
+                    (int)netascii_read(&netascii_state, file, block_packet + TFTP_HEADER_SIZE, (size_t)block_size) :
+                    (int)fread(block_packet + TFTP_HEADER_SIZE, 1, block_size, file);
+                read_upto = next;
+                if (window_lens[slot] < block_size) {
+                    last_block = next;
+                }
+                send_ns[slot] = timing_now_ns();
+            } else {
+                stats.retransmissions++;                 // 回退重传窗口中的块
+                send_ns[slot] = 0;                       // 重传的块不测量延迟（Karn算法）
+            }
+            
+            if (send_data_block(data_sock, client_addr, (unsigned short)next, 
+                                block_packet, window_lens[slot]) < 0) {
+                log_message("ERROR", "Failed to send data packet, block number: %lu", next);
+                send_failed = 1;
                 break;
             }
             
             stats.blocks_sent++;
-            
-            // 等待ACK
-            char ack_buffer[4];
-            struct sockaddr_in ack_addr;
-            int ack_addr_len = sizeof(ack_addr);
-            
-            int recv_result = recvfrom(data_sock, ack_buffer, sizeof(ack_buffer), 0,
-                                     (struct sockaddr*)&ack_addr, &ack_addr_len);
-            
-            if (recv_result == SOCKET_ERROR) {
-                int error = WSAGetLastError();
-                if (error == WSAETIMEDOUT) {
-                    log_message("WARNING", "Waiting for ACK timed out, retransmitting data packet, block number: %d", block_num);
-                    retries++;
-                    stats.retransmissions++;
-                    continue;
-                } else {
-                    log_message("ERROR", "Failed to receive ACK: %d", error);
+            next++;
+        }
+        
+        if (send_failed) {
+            break;
+        }
+        
+        // 等待ACK（缓冲区按最大包长分配，客户端发来的错误包也能完整接收）
+        char ack_buffer[BUFFER_SIZE];
+        struct sockaddr_in ack_addr;
+        int ack_addr_len = sizeof(ack_addr);
+        
+        int recv_result = recvfrom(data_sock, ack_buffer, sizeof(ack_buffer), 0,
+                                 (struct sockaddr*)&ack_addr, &ack_addr_len);
+        
+        if (recv_result == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error == WSAETIMEDOUT) {
+                retries++;
+                if (retries >= MAX_RETRIES) {
+                    log_message("ERROR", "Number %lu transmission failed, reached maximum retry count", base);
+                    send_error_packet(data_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Transfer timed out");
                     break;
                 }
-            }
-            
-            // 验证ACK包
-            unsigned short ack_opcode = ntohs(*(unsigned short*)ack_buffer);
-            unsigned short ack_block = ntohs(*(unsigned short*)(ack_buffer + 2));
-            
-            if (ack_opcode == TFTP_ACK && ack_block == block_num) {
-                log_message("DEBUG", "Received ACK, block number: %d", block_num);
-                ack_received = 1;
-                stats.bytes_transferred += bytes_read;
+                log_message_limited(log_limits, LOG_EVENT_RETRANSMIT, "WARNING",
+                                    "Waiting for ACK timed out, retransmitting from block number: %lu", base);
+                next = base;                             // 回退到最后确认位置之后重传
+                continue;
             } else {
-                log_message("WARNING", "Received invalid ACK, expected block number: %d, received block number: %d",
-                           block_num, ack_block);
-                retries++;
+                log_message("ERROR", "Failed to receive ACK: %d", error);
+                break;
             }
         }
         
-        if (!ack_received) {
-            log_message("ERROR", "Number %d transmission failed, reached maximum retry count", block_num);
-            send_error_packet(data_sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Transfer timed out");
-            break;
+        if (recv_result < 4) {
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING",
+                                "Received truncated packet, size: %d bytes", recv_result);
+            continue;
         }
         
-        block_num++;
+        // 验证ACK包
+        unsigned short ack_opcode = ntohs(*(unsigned short*)ack_buffer);
+        unsigned short ack_block = ntohs(*(unsigned short*)(ack_buffer + 2));
         
-        // 如果读取的字节数小于512，说明这是最后一个包
-        if (bytes_read < DATA_SIZE) {
-            log_message("INFO", "File transfer complete: %s", filename);
+        if (ack_opcode == TFTP_ACK) {
+            // 将16位块号还原为序号：有效ACK只可能落在[base-1, next-1]区间内
+            unsigned long ack_seq = (base - 1) + (unsigned short)(ack_block - (unsigned short)(base - 1));
+            
+            if (ack_seq >= base && ack_seq < next) {
+                log_message("DEBUG", "Received ACK, block number: %d", ack_block);
+                
+                // 以被确认的块测量ACK延迟
+                ULONGLONG sent_at = send_ns[(ack_seq - 1) % window_size];
+                if (sent_at != 0) {
+                    histogram_record(&stats.ack_latency, timing_now_ns() - sent_at);
+                }
+                
+                // 累计确认：ack_seq及之前的块全部完成
+                while (base <= ack_seq) {
+                    stats.bytes_transferred += window_lens[(base - 1) % window_size];
+                    base++;
+                }
+                retries = 0;
+                
+                // 确认未覆盖整个窗口说明后续块丢失，从确认点之后重新发送（RFC 7440）
+                next = base;
+                
+                if (last_block != 0 && base > last_block) {
+                    transfer_complete = 1;
+                    log_message("INFO", "File transfer complete: %s", filename);
+                }
+            } else {
+                // 重复的旧ACK直接忽略，避免"魔法师的学徒"式的重复发送
+                log_message("DEBUG", "Ignored duplicate ACK, block number: %d", ack_block);
+            }
+        } else if (ack_opcode == TFTP_ERROR) {
+            log_message("ERROR", "Client send error (code:%d): %.*s", ack_block,
+                       (int)strnlen(ack_buffer + 4, (size_t)(recv_result - 4)), ack_buffer + 4);
             break;
+        } else {
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING",
+                                "Received invalid packet while waiting for ACK, opcode: %d", ack_opcode);
         }
     }
     
-    time(&stats.end_time);
+    stats.end_ns = timing_now_ns();
     print_throughput(&stats);
+    log_limits_report(log_limits, client_addr);
     
+    free(window_buffer);
+    free(window_lens);
+    free(send_ns);
     fclose(file);
     closesocket(data_sock);
 }
@@ -170,18 +340,10 @@ void handle_rrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
 /**
  * 处理写请求（WRQ）- 客户端要上传文件
  */
-void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_addr) {
-    char* ptr = (char*)packet + 2; // 跳过操作码
-    char filename[MAX_FILENAME_LEN];
-    char mode[MAX_MODE_LEN];
+void handle_wrq(SOCKET sock, tftp_packet_view_t* packet, struct sockaddr_in* client_addr) {
+    const char* filename = packet->filename;             // 文件名（指向接收缓冲区）
+    const char* mode = packet->mode;                     // 传输模式
     char filepath[512];
-    
-    // 解析文件名
-    strcpy(filename, ptr);
-    ptr += strlen(filename) + 1;
-    
-    // 解析传输模式
-    strcpy(mode, ptr);
 
     log_message("INFO", "Client %s:%d requests to upload file: %s, mode: %s",
                inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
@@ -199,14 +361,31 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
         return;
     }
     
-    // 尝试创建文件
-    FILE* file = fopen(filepath, (parse_mode(mode) == MODE_NETASCII) ? "w" : "wb");
+    // 客户端通过tsize声明了文件大小时，剩余空间不足则在创建文件之前拒绝
+    if (packet->options.tsize && !upload_space_available(packet->options.tsize_value)) {
+        log_message("ERROR", "Upload of %llu bytes exceeds free disk space: %s",
+                   packet->options.tsize_value, filepath);
+        send_error_packet(sock, client_addr, TFTP_ERROR_DISK_FULL, "File too large for available disk space");
+        return;
+    }
+    
+    // 尝试创建文件（两种模式都以二进制方式写入，netascii模式写入前显式解码）
+    int netascii = (parse_mode(mode) == MODE_NETASCII);
+    FILE* file = fopen(filepath, "wb");
     if (file == NULL) {
         log_message("ERROR", "Failed to create file: %s", filepath);
         send_error_packet(sock, client_addr, TFTP_ERROR_ACCESS_VIOLATION, "Failed to create file");
         return;
     }
     
+    // 协商选项扩展（上传不接受windowsize）
+    tftp_options_t accepted;
+    int has_options = negotiate_options(&packet->options, 1, &accepted);
+    int block_size = (accepted.blksize > 0) ? accepted.blksize : DATA_SIZE;
+    if (accepted.tsize) {
+        reserve_file_space(file, accepted.tsize_value);
+    }
+    
     // 创建新的socket用于数据传输
     SOCKET data_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (data_sock == INVALID_SOCKET) {
@@ -232,13 +411,28 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
         return;
     }
     
-    // 设置socket超时
-    int timeout = TIMEOUT_SECONDS * 1000;
+    // 设置socket超时（协商了timeout选项时按协商值）
+    int timeout = ((accepted.timeout > 0) ? accepted.timeout : TIMEOUT_SECONDS) * 1000;
     setsockopt(data_sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
     
-    // 发送初始ACK（块号0）表示准备接收数据
-    if (send_ack_packet(data_sock, client_addr, 0) < 0) {
+    // 接收缓冲区按协商的块大小分配；netascii模式在其后附带解码缓冲区（解码输出最多比输入多一个字节）
+    int recv_buffer_size = TFTP_HEADER_SIZE + block_size;
+    char* recv_buffer = (char*)malloc((size_t)recv_buffer_size + (netascii ? (size_t)block_size + 1 : 0));
+    if (recv_buffer == NULL) {
+        log_message("ERROR", "Failed to allocate receive buffer");
+        closesocket(data_sock);
+        fclose(file);
+        remove(filepath);
+        send_error_packet(sock, client_addr, TFTP_ERROR_NOT_DEFINED, "Server internal error");
+        return;
+    }
+    
+    // 发送初始ACK（块号0）表示准备接收数据；接受了选项时以OACK代替
+    int ready_result = has_options ? send_oack_packet(data_sock, client_addr, &accepted)
+                                   : send_ack_packet(data_sock, client_addr, 0);
+    if (ready_result < 0) {
         log_message("ERROR", "Failed to send initial ACK");
+        free(recv_buffer);
         closesocket(data_sock);
         fclose(file);
         remove(filepath);
@@ -247,17 +441,23 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
     
     // 开始接收文件数据
     tftp_stats_t stats = {0};
-    time(&stats.start_time);
+    stats.start_ns = timing_now_ns();
+    ULONGLONG ack_sent_ns = stats.start_ns;              // 最近一个ACK的发送时间（0表示已重发，不测量延迟）
+    
+    // 重复数据包、未知操作码等热路径日志按类别限速
+    tftp_log_limiter_t log_limits[LOG_EVENT_COUNT];
+    memset(log_limits, 0, sizeof(log_limits));
     
     unsigned short expected_block = 1;
-    char recv_buffer[BUFFER_SIZE];
     int transfer_complete = 0;
+    tftp_netascii_t netascii_state;
+    netascii_init(&netascii_state, NULL);
     
     while (!transfer_complete) {
         struct sockaddr_in recv_addr;
         int recv_addr_len = sizeof(recv_addr);
         
-        int recv_result = recvfrom(data_sock, recv_buffer, sizeof(recv_buffer), 0,
+        int recv_result = recvfrom(data_sock, recv_buffer, recv_buffer_size, 0,
                                  (struct sockaddr*)&recv_addr, &recv_addr_len);
         
         if (recv_result == SOCKET_ERROR) {
@@ -271,7 +471,13 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
                 break;
             }
         }
-        
+
+        if (recv_result < 4) {
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING",
+                                "Received truncated packet, size: %d bytes", recv_result);
+            continue;
+        }
+
         // 解析数据包
         unsigned short opcode = ntohs(*(unsigned short*)recv_buffer);
         
@@ -281,8 +487,20 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
             int data_len = recv_result - 4;
             
             if (block_num == expected_block) {
+                // netascii模式先解码，最后一块再补出末尾的裸CR
+                const char* write_data = data;
+                size_t write_len = (size_t)data_len;
+                if (netascii) {
+                    char* decoded = recv_buffer + recv_buffer_size;
+                    write_len = netascii_decode(&netascii_state, data, (size_t)data_len, decoded);
+                    if (data_len < block_size) {
+                        write_len += netascii_decode_end(&netascii_state, decoded + write_len);
+                    }
+                    write_data = decoded;
+                }
+                
                 // 写入数据到文件
-                if (fwrite(data, 1, (size_t)data_len, file) != (size_t)data_len) {
+                if (fwrite(write_data, 1, write_len, file) != write_len) {
                     log_message("ERROR", "Failed to write to file");
                     send_error_packet(data_sock, client_addr, TFTP_ERROR_DISK_FULL, "磁盘已满");
                     break;
@@ -290,40 +508,51 @@ void handle_wrq(SOCKET sock, tftp_packet_t* packet, struct sockaddr_in* client_a
                 
                 stats.bytes_transferred += data_len;
                 
+                // ACK延迟：从发出上一个ACK到收到下一个数据块
+                if (ack_sent_ns != 0) {
+                    histogram_record(&stats.ack_latency, timing_now_ns() - ack_sent_ns);
+                }
+                
                 // 发送ACK
                 send_ack_packet(data_sock, client_addr, block_num);
+                ack_sent_ns = timing_now_ns();
 
                 log_message("DEBUG", "Received data packet, block number: %d, size: %d bytes", block_num, data_len);
 
                 expected_block++;
                 
-                // 如果数据长度小于512字节，说明传输完成
-                if (data_len < DATA_SIZE) {
+                // 如果数据长度小于块大小，说明传输完成
+                if (data_len < block_size) {
                     transfer_complete = 1;
                     log_message("INFO", "File upload complete: %s", filename);
                 }
             } else {
-                log_message("WARNING", "Received duplicate or out-of-order packet, block number: %d, expected: %d",
-                           block_num, expected_block);
+                log_message_limited(log_limits, LOG_EVENT_DUPLICATE, "WARNING",
+                                    "Received duplicate or out-of-order packet, block number: %d, expected: %d",
+                                    block_num, expected_block);
                 // 重新发送上一个ACK
                 if (block_num == expected_block - 1) {
                     send_ack_packet(data_sock, client_addr, block_num);
                     stats.retransmissions++;
+                    ack_sent_ns = 0;
                 }
             }
         } else if (opcode == TFTP_ERROR) {
             unsigned short error_code = ntohs(*(unsigned short*)(recv_buffer + 2));
             char* error_msg = recv_buffer + 4;
-            log_message("ERROR", "Client send error (code:%d): %s", error_code, error_msg);
+            int error_len = (recv_result > 4) ? (int)strnlen(error_msg, (size_t)(recv_result - 4)) : 0;
+            log_message("ERROR", "Client send error (code:%d): %.*s", error_code, error_len, error_msg);
             break;
         } else {
-            log_message("WARNING", "Received unknown opcode: %d", opcode);
+            log_message_limited(log_limits, LOG_EVENT_INVALID, "WARNING", "Received unknown opcode: %d", opcode);
         }
     }
     
-    time(&stats.end_time);
+    stats.end_ns = timing_now_ns();
     print_throughput(&stats);
+    log_limits_report(log_limits, client_addr);
     
+    free(recv_buffer);
     fclose(file);
     closesocket(data_sock);
     
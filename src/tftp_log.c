@@ -0,0 +1,668 @@
+#include "../include/tftp.h"
+#include <process.h>
+#include <ctype.h>
+
+/*
+ * 异步日志（多线程版本服务器使用）
+ *
+ * 设计思路：
+ * - 每个线程第一次写日志时分配自己的日志环（单生产者单消费者），
+ *   写日志只把格式化字符串指针和参数的二进制副本（字符串按内容复制）存入本线程的环并推进尾指针，
+ *   不格式化、不加锁、不做系统调用；vsnprintf由后台线程在写出时完成
+ * - 格式化字符串必须在进程生命周期内有效（字符串字面量）；含有不支持的转换说明时
+ *   （或参数区放不下）退回在调用线程中格式化
+ * - 后台日志线程每LOG_FLUSH_INTERVAL_MS（或某个环超过一半时被唤醒）取出所有环中的记录，
+ *   拼成大块一次写入始终打开的日志文件和控制台，每批只刷新一次
+ * - 低于最低级别的日志在格式化之前就返回（-log debug|info|warning|error）
+ * - 环满时新日志直接丢弃并计数，后台线程写出"N messages dropped"提示，
+ *   磁盘或控制台变慢时不会拖慢事件循环
+ * - 同一线程的日志保持先后顺序，不同线程之间按批交错
+ * - 后台线程启动前（或启动失败时）以及开始退出后退回同步写入：加锁后直接写控制台和文件
+ * - tftp_utils.c中共用函数的log_message（如发送ACK时的DEBUG日志）也转入异步日志
+ */
+
+// 一条日志记录：时间、级别和参数按二进制保存，由后台线程格式化为文本行
+typedef struct {
+    time_t time;                        // 记录时间
+    tftp_log_level_t level;             // 日志级别
+    const char* format;                 // 格式化字符串（NULL表示args中已是格式化好的消息）
+    int length;                         // args中的有效字节数
+    char args[LOG_RECORD_TEXT];         // 参数的二进制副本，或格式化好的消息（超长截断）
+} tftp_log_record_t;
+
+// 转换说明对应的参数类型（决定从va_list中取参数和回放时的类型）
+typedef enum {
+    LOG_ARG_NONE,                       // %%，不消耗参数
+    LOG_ARG_INT,                        // int（含char、short的默认提升）
+    LOG_ARG_LONG,                       // long
+    LOG_ARG_LLONG,                      // long long（ll、I64）
+    LOG_ARG_SIZE,                       // size_t（z）
+    LOG_ARG_DOUBLE,                     // double
+    LOG_ARG_STRING,                     // 字符串，按内容复制（以null结尾）
+    LOG_ARG_POINTER,                    // 指针（%p）
+    LOG_ARG_UNSUPPORTED                 // 其他转换说明，退回在调用线程中格式化
+} tftp_log_arg_t;
+
+// 每个线程的日志环：所属线程只修改tail，后台线程只修改head
+typedef struct tftp_log_ring {
+    struct tftp_log_ring* next;         // 所有日志环组成的链表（只在头部插入）
+    DWORD thread_id;                    // 所属线程
+    volatile ULONG head;                // 下一条待写出的记录序号
+    volatile ULONG tail;                // 下一条待写入的记录序号
+    volatile LONG dropped;              // 环满时丢弃的记录数（后台线程写出提示后清零）
+    tftp_log_record_t records[LOG_RING_RECORDS];
+} tftp_log_ring_t;
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护日志环注册、后台线程的等待和同步写入
+    CONDITION_VARIABLE wake;            // 唤醒后台线程（某个环超过一半或需要退出）
+    tftp_log_ring_t* volatile rings;    // 所有线程的日志环
+    DWORD tls_index;                    // 线程局部存储：本线程的日志环
+    FILE* file;                         // 始终打开的日志文件
+    HANDLE thread;                      // 后台日志线程
+    tftp_log_level_t min_level;         // 最低输出级别
+    volatile LONG dropped_total;        // 累计丢弃的日志数
+    volatile int running;               // 后台线程是否在运行（否则同步写入）
+    volatile int stopping;              // 通知后台线程退出；之后的日志同步写入
+    int initialized;                    // 锁是否已初始化
+} tftp_logger_t;
+
+static tftp_logger_t logger;
+
+static const char* const log_level_names[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+/**
+ * 初始化锁（第一次写日志或log_init时调用，此时只有主线程）
+ */
+static void log_init_lock(void) {
+    if (!logger.initialized) {
+        InitializeCriticalSection(&logger.lock);
+        InitializeConditionVariable(&logger.wake);
+        logger.min_level = LOG_LEVEL_INFO;
+        logger.initialized = 1;
+    }
+}
+
+/**
+ * 把级别名称转换为日志级别（按首字母，不区分大小写；无法识别时为INFO）
+ */
+tftp_log_level_t log_parse_level(const char* level) {
+    switch (level[0]) {
+        case 'D': case 'd': return LOG_LEVEL_DEBUG;
+        case 'W': case 'w': return LOG_LEVEL_WARNING;
+        case 'E': case 'e': return LOG_LEVEL_ERROR;
+        default: return LOG_LEVEL_INFO;
+    }
+}
+
+/**
+ * 格式化日志行前缀"[YYYY-MM-DD HH:MM:SS] [LEVEL] "
+ *
+ * 返回值：
+ * - 前缀长度
+ */
+static int log_format_prefix(char* buffer, size_t size, time_t time, tftp_log_level_t level) {
+    struct tm* local_time = localtime(&time);
+    return snprintf(buffer, size, "[%04d-%02d-%02d %02d:%02d:%02d] [%s] ",
+                    local_time->tm_year + 1900, local_time->tm_mon + 1, local_time->tm_mday,
+                    local_time->tm_hour, local_time->tm_min, local_time->tm_sec, log_level_names[level]);
+}
+
+/**
+ * 同步写入一条日志（后台线程未运行时使用）
+ */
+static void log_write_sync(tftp_log_level_t level, const char* message, va_list args) {
+    char line[64 + LOG_RECORD_TEXT];
+
+    // 只格式化一次，控制台和文件写同一行
+    int length = log_format_prefix(line, sizeof(line), time(NULL), level);
+    int text_length = vsnprintf(line + length, sizeof(line) - (size_t)length - 1, message, args);
+    if (text_length < 0) {
+        text_length = 0;
+    }
+    length += (text_length < (int)(sizeof(line) - (size_t)length - 1)) ? text_length
+                                                                       : (int)(sizeof(line) - (size_t)length - 2);
+    line[length++] = '\n';
+
+    EnterCriticalSection(&logger.lock);
+    fwrite(line, 1, (size_t)length, stdout);
+    if (logger.file != NULL) {
+        fwrite(line, 1, (size_t)length, logger.file);
+        fflush(logger.file);
+    } else {
+        FILE* log_file = fopen(LOG_FILE_MT, "a");
+        if (log_file != NULL) {
+            fwrite(line, 1, (size_t)length, log_file);
+            fclose(log_file);
+        }
+    }
+    LeaveCriticalSection(&logger.lock);
+}
+
+/**
+ * 解析一个转换说明
+ *
+ * 参数：
+ * - spec: '%'之后的字符
+ * - end: 输出转换说明之后的位置
+ * - stars: 输出宽度和精度中'*'的个数（各消耗一个int参数，位于转换参数之前）
+ * - precision: 输出固定精度（没有时为-1，为'*'时为-2）
+ *
+ * 返回值：
+ * - 参数类型
+ */
+static tftp_log_arg_t log_parse_spec(const char* spec, const char** end, int* stars, int* precision) {
+    const char* p = spec;
+    int length = 0;                                      // 0：无，1：h/hh，2：l，3：ll/I64，4：z
+
+    *stars = 0;
+    *precision = -1;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        p++;
+    }
+    for (; isdigit((unsigned char)*p) || *p == '*'; p++) {
+        *stars += (*p == '*');
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            *precision = -2;
+            p++;
+        } else {
+            *precision = 0;
+            for (; isdigit((unsigned char)*p); p++) {
+                *precision = *precision * 10 + (*p - '0');
+            }
+        }
+    }
+    if (p[0] == 'h') {
+        length = 1;
+        p += (p[1] == 'h') ? 2 : 1;
+    } else if (p[0] == 'l') {
+        length = (p[1] == 'l') ? 3 : 2;
+        p += (p[1] == 'l') ? 2 : 1;
+    } else if (p[0] == 'I' && p[1] == '6' && p[2] == '4') {
+        length = 3;
+        p += 3;
+    } else if (p[0] == 'z') {
+        length = 4;
+        p++;
+    }
+
+    *end = (*p != '\0') ? p + 1 : p;
+    switch (*p) {
+        case '%':
+            return LOG_ARG_NONE;
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            switch (length) {
+                case 0: case 1: return LOG_ARG_INT;
+                case 2: return (*p == 'c') ? LOG_ARG_UNSUPPORTED : LOG_ARG_LONG;
+                case 3: return LOG_ARG_LLONG;
+                default: return LOG_ARG_SIZE;
+            }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            return (length == 0) ? LOG_ARG_DOUBLE : LOG_ARG_UNSUPPORTED;
+        case 's':
+            return (length == 0) ? LOG_ARG_STRING : LOG_ARG_UNSUPPORTED;
+        case 'p':
+            return LOG_ARG_POINTER;
+        default:
+            return LOG_ARG_UNSUPPORTED;
+    }
+}
+
+/**
+ * 按格式化字符串从va_list取出参数，以二进制形式复制到记录的参数区
+ *
+ * 返回值：
+ * - 成功：参数区使用的字节数
+ * - 失败：-1（不支持的转换说明或参数区放不下，调用者改为直接格式化）
+ */
+static int log_capture_args(char* buffer, const char* format, va_list args) {
+    size_t used = 0;
+
+    for (const char* p = strchr(format, '%'); p != NULL; p = strchr(p, '%')) {
+        int stars;
+        int precision;
+        tftp_log_arg_t kind = log_parse_spec(p + 1, &p, &stars, &precision);
+        if (kind == LOG_ARG_UNSUPPORTED) {
+            return -1;
+        }
+
+        for (int i = 0; i < stars; i++) {
+            int value = va_arg(args, int);
+            if (used + sizeof(value) > LOG_RECORD_TEXT) {
+                return -1;
+            }
+            memcpy(buffer + used, &value, sizeof(value));
+            used += sizeof(value);
+            if (i == stars - 1 && precision == -2) {
+                precision = value;                       // 精度为'*'时是最后一个'*'（%.*s）
+            }
+        }
+
+        union {
+            int i;
+            long l;
+            long long ll;
+            size_t z;
+            double d;
+            const void* ptr;
+        } value;
+        size_t size = 0;
+        switch (kind) {
+            case LOG_ARG_INT: value.i = va_arg(args, int); size = sizeof(value.i); break;
+            case LOG_ARG_LONG: value.l = va_arg(args, long); size = sizeof(value.l); break;
+            case LOG_ARG_LLONG: value.ll = va_arg(args, long long); size = sizeof(value.ll); break;
+            case LOG_ARG_SIZE: value.z = va_arg(args, size_t); size = sizeof(value.z); break;
+            case LOG_ARG_DOUBLE: value.d = va_arg(args, double); size = sizeof(value.d); break;
+            case LOG_ARG_POINTER: value.ptr = va_arg(args, const void*); size = sizeof(value.ptr); break;
+            case LOG_ARG_STRING: {
+                // 字符串在调用返回后可能失效，复制内容；带精度时不一定以null结尾
+                const char* text = va_arg(args, const char*);
+                if (text == NULL) {
+                    text = "(null)";
+                }
+                size_t length = 0;
+                while ((precision < 0 || length < (size_t)precision) && text[length] != '\0') {
+                    length++;
+                }
+                if (used + length + 1 > LOG_RECORD_TEXT) {
+                    return -1;
+                }
+                memcpy(buffer + used, text, length);
+                used += length;
+                buffer[used++] = '\0';
+                break;
+            }
+            default:
+                break;
+        }
+        if (size > 0) {
+            if (used + size > LOG_RECORD_TEXT) {
+                return -1;
+            }
+            memcpy(buffer + used, &value, size);
+            used += size;
+        }
+    }
+    return (int)used;
+}
+
+/**
+ * 回放记录：按格式化字符串和参数区的二进制参数生成消息文本（后台线程中调用）
+ *
+ * 功能说明：
+ * - 转换说明之间的文本原样复制，每个转换说明单独调用snprintf，
+ *   宽度和精度中的'*'替换为记录中保存的数值
+ *
+ * 返回值：
+ * - 消息长度（不超过size - 1，超长截断）
+ */
+static int log_format_record(const tftp_log_record_t* record, char* out, size_t size) {
+    if (record->format == NULL) {
+        memcpy(out, record->args, (size_t)record->length);
+        return record->length;
+    }
+
+    const char* args = record->args;
+    const char* p = record->format;
+    size_t n = 0;
+
+    while (*p != '\0' && n < size - 1) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+
+        const char* end;
+        int stars;
+        int precision;
+        tftp_log_arg_t kind = log_parse_spec(p + 1, &end, &stars, &precision);
+        char spec[64];
+        size_t spec_length = 0;
+        for (const char* s = p; s < end && spec_length < sizeof(spec) - 16; s++) {
+            if (*s == '*') {
+                int value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                spec_length += (size_t)snprintf(spec + spec_length, sizeof(spec) - spec_length, "%d", value);
+            } else {
+                spec[spec_length++] = *s;
+            }
+        }
+        spec[spec_length] = '\0';
+        p = end;
+
+        int written = 0;
+        switch (kind) {
+            case LOG_ARG_NONE: written = snprintf(out + n, size - n, "%%"); break;
+            case LOG_ARG_INT: {
+                int value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_LONG: {
+                long value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_LLONG: {
+                long long value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_SIZE: {
+                size_t value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                const void* value;
+                memcpy(&value, args, sizeof(value));
+                args += sizeof(value);
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case LOG_ARG_STRING:
+                written = snprintf(out + n, size - n, spec, args);
+                args += strlen(args) + 1;
+                break;
+            default:
+                break;
+        }
+        if (written > 0) {
+            n += (size_t)written;
+        }
+    }
+
+    if (n > size - 1) {
+        n = size - 1;
+    }
+    return (int)n;
+}
+
+/**
+ * 为当前线程分配并登记日志环
+ *
+ * 返回值：
+ * - 成功：日志环
+ * - 失败：NULL（内存不足，调用者改为同步写入）
+ */
+static tftp_log_ring_t* log_ring_register(void) {
+    tftp_log_ring_t* ring = (tftp_log_ring_t*)calloc(1, sizeof(tftp_log_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->thread_id = GetCurrentThreadId();
+    TlsSetValue(logger.tls_index, ring);
+
+    EnterCriticalSection(&logger.lock);
+    ring->next = logger.rings;
+    MemoryBarrier();                                     // 后台线程不加锁遍历链表，先初始化再发布
+    logger.rings = ring;
+    LeaveCriticalSection(&logger.lock);
+    return ring;
+}
+
+/**
+ * 写入一条日志（va_list版本，也作为tftp_utils.c中log_message的转发目标）
+ *
+ * 说明：
+ * - message必须在进程生命周期内有效（字符串字面量），后台线程写出时才按它格式化
+ */
+void thread_safe_vlog(const char* level, const char* message, va_list args) {
+    tftp_log_level_t log_level = log_parse_level(level);
+
+    if (!logger.initialized) {
+        log_init_lock();
+    }
+    if (log_level < logger.min_level) {
+        return;
+    }
+
+    // 开始退出后同步写入，不再推入后台线程可能已经取完的日志环
+    int use_ring = logger.running && !logger.stopping;
+    tftp_log_ring_t* ring = use_ring ? (tftp_log_ring_t*)TlsGetValue(logger.tls_index) : NULL;
+    if (use_ring && ring == NULL) {
+        ring = log_ring_register();
+    }
+    if (ring == NULL) {
+        log_write_sync(log_level, message, args);
+        return;
+    }
+
+    ULONG tail = ring->tail;
+    if (tail - ring->head >= LOG_RING_RECORDS) {
+        InterlockedIncrement(&ring->dropped);
+        return;
+    }
+
+    tftp_log_record_t* record = &ring->records[tail & (LOG_RING_RECORDS - 1)];
+    record->time = time(NULL);
+    record->level = log_level;
+    va_list capture;
+    va_copy(capture, args);
+    int length = log_capture_args(record->args, message, capture);
+    va_end(capture);
+    if (length >= 0) {
+        record->format = message;
+    } else {
+        // 不支持的转换说明或参数太长：在本线程中格式化
+        record->format = NULL;
+        length = vsnprintf(record->args, sizeof(record->args), message, args);
+        if (length < 0) {
+            length = 0;
+        }
+        if (length >= (int)sizeof(record->args)) {
+            length = (int)sizeof(record->args) - 1;
+        }
+    }
+    record->length = length;
+
+    MemoryBarrier();                                     // 记录内容先于尾指针对后台线程可见
+    ring->tail = tail + 1;
+
+    if (tail + 1 - ring->head > LOG_RING_RECORDS / 2) {
+        WakeConditionVariable(&logger.wake);
+    }
+}
+
+/**
+ * 线程安全的日志记录函数：写入本线程的日志环，由后台线程写出
+ *
+ * 参数：
+ * - level: 日志级别（"DEBUG"、"INFO"、"WARNING"、"ERROR"）
+ * - message: 格式化字符串
+ * - ...: 可变参数列表
+ */
+void thread_safe_log(const char* level, const char* message, ...) {
+    va_list args;
+    va_start(args, message);
+    thread_safe_vlog(level, message, args);
+    va_end(args);
+}
+
+/**
+ * 把批缓冲区写入日志文件和控制台
+ */
+static void log_flush_batch(const char* batch, size_t length) {
+    if (length > 0) {
+        fwrite(batch, 1, length, logger.file);
+        fwrite(batch, 1, length, stdout);
+    }
+}
+
+/**
+ * 取出所有日志环中的记录并写出（只在后台线程或退出时调用）
+ *
+ * 返回值：
+ * - 写出的记录数
+ */
+static int log_drain(void) {
+    static char batch[LOG_BATCH_BYTES];
+    size_t used = 0;
+    int written = 0;
+    time_t prefix_time = 0;
+    tftp_log_level_t prefix_level = LOG_LEVEL_INFO;
+    char prefix[64];
+    int prefix_length = 0;
+    char text[LOG_RECORD_TEXT];
+
+    for (tftp_log_ring_t* ring = logger.rings; ring != NULL; ring = ring->next) {
+        ULONG tail = ring->tail;
+        MemoryBarrier();                                 // 先读尾指针，再读记录内容
+
+        for (ULONG head = ring->head; head != tail; head++) {
+            tftp_log_record_t* record = &ring->records[head & (LOG_RING_RECORDS - 1)];
+
+            // 同一秒、同一级别的连续记录复用已格式化的前缀
+            if (prefix_length == 0 || record->time != prefix_time || record->level != prefix_level) {
+                prefix_time = record->time;
+                prefix_level = record->level;
+                prefix_length = log_format_prefix(prefix, sizeof(prefix), prefix_time, prefix_level);
+            }
+            int text_length = log_format_record(record, text, sizeof(text));
+            if (used + (size_t)prefix_length + (size_t)text_length + 1 > sizeof(batch)) {
+                log_flush_batch(batch, used);
+                used = 0;
+            }
+            memcpy(batch + used, prefix, (size_t)prefix_length);
+            used += (size_t)prefix_length;
+            memcpy(batch + used, text, (size_t)text_length);
+            used += (size_t)text_length;
+            batch[used++] = '\n';
+            written++;
+        }
+        MemoryBarrier();                                 // 记录读完后才把槽位还给所属线程
+        ring->head = tail;
+
+        LONG dropped = InterlockedExchange(&ring->dropped, 0);
+        if (dropped > 0) {
+            InterlockedExchangeAdd(&logger.dropped_total, dropped);
+            if (used + 256 > sizeof(batch)) {
+                log_flush_batch(batch, used);
+                used = 0;
+            }
+            int length = log_format_prefix(batch + used, sizeof(batch) - used, time(NULL), LOG_LEVEL_WARNING);
+            length += snprintf(batch + used + length, sizeof(batch) - used - (size_t)length,
+                               "Log ring of thread %lu full, %ld messages dropped\n",
+                               (unsigned long)ring->thread_id, (long)dropped);
+            used += (size_t)length;
+            written++;
+        }
+    }
+
+    log_flush_batch(batch, used);
+    if (written > 0) {
+        fflush(logger.file);
+        fflush(stdout);
+    }
+    return written;
+}
+
+/**
+ * 后台日志线程：定期或被唤醒时写出所有日志环中的记录
+ */
+static unsigned __stdcall log_writer_thread(void* param) {
+    (void)param;
+
+    EnterCriticalSection(&logger.lock);
+    while (!logger.stopping) {
+        SleepConditionVariableCS(&logger.wake, &logger.lock, LOG_FLUSH_INTERVAL_MS);
+        LeaveCriticalSection(&logger.lock);
+        log_drain();
+        EnterCriticalSection(&logger.lock);
+    }
+    LeaveCriticalSection(&logger.lock);
+
+    log_drain();
+    return 0;
+}
+
+/**
+ * 打开日志文件并启动后台日志线程
+ *
+ * 参数：
+ * - path: 日志文件路径（追加写入，运行期间保持打开）
+ * - min_level: 最低输出级别
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（之后的日志同步写入）
+ */
+int log_init(const char* path, tftp_log_level_t min_level) {
+    log_init_lock();
+    logger.min_level = min_level;
+
+    logger.file = fopen(path, "a");
+    if (logger.file == NULL) {
+        return -1;
+    }
+    setvbuf(logger.file, NULL, _IOFBF, LOG_BATCH_BYTES);
+
+    logger.tls_index = TlsAlloc();
+    if (logger.tls_index == TLS_OUT_OF_INDEXES) {
+        return -1;
+    }
+
+    logger.running = 1;
+    logger.thread = (HANDLE)_beginthreadex(NULL, 0, log_writer_thread, NULL, 0, NULL);
+    if (logger.thread == 0) {
+        logger.running = 0;
+        TlsFree(logger.tls_index);
+        return -1;
+    }
+
+    // 共用函数中的log_message也写入本线程的日志环
+    log_set_redirect(thread_safe_vlog);
+    return 0;
+}
+
+/**
+ * 停止后台日志线程并写出剩余的记录（退出前调用）
+ *
+ * 说明：
+ * - 设置stopping后的日志改为同步写入；已判断过stopping、正在推入日志环的记录
+ *   由后台线程退出后的最后一次取出写出
+ * - 日志环不释放，其他线程此时可能仍在写入，内存在进程退出时回收
+ */
+void log_cleanup(void) {
+    if (!logger.initialized || !logger.running) {
+        return;
+    }
+
+    EnterCriticalSection(&logger.lock);
+    logger.stopping = 1;
+    WakeConditionVariable(&logger.wake);
+    LeaveCriticalSection(&logger.lock);
+
+    WaitForSingleObject(logger.thread, INFINITE);
+    CloseHandle(logger.thread);
+    logger.running = 0;
+    log_set_redirect(NULL);
+    log_drain();
+}
+
+/**
+ * 累计因日志环满而丢弃的日志数
+ */
+unsigned long log_dropped_count(void) {
+    return (unsigned long)logger.dropped_total;
+}
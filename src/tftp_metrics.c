@@ -0,0 +1,470 @@
+#include "../include/tftp.h"
+#include <process.h>
+
+/*
+ * 指标端点：以Prometheus文本格式输出传输指标（多线程版本服务器使用）
+ *
+ * 设计思路：
+ * - 每个引擎有自己的计数器（tftp_metrics_t），只由所属工作线程更新，
+ *   热路径上只是普通的自增，没有锁和原子操作
+ * - 端点线程只在收到抓取请求时汇总所有已登记引擎的计数器，
+ *   再通过session_table_foreach输出各活动传输的进度和队列深度；
+ *   持有会话表锁时只复制每个会话的几个字段，释放锁后再格式化输出
+ * - 只监听127.0.0.1，每个连接读取一个请求后返回完整的指标文本并关闭（HTTP/1.0），
+ *   监控不再需要反复读取不断增长的日志文件
+ * - 计数器读取时不加锁，32位系统上可能读到撕裂的64位值，只影响单次抓取
+ */
+
+// ACK延迟摘要输出的分位点
+static const double metrics_quantiles[3] = { 0.5, 0.99, 0.999 };
+
+static const char* const metrics_directions[2] = { "download", "upload" };
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护引擎登记表
+    tftp_metrics_t* engines[METRICS_MAX_ENGINES]; // 已登记引擎的计数器
+    int engine_count;                   // 已登记的引擎数
+    SOCKET listen_sock;                 // HTTP监听套接字
+    HANDLE thread;                      // 端点线程
+    volatile int stopping;              // 通知端点线程退出
+    int initialized;                    // 是否已初始化
+} tftp_metrics_endpoint_t;
+
+static tftp_metrics_endpoint_t metrics_endpoint;
+
+// 输出缓冲区：按需扩容
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int failed;                         // 扩容失败，放弃本次输出
+} tftp_metrics_text_t;
+
+// 一个活动传输的指标快照
+typedef struct {
+    struct sockaddr_in client_addr;     // 客户端地址
+    int is_upload;                      // 传输方向
+    char filename[MAX_FILENAME_LEN];    // 文件名
+    double values[4];                   // 已传输字节数、重传次数、平滑RTT、ACK延迟p99（秒）
+} tftp_metrics_session_t;
+
+// 枚举活动会话时的汇总结果
+typedef struct {
+    tftp_metrics_session_t* sessions;   // 会话快照（枚举前按会话数分配）
+    int capacity;                       // 快照数组容量
+    int count;                          // 枚举到的会话数（可能超过容量）
+    long reads_in_flight;               // 下载：已提交尚未完成的文件读请求数
+    long write_queue_blocks;            // 上传：写缓冲环中等待写入磁盘的块数
+} tftp_metrics_scan_t;
+
+/**
+ * 向输出缓冲区追加格式化文本
+ */
+static void metrics_printf(tftp_metrics_text_t* text, const char* format, ...) {
+    if (text->failed) {
+        return;
+    }
+
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+        va_end(args);
+
+        if (length < 0) {
+            text->failed = 1;
+            return;
+        }
+        if ((size_t)length < text->capacity - text->length) {
+            text->length += (size_t)length;
+            return;
+        }
+
+        size_t capacity = text->capacity * 2 + (size_t)length;
+        char* data = (char*)realloc(text->data, capacity);
+        if (data == NULL) {
+            text->failed = 1;
+            return;
+        }
+        text->data = data;
+        text->capacity = capacity;
+    }
+}
+
+/**
+ * 输出标签值：按Prometheus文本格式转义反斜杠、双引号和换行
+ */
+static void metrics_print_label(tftp_metrics_text_t* text, const char* value) {
+    char escaped[2 * MAX_FILENAME_LEN + 1];
+    size_t length = 0;
+
+    for (const char* p = value; *p != '\0' && length + 2 < sizeof(escaped); p++) {
+        if (*p == '\\' || *p == '"') {
+            escaped[length++] = '\\';
+            escaped[length++] = *p;
+        } else if (*p == '\n') {
+            escaped[length++] = '\\';
+            escaped[length++] = 'n';
+        } else {
+            escaped[length++] = *p;
+        }
+    }
+    escaped[length] = '\0';
+    metrics_printf(text, "%s", escaped);
+}
+
+/**
+ * 输出一个指标的HELP和TYPE行
+ */
+static void metrics_header(tftp_metrics_text_t* text, const char* name, const char* type, const char* help) {
+    metrics_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * 复制一个活动传输的指标快照，并累计队列深度（在持有会话表锁时调用，不分配内存、不格式化）
+ */
+static void metrics_visit_session(const tftp_session_t* session, void* context) {
+    tftp_metrics_scan_t* scan = (tftp_metrics_scan_t*)context;
+
+    if (scan->count < scan->capacity) {
+        tftp_metrics_session_t* snapshot = &scan->sessions[scan->count];
+        snapshot->client_addr = session->client_addr;
+        snapshot->is_upload = session->is_upload;
+        memcpy(snapshot->filename, session->filename, sizeof(snapshot->filename));
+        snapshot->filename[sizeof(snapshot->filename) - 1] = '\0';
+        snapshot->values[0] = (double)session->stats.bytes_transferred;
+        snapshot->values[1] = (double)session->stats.retransmissions;
+        snapshot->values[2] = (double)session->stats.srtt_ms;
+        snapshot->values[3] = (double)histogram_percentile(&session->stats.ack_latency, 0.99) / 1e9;
+    }
+    scan->count++;
+
+    scan->reads_in_flight += session->reads_in_flight;
+    if (session->write_ring != NULL) {
+        scan->write_queue_blocks += (long)(session->write_ring->tail - session->write_ring->head);
+    }
+}
+
+/**
+ * 枚举活动会话，得到快照和队列深度
+ *
+ * 功能说明：
+ * - 快照数组在持锁之前按当前会话数（留一些余量）分配；枚举期间新增的会话超过容量时
+ *   按新的会话数重新分配并重新枚举，最多重试几次，之后只输出放得下的会话
+ *
+ * 返回值：
+ * - 成功：0（scan->sessions用完后由调用者释放）
+ * - 失败：-1（内存不足）
+ */
+static int metrics_scan_sessions(tftp_metrics_scan_t* scan) {
+    int capacity = session_table_count() + 16;
+
+    for (int attempt = 0; attempt < 3; attempt++) {
+        tftp_metrics_session_t* sessions =
+            (tftp_metrics_session_t*)realloc(scan->sessions, (size_t)capacity * sizeof(tftp_metrics_session_t));
+        if (sessions == NULL) {
+            return -1;
+        }
+        scan->sessions = sessions;
+        scan->capacity = capacity;
+        scan->count = 0;
+        scan->reads_in_flight = 0;
+        scan->write_queue_blocks = 0;
+
+        session_table_foreach(metrics_visit_session, scan);
+        if (scan->count <= scan->capacity) {
+            break;
+        }
+        capacity = scan->count + 16;
+    }
+    if (scan->count > scan->capacity) {
+        scan->count = scan->capacity;
+    }
+    return 0;
+}
+
+/**
+ * 生成完整的指标文本
+ */
+static void metrics_render(tftp_metrics_text_t* text) {
+    tftp_metrics_t total;
+    memset(&total, 0, sizeof(total));
+
+    // 汇总所有引擎的计数器
+    EnterCriticalSection(&metrics_endpoint.lock);
+    for (int i = 0; i < metrics_endpoint.engine_count; i++) {
+        const tftp_metrics_t* engine = metrics_endpoint.engines[i];
+        for (int d = 0; d < 2; d++) {
+            total.transfers_started[d] += engine->transfers_started[d];
+            total.transfers_completed[d] += engine->transfers_completed[d];
+            total.transfers_ended[d] += engine->transfers_ended[d];
+        }
+        total.bytes_sent += engine->bytes_sent;
+        total.bytes_received += engine->bytes_received;
+        total.data_packets_sent += engine->data_packets_sent;
+        total.retransmissions += engine->retransmissions;
+        total.timeouts += engine->timeouts;
+        total.invalid_packets += engine->invalid_packets;
+        histogram_merge(&total.ack_latency, &engine->ack_latency);
+    }
+    LeaveCriticalSection(&metrics_endpoint.lock);
+
+    metrics_header(text, "tftp_transfers_started_total", "counter", "Transfers accepted by the server.");
+    for (int d = 0; d < 2; d++) {
+        metrics_printf(text, "tftp_transfers_started_total{direction=\"%s\"} %llu\n",
+                       metrics_directions[d], total.transfers_started[d]);
+    }
+    metrics_header(text, "tftp_transfers_completed_total", "counter", "Transfers that completed successfully.");
+    for (int d = 0; d < 2; d++) {
+        metrics_printf(text, "tftp_transfers_completed_total{direction=\"%s\"} %llu\n",
+                       metrics_directions[d], total.transfers_completed[d]);
+    }
+    metrics_header(text, "tftp_transfers_failed_total", "counter", "Transfers that ended without completing.");
+    for (int d = 0; d < 2; d++) {
+        ULONGLONG failed = (total.transfers_ended[d] > total.transfers_completed[d])
+                         ? total.transfers_ended[d] - total.transfers_completed[d] : 0;
+        metrics_printf(text, "tftp_transfers_failed_total{direction=\"%s\"} %llu\n", metrics_directions[d], failed);
+    }
+
+    metrics_header(text, "tftp_bytes_sent_total", "counter", "Download payload bytes acknowledged by clients.");
+    metrics_printf(text, "tftp_bytes_sent_total %llu\n", total.bytes_sent);
+    metrics_header(text, "tftp_bytes_received_total", "counter", "Upload payload bytes received from clients.");
+    metrics_printf(text, "tftp_bytes_received_total %llu\n", total.bytes_received);
+    metrics_header(text, "tftp_data_packets_sent_total", "counter", "DATA packets sent, including retransmissions.");
+    metrics_printf(text, "tftp_data_packets_sent_total %llu\n", total.data_packets_sent);
+    metrics_header(text, "tftp_retransmissions_total", "counter", "DATA and ACK packets sent again.");
+    metrics_printf(text, "tftp_retransmissions_total %llu\n", total.retransmissions);
+    metrics_header(text, "tftp_timeouts_total", "counter", "Retransmission timeouts that fired.");
+    metrics_printf(text, "tftp_timeouts_total %llu\n", total.timeouts);
+    metrics_header(text, "tftp_invalid_packets_total", "counter", "Malformed or unexpected packets received.");
+    metrics_printf(text, "tftp_invalid_packets_total %llu\n", total.invalid_packets);
+
+    // 各引擎的HDR直方图相加后计算全局百分位数
+    metrics_header(text, "tftp_ack_latency_seconds", "summary", "Time from a DATA/ACK being sent to the matching reply.");
+    for (int q = 0; q < 3; q++) {
+        metrics_printf(text, "tftp_ack_latency_seconds{quantile=\"%g\"} %.9f\n", metrics_quantiles[q],
+                       (double)histogram_percentile(&total.ack_latency, metrics_quantiles[q]) / 1e9);
+    }
+    metrics_printf(text, "tftp_ack_latency_seconds_sum %.9f\ntftp_ack_latency_seconds_count %llu\n",
+                   (double)total.ack_latency.sum_ns / 1e9, total.ack_latency.count);
+
+    size_t heap_bytes;
+    unsigned long heap_allocs;
+    pool_get_stats(&heap_bytes, &heap_allocs);
+    metrics_header(text, "tftp_active_sessions", "gauge", "Transfers currently registered in the session table.");
+    metrics_printf(text, "tftp_active_sessions %d\n", session_table_count());
+    metrics_header(text, "tftp_socket_pool_idle", "gauge", "Pre-bound transfer sockets waiting in the socket pool.");
+    metrics_printf(text, "tftp_socket_pool_idle %d\n", socket_pool_idle_count());
+    metrics_header(text, "tftp_buffer_pool_heap_bytes", "gauge", "Bytes the buffer pool holds from the heap.");
+    metrics_printf(text, "tftp_buffer_pool_heap_bytes %zu\n", heap_bytes);
+    metrics_header(text, "tftp_buffer_pool_heap_allocations_total", "counter", "malloc calls made by the buffer pool.");
+    metrics_printf(text, "tftp_buffer_pool_heap_allocations_total %lu\n", heap_allocs);
+    metrics_header(text, "tftp_log_dropped_total", "counter", "Log records dropped because a log ring was full.");
+    metrics_printf(text, "tftp_log_dropped_total %lu\n", log_dropped_count());
+    metrics_header(text, "tftp_log_suppressed_total", "counter", "Hot-path log events suppressed by rate limits.");
+    metrics_printf(text, "tftp_log_suppressed_total %lu\n", log_suppressed_count());
+
+    // 按传输的指标和队列深度：持锁复制快照，释放锁后再格式化
+    tftp_metrics_scan_t scan;
+    memset(&scan, 0, sizeof(scan));
+    if (metrics_scan_sessions(&scan) < 0) {
+        text->failed = 1;
+    }
+    const char* metric_names[4] = {
+        "tftp_transfer_bytes", "tftp_transfer_retransmissions", "tftp_transfer_srtt_milliseconds",
+        "tftp_transfer_ack_latency_p99_seconds"
+    };
+    metrics_header(text, "tftp_transfer_bytes", "gauge", "Payload bytes transferred so far by an active transfer.");
+    metrics_header(text, "tftp_transfer_retransmissions", "gauge", "Retransmissions so far in an active transfer.");
+    metrics_header(text, "tftp_transfer_srtt_milliseconds", "gauge", "Smoothed round-trip time of an active transfer.");
+    metrics_header(text, "tftp_transfer_ack_latency_p99_seconds", "gauge", "99th percentile ACK latency of an active transfer.");
+    for (int s = 0; s < scan.count; s++) {
+        const tftp_metrics_session_t* session = &scan.sessions[s];
+        for (int i = 0; i < 4; i++) {
+            metrics_printf(text, "%s{client=\"%s:%d\",direction=\"%s\",file=\"", metric_names[i],
+                           inet_ntoa(session->client_addr.sin_addr), ntohs(session->client_addr.sin_port),
+                           metrics_directions[session->is_upload ? 1 : 0]);
+            metrics_print_label(text, session->filename);
+            metrics_printf(text, "\"} %.9g\n", session->values[i]);
+        }
+    }
+    free(scan.sessions);
+    metrics_header(text, "tftp_file_reads_in_flight", "gauge", "Download file reads submitted and not yet completed.");
+    metrics_printf(text, "tftp_file_reads_in_flight %ld\n", scan.reads_in_flight);
+    metrics_header(text, "tftp_write_behind_queued_blocks", "gauge", "Upload blocks waiting to be written to disk.");
+    metrics_printf(text, "tftp_write_behind_queued_blocks %ld\n", scan.write_queue_blocks);
+}
+
+/**
+ * 发送全部数据（处理部分发送）
+ */
+static int metrics_send_all(SOCKET sock, const char* data, size_t length) {
+    while (length > 0) {
+        int sent = send(sock, data, (int)length, 0);
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+/**
+ * 处理一个抓取连接：读取请求行，GET /metrics（或/）返回指标，其他路径返回404
+ */
+static void metrics_serve(SOCKET client_sock) {
+    char request[1024];
+    int received = 0;
+    int timeout = 1000;
+
+    setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+    while (received < (int)sizeof(request) - 1) {
+        int result = recv(client_sock, request + received, (int)sizeof(request) - 1 - received, 0);
+        if (result <= 0) {
+            break;
+        }
+        received += result;
+        request[received] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+    request[received] = '\0';
+
+    if (strncmp(request, "GET /metrics", 12) != 0 && strncmp(request, "GET / ", 6) != 0) {
+        static const char not_found[] =
+            "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n"
+            "Connection: close\r\n\r\nnot found\n";
+        metrics_send_all(client_sock, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    tftp_metrics_text_t text = { NULL, 0, 0, 0 };
+    text.capacity = 16 * 1024;
+    text.data = (char*)malloc(text.capacity);
+    if (text.data == NULL) {
+        return;
+    }
+    metrics_render(&text);
+
+    if (!text.failed) {
+        char header[256];
+        int header_length = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", text.length);
+        if (metrics_send_all(client_sock, header, (size_t)header_length) == 0) {
+            metrics_send_all(client_sock, text.data, text.length);
+        }
+    }
+    free(text.data);
+}
+
+/**
+ * 端点线程：等待连接（每500毫秒检查一次退出标志），逐个处理抓取请求
+ */
+static unsigned __stdcall metrics_thread(void* param) {
+    (void)param;
+
+    while (!metrics_endpoint.stopping) {
+        fd_set read_set;
+        struct timeval wait = { 0, 500 * 1000 };
+        FD_ZERO(&read_set);
+        FD_SET(metrics_endpoint.listen_sock, &read_set);
+
+        if (select((int)metrics_endpoint.listen_sock + 1, &read_set, NULL, NULL, &wait) <= 0) {
+            continue;
+        }
+        SOCKET client_sock = accept(metrics_endpoint.listen_sock, NULL, NULL);
+        if (client_sock == INVALID_SOCKET) {
+            continue;
+        }
+        metrics_serve(client_sock);
+        closesocket(client_sock);
+    }
+    return 0;
+}
+
+/**
+ * 初始化引擎登记表并启动指标端点
+ *
+ * 参数：
+ * - port: 监听端口（只监听127.0.0.1，0表示不启动端点，只登记计数器）
+ *
+ * 返回值：
+ * - 成功（或port为0）：0
+ * - 失败：-1（端口被占用等，引擎照常登记，只是无法抓取）
+ */
+int metrics_init(int port) {
+    memset(&metrics_endpoint, 0, sizeof(metrics_endpoint));
+    InitializeCriticalSection(&metrics_endpoint.lock);
+    metrics_endpoint.listen_sock = INVALID_SOCKET;
+    metrics_endpoint.initialized = 1;
+
+    if (port <= 0) {
+        return 0;
+    }
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+        closesocket(sock);
+        return -1;
+    }
+
+    metrics_endpoint.listen_sock = sock;
+    metrics_endpoint.thread = (HANDLE)_beginthreadex(NULL, 0, metrics_thread, NULL, 0, NULL);
+    if (metrics_endpoint.thread == 0) {
+        closesocket(sock);
+        metrics_endpoint.listen_sock = INVALID_SOCKET;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 登记一个引擎的计数器（计数器在metrics_cleanup之前必须保持有效）
+ */
+void metrics_register(tftp_metrics_t* metrics) {
+    if (!metrics_endpoint.initialized) {
+        return;
+    }
+
+    EnterCriticalSection(&metrics_endpoint.lock);
+    if (metrics_endpoint.engine_count < METRICS_MAX_ENGINES) {
+        metrics_endpoint.engines[metrics_endpoint.engine_count++] = metrics;
+    }
+    LeaveCriticalSection(&metrics_endpoint.lock);
+}
+
+/**
+ * 停止指标端点（在释放各引擎之前调用）
+ */
+void metrics_cleanup(void) {
+    if (!metrics_endpoint.initialized) {
+        return;
+    }
+
+    if (metrics_endpoint.thread != 0) {
+        metrics_endpoint.stopping = 1;
+        WaitForSingleObject(metrics_endpoint.thread, INFINITE);
+        CloseHandle(metrics_endpoint.thread);
+        metrics_endpoint.thread = 0;
+    }
+    if (metrics_endpoint.listen_sock != INVALID_SOCKET) {
+        closesocket(metrics_endpoint.listen_sock);
+        metrics_endpoint.listen_sock = INVALID_SOCKET;
+    }
+
+    DeleteCriticalSection(&metrics_endpoint.lock);
+    metrics_endpoint.initialized = 0;
+}
@@ -0,0 +1,375 @@
+#include "../include/tftp.h"
+
+/*
+ * 组播TFTP（RFC 2090）的进程级组注册表（多线程版本使用）
+ *
+ * 设计思路：
+ * - 请求中带multicast选项的octet下载按（文件路径，块大小）归组：第一个客户端创建组，
+ *   同一文件的后续请求加入已有的组，OACK中的multicast选项告诉客户端组地址、端口以及
+ *   它是否为主客户端（mc=1）
+ * - 组由创建它的工作线程以一个会话驱动（tftp_engine.c）：只有主客户端发送ACK，
+ *   每个ACK使下一个数据块向组播地址发送一次，组内所有客户端同时收到
+ * - 主客户端收齐文件（确认最后一块）或超时后离开，下一个客户端被提升为主客户端，
+ *   它以已连续收到的最后一块的ACK作答，服务器从它缺少的块继续发送；
+ *   中途加入的客户端就这样在成为主客户端时补齐错过的开头部分
+ * - 文件内容取自共享文件缓存，缓存不下时映射到内存，任意块都可以直接取用
+ * - 客户端加入可能发生在任何工作线程上，组成员列表和槽位由注册表锁保护；
+ *   加入的客户端的OACK也在持有锁时从组的套接字发出，组结束时在锁内关闭套接字
+ * - 组地址从-mcast指定的基地址起按槽位依次分配，槽位用完或组内客户端已满时
+ *   请求回退为单播下载
+ */
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护所有组的成员列表和槽位状态
+    tftp_multicast_group_t groups[MULTICAST_MAX_GROUPS]; // 组槽位，槽位i使用基地址 + i
+    ULONG base_addr;                    // 组播基地址（主机字节序）
+    unsigned short port;                // 组播目的端口（主机字节序）
+    int initialized;                    // 是否已初始化（未初始化时不支持组播）
+} tftp_multicast_registry_t;
+
+static tftp_multicast_registry_t multicast_registry;
+
+/**
+ * 比较两个客户端地址（IP和端口）
+ */
+static int multicast_same_client(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/**
+ * 查找客户端在组内的位置（调用时持有锁）
+ *
+ * 返回值：
+ * - 在members中的下标，不在组内时为-1
+ */
+static int multicast_find_member(const tftp_multicast_group_t* group, const struct sockaddr_in* client_addr) {
+    for (int i = 0; i < group->member_count; i++) {
+        if (multicast_same_client(&group->members[i], client_addr)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * 查找可以加入的组（调用时持有锁）
+ */
+static tftp_multicast_group_t* multicast_find_group(const char* filepath, int block_size) {
+    for (int i = 0; i < MULTICAST_MAX_GROUPS; i++) {
+        tftp_multicast_group_t* group = &multicast_registry.groups[i];
+        if (group->in_use && group->accepting && group->block_size == block_size &&
+            strcmp(group->filepath, filepath) == 0) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 把客户端加入组并从组的套接字回复OACK（调用时持有锁）
+ *
+ * 返回值：
+ * - 成功：1
+ * - 失败：-1（组内客户端已满）
+ */
+static int multicast_join_locked(tftp_multicast_group_t* group, const struct sockaddr_in* client_addr,
+                                 tftp_options_t* accepted) {
+    // 已在组内时是客户端因OACK丢失而重发的请求，按它当前的角色重发OACK
+    int index = multicast_find_member(group, client_addr);
+    if (index < 0) {
+        if (group->member_count >= MULTICAST_MAX_MEMBERS) {
+            return -1;
+        }
+        index = group->member_count++;
+        group->members[index] = *client_addr;
+    }
+
+    multicast_option_value(group, index == 0, accepted);
+    send_oack_packet(group->sock, (struct sockaddr_in*)client_addr, accepted);
+    // inet_ntoa返回共享缓冲区，同一条日志中的第二个地址先复制出来
+    char group_ip[16];
+    strcpy(group_ip, inet_ntoa(group->group_addr.sin_addr));
+    thread_safe_log("INFO", "Client %s:%d joined multicast group %s:%d for %s (%d client(s))",
+                   inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
+                   group_ip, ntohs(group->group_addr.sin_port), group->filepath, group->member_count);
+    return 1;
+}
+
+/**
+ * 释放组的文件内容
+ */
+static void multicast_release_data(tftp_cache_entry_t* cache_entry, tftp_file_map_t* map) {
+    if (cache_entry != NULL) {
+        file_cache_release(cache_entry);
+    }
+    file_map_close(map);
+}
+
+/**
+ * 创建组的传输套接字：绑定系统分配的端口（服务器端TID），非阻塞，不连接
+ */
+static SOCKET multicast_create_socket(void) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    struct sockaddr_in local_addr;
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = INADDR_ANY;
+    local_addr.sin_port = 0;
+
+    unsigned long non_blocking = 1;
+    int ttl = MULTICAST_TTL;
+    if (bind(sock, (struct sockaddr*)&local_addr, sizeof(local_addr)) == SOCKET_ERROR ||
+        ioctlsocket(sock, FIONBIO, &non_blocking) == SOCKET_ERROR ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl, sizeof(ttl)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+/**
+ * 启用组播支持
+ *
+ * 参数：
+ * - base_addr: 组播基地址（点分十进制，如"239.255.69.1"），组i使用基地址 + i
+ * - port: 组播目的端口（0表示MULTICAST_DEFAULT_PORT）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（不是组播地址）
+ */
+int multicast_init(const char* base_addr, int port) {
+    ULONG addr = ntohl(inet_addr(base_addr));
+    ULONG last = addr + MULTICAST_MAX_GROUPS - 1;
+
+    // 所有组地址都必须落在224.0.0.0/4内
+    if ((addr >> 28) != 0xE || (last >> 28) != 0xE) {
+        return -1;
+    }
+
+    memset(&multicast_registry, 0, sizeof(multicast_registry));
+    InitializeCriticalSection(&multicast_registry.lock);
+    multicast_registry.base_addr = addr;
+    multicast_registry.port = (unsigned short)((port > 0 && port <= 65535) ? port : MULTICAST_DEFAULT_PORT);
+    for (int i = 0; i < MULTICAST_MAX_GROUPS; i++) {
+        multicast_registry.groups[i].sock = INVALID_SOCKET;
+    }
+    multicast_registry.initialized = 1;
+    return 0;
+}
+
+/**
+ * 是否已启用组播支持
+ */
+int multicast_enabled(void) {
+    return multicast_registry.initialized;
+}
+
+/**
+ * 为组播请求加入已有的组，或创建新组
+ *
+ * 功能说明：
+ * - 同一文件、同一块大小的组存在且仍接受客户端时加入该组，并回复OACK（mc=0）
+ * - 否则准备文件内容（共享缓存或文件映射）和组的套接字，占用一个空闲槽位；
+ *   新组的OACK（mc=1）由驱动它的会话发送
+ * - 准备期间另一个线程抢先为同一文件创建了组时，改为加入那个组
+ *
+ * 参数：
+ * - filepath: 文件路径
+ * - block_size: 协商的块大小
+ * - client_addr: 客户端地址
+ * - accepted: 协商后的选项，写入multicast选项的值
+ * - created: 新建组时输出组指针
+ *
+ * 返回值：
+ * - 1：已加入已有的组
+ * - 0：已创建新组，客户端为主客户端
+ * - -1：不能使用组播（槽位或组内客户端已满、文件无法打开或超过65535块），调用者回退为单播
+ */
+int multicast_start(const char* filepath, int block_size, const struct sockaddr_in* client_addr,
+                    tftp_options_t* accepted, tftp_multicast_group_t** created) {
+    int result = -1;
+
+    EnterCriticalSection(&multicast_registry.lock);
+    tftp_multicast_group_t* group = multicast_find_group(filepath, block_size);
+    if (group != NULL) {
+        result = multicast_join_locked(group, client_addr, accepted);
+    }
+    LeaveCriticalSection(&multicast_registry.lock);
+    if (group != NULL) {
+        return result;
+    }
+
+    // 在锁外准备文件内容和套接字（缓存未命中时映射文件），不阻塞其他线程的加入
+    tftp_file_map_t map;
+    map.file = INVALID_HANDLE_VALUE;
+    map.mapping = NULL;
+    tftp_cache_entry_t* cache_entry = file_cache_acquire(filepath);
+    const char* data = NULL;
+    ULONGLONG size = 0;
+    if (cache_entry != NULL) {
+        data = cache_entry->data;
+        size = cache_entry->size;
+    } else if (file_map_open(filepath, &map) == 0) {
+        data = map.data;
+        size = map.size;
+    } else {
+        return -1;
+    }
+
+    // 块号只有16位，组播传输不回绕
+    if (size / (ULONGLONG)block_size + 1 > 65535) {
+        multicast_release_data(cache_entry, &map);
+        return -1;
+    }
+
+    SOCKET sock = multicast_create_socket();
+    if (sock == INVALID_SOCKET) {
+        multicast_release_data(cache_entry, &map);
+        return -1;
+    }
+
+    EnterCriticalSection(&multicast_registry.lock);
+    group = multicast_find_group(filepath, block_size);
+    if (group != NULL) {
+        result = multicast_join_locked(group, client_addr, accepted);
+        LeaveCriticalSection(&multicast_registry.lock);
+        closesocket(sock);
+        multicast_release_data(cache_entry, &map);
+        return result;
+    }
+
+    for (int i = 0; i < MULTICAST_MAX_GROUPS && group == NULL; i++) {
+        if (!multicast_registry.groups[i].in_use) {
+            group = &multicast_registry.groups[i];
+            memset(group, 0, sizeof(*group));
+            group->in_use = 1;
+            group->accepting = 1;
+            strncpy(group->filepath, filepath, sizeof(group->filepath) - 1);
+            group->block_size = block_size;
+            group->group_addr.sin_family = AF_INET;
+            group->group_addr.sin_addr.s_addr = htonl(multicast_registry.base_addr + (ULONG)i);
+            group->group_addr.sin_port = htons(multicast_registry.port);
+            group->sock = sock;
+            group->cache_entry = cache_entry;
+            group->map = map;
+            group->data = data;
+            group->size = size;
+            group->members[0] = *client_addr;
+            group->member_count = 1;
+        }
+    }
+    LeaveCriticalSection(&multicast_registry.lock);
+
+    if (group == NULL) {
+        closesocket(sock);
+        multicast_release_data(cache_entry, &map);
+        return -1;
+    }
+
+    multicast_option_value(group, 1, accepted);
+    *created = group;
+    return 0;
+}
+
+/**
+ * 生成OACK中multicast选项的值："组地址,端口,mc"
+ *
+ * 参数：
+ * - group: 组
+ * - master: 收到该OACK的客户端是否为主客户端
+ * - options: 写入multicast_value的选项
+ */
+void multicast_option_value(const tftp_multicast_group_t* group, int master, tftp_options_t* options) {
+    snprintf(options->multicast_value, sizeof(options->multicast_value), "%s,%d,%d",
+             inet_ntoa(group->group_addr.sin_addr), ntohs(group->group_addr.sin_port), master ? 1 : 0);
+}
+
+/**
+ * 读取当前的主客户端
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（组内已没有客户端）
+ */
+int multicast_master(tftp_multicast_group_t* group, struct sockaddr_in* master) {
+    int result = -1;
+
+    EnterCriticalSection(&multicast_registry.lock);
+    if (group->member_count > 0) {
+        *master = group->members[0];
+        result = 0;
+    }
+    LeaveCriticalSection(&multicast_registry.lock);
+    return result;
+}
+
+/**
+ * 客户端离开组
+ *
+ * 功能说明：
+ * - 离开的是主客户端时，剩下的第一个客户端成为新的主客户端（由调用者发送mc=1的OACK）
+ * - 最后一个客户端离开后组不再接受加入，之后的同名请求创建新组
+ *
+ * 参数：
+ * - group: 组
+ * - client_addr: 离开的客户端
+ * - served: 该客户端是否已收齐文件
+ *
+ * 返回值：
+ * - 组内剩余的客户端数
+ */
+int multicast_leave(tftp_multicast_group_t* group, const struct sockaddr_in* client_addr, int served) {
+    EnterCriticalSection(&multicast_registry.lock);
+    int index = multicast_find_member(group, client_addr);
+    if (index >= 0) {
+        memmove(&group->members[index], &group->members[index + 1],
+                (size_t)(group->member_count - index - 1) * sizeof(struct sockaddr_in));
+        group->member_count--;
+        if (served) {
+            group->served++;
+        }
+    }
+    if (group->member_count == 0) {
+        group->accepting = 0;
+    }
+    int remaining = group->member_count;
+    LeaveCriticalSection(&multicast_registry.lock);
+    return remaining;
+}
+
+/**
+ * 结束组：关闭组的套接字，释放文件内容，槽位可以分配给新组
+ */
+void multicast_release(tftp_multicast_group_t* group) {
+    EnterCriticalSection(&multicast_registry.lock);
+    group->accepting = 0;
+    if (group->sock != INVALID_SOCKET) {
+        closesocket(group->sock);
+        group->sock = INVALID_SOCKET;
+    }
+    tftp_cache_entry_t* cache_entry = group->cache_entry;
+    tftp_file_map_t map = group->map;
+    group->cache_entry = NULL;
+    group->data = NULL;
+    group->member_count = 0;
+    group->in_use = 0;
+    LeaveCriticalSection(&multicast_registry.lock);
+
+    multicast_release_data(cache_entry, &map);
+}
+
+/**
+ * 释放组注册表（所有引擎退出后调用，此时所有组都已结束）
+ */
+void multicast_cleanup(void) {
+    if (!multicast_registry.initialized) {
+        return;
+    }
+    DeleteCriticalSection(&multicast_registry.lock);
+    multicast_registry.initialized = 0;
+}
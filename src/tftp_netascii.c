@@ -0,0 +1,305 @@
+#include "../include/tftp.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NETASCII_SSE2 1
+#endif
+
+/*
+ * netascii流式转换（RFC 764 / RFC 1350，两个版本共用）
+ *
+ * 设计思路：
+ * - 原来netascii只是以文本方式打开文件，换行转换交给C运行库：转换规则随平台而变，
+ *   Linux上根本不转换，裸CR也不会按NVT规则编码为CR NUL
+ * - 现在文件一律以二进制方式打开，由本模块显式转换：
+ *   下载编码 LF -> CR LF、CR -> CR NUL（文件中已有的CR LF视为一个换行，原样输出）；
+ *   上传解码 CR LF -> LF、CR NUL -> CR，其他字节前的裸CR原样保留
+ * - 转换状态跨数据块保存：CR出现在块末尾时，它与下一块第一个字节一起处理；
+ *   编码输出缓冲区只剩一个字节时，CR之后的LF或NUL留到下一块开头输出
+ * - 文本中绝大部分字节不需要转换，用SIMD（SSE2每次16字节，-mavx2编译时AVX2每次32字节）
+ *   找出下一个CR/LF，中间的连续字节整段memcpy，转换速度接近octet模式
+ */
+
+/**
+ * 掩码中最低的置位位置（mask必须非0）
+ */
+static int netascii_lowest_bit(unsigned int mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#endif
+}
+
+/**
+ * 查找第一个CR或LF
+ *
+ * 参数：
+ * - data: 数据
+ * - len: 数据长度
+ * - match_lf: 是否同时查找LF（编码时查找CR和LF，解码时只查找CR）
+ *
+ * 返回值：
+ * - 第一个CR（或LF）的位置，没有时为len
+ */
+static size_t netascii_scan(const char* data, size_t len, int match_lf) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i lf32 = _mm256_set1_epi8(match_lf ? '\n' : '\r');
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr32), _mm256_cmpeq_epi8(chunk, lf32)));
+        if (mask != 0) {
+            return i + (size_t)netascii_lowest_bit(mask);
+        }
+    }
+#elif defined(NETASCII_SSE2)
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i lf16 = _mm_set1_epi8(match_lf ? '\n' : '\r');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr16), _mm_cmpeq_epi8(chunk, lf16)));
+        if (mask != 0) {
+            return i + (size_t)netascii_lowest_bit(mask);
+        }
+    }
+#endif
+
+    // 不足一个向量的尾部（或不支持SIMD时的全部数据）逐字节查找
+    for (; i < len; i++) {
+        if (data[i] == '\r' || (match_lf && data[i] == '\n')) {
+            return i;
+        }
+    }
+    return len;
+}
+
+/**
+ * 初始化转换状态
+ *
+ * 参数：
+ * - state: 转换状态
+ * - input: netascii_read使用的读缓冲区（NETASCII_READ_SIZE字节），只解码时可以为NULL
+ */
+void netascii_init(tftp_netascii_t* state, char* input) {
+    memset(state, 0, sizeof(*state));
+    state->input = input;
+}
+
+/**
+ * 把本地文本编码为netascii
+ *
+ * 功能说明：
+ * - 先输出上次因缓冲区已满留下的字节，再转换输入，直到输入用完或输出缓冲区已满
+ * - 输入以CR结尾时CR被取走但暂不输出，由下一段输入的第一个字节（或netascii_encode_end）决定
+ *
+ * 参数：
+ * - state: 转换状态
+ * - in, in_len: 本地文本
+ * - consumed: 输出已取走的输入字节数
+ * - out, out_size: 输出缓冲区
+ *
+ * 返回值：
+ * - 写入out的字节数
+ */
+size_t netascii_encode(tftp_netascii_t* state, const char* in, size_t in_len, size_t* consumed,
+                       char* out, size_t out_size) {
+    size_t i = 0;
+    size_t n = 0;
+
+    for (;;) {
+        while (state->pending_len > 0 && n < out_size) {
+            out[n++] = state->pending[0];
+            state->pending[0] = state->pending[1];
+            state->pending_len--;
+        }
+        if (state->pending_len > 0 || n == out_size || i == in_len) {
+            break;
+        }
+
+        if (state->cr_seen) {
+            // 上一个字节是CR：后面是LF时这一对就是换行，否则CR编码为CR NUL
+            state->cr_seen = 0;
+            state->pending[0] = '\r';
+            state->pending[1] = (in[i] == '\n') ? '\n' : '\0';
+            state->pending_len = 2;
+            if (in[i] == '\n') {
+                i++;
+            }
+            continue;
+        }
+
+        size_t limit = in_len - i;
+        if (limit > out_size - n) {
+            limit = out_size - n;
+        }
+        size_t run = netascii_scan(in + i, limit, 1);
+        memcpy(out + n, in + i, run);
+        n += run;
+        i += run;
+        if (run < limit) {
+            if (in[i] == '\n') {
+                state->pending[0] = '\r';
+                state->pending[1] = '\n';
+                state->pending_len = 2;
+            } else {
+                state->cr_seen = 1;
+            }
+            i++;
+        }
+    }
+
+    *consumed = i;
+    return n;
+}
+
+/**
+ * 输入结束：文件末尾的裸CR编码为CR NUL（之后再调用一次netascii_encode输出）
+ */
+void netascii_encode_end(tftp_netascii_t* state) {
+    if (state->cr_seen) {
+        state->cr_seen = 0;
+        state->pending[state->pending_len++] = '\r';
+        state->pending[state->pending_len++] = '\0';
+    }
+}
+
+/**
+ * 从文件读取并编码，填满一个数据块
+ *
+ * 参数：
+ * - state: 转换状态（input为读缓冲区）
+ * - file: 以二进制方式打开的文件
+ * - out, out_size: 数据块缓冲区和块大小
+ *
+ * 返回值：
+ * - 写入的字节数，小于out_size说明文件已全部编码完（即最后一块）
+ */
+size_t netascii_read(tftp_netascii_t* state, FILE* file, char* out, size_t out_size) {
+    size_t n = 0;
+
+    while (n < out_size) {
+        if (state->input_pos == state->input_len && state->pending_len == 0) {
+            if (state->eof) {
+                break;
+            }
+            state->input_len = fread(state->input, 1, NETASCII_READ_SIZE, file);
+            state->input_pos = 0;
+            if (state->input_len == 0) {
+                state->eof = 1;
+                netascii_encode_end(state);
+                continue;
+            }
+        }
+
+        size_t consumed;
+        n += netascii_encode(state, state->input + state->input_pos, state->input_len - state->input_pos,
+                             &consumed, out + n, out_size - n);
+        state->input_pos += consumed;
+    }
+    return n;
+}
+
+/**
+ * 计算文件编码为netascii后的长度（RRQ的tsize选项）
+ *
+ * 功能说明：
+ * - 从文件开头按下载时相同的规则完整编码一遍，只计数不发送，结果与实际发送的字节数一致
+ * - 返回前把文件位置移回开头
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（内存不足或读取出错）
+ */
+int netascii_file_size(FILE* file, ULONGLONG* size) {
+    char* input = (char*)malloc(NETASCII_READ_SIZE);
+    char* output = (char*)malloc(NETASCII_READ_SIZE);
+    int result = -1;
+
+    if (input != NULL && output != NULL) {
+        tftp_netascii_t state;
+        ULONGLONG total = 0;
+        size_t n;
+
+        rewind(file);
+        netascii_init(&state, input);
+        do {
+            n = netascii_read(&state, file, output, NETASCII_READ_SIZE);
+            total += n;
+        } while (n == NETASCII_READ_SIZE);
+
+        if (!ferror(file)) {
+            *size = total;
+            result = 0;
+        }
+        rewind(file);
+    }
+    free(input);
+    free(output);
+    return result;
+}
+
+/**
+ * 把netascii解码为本地文本
+ *
+ * 参数：
+ * - state: 转换状态
+ * - in, in_len: 收到的数据块
+ * - out: 输出缓冲区（至少in_len + 1字节：上一块末尾的CR后面不是LF或NUL时在这里补出）
+ *
+ * 返回值：
+ * - 写入out的字节数
+ */
+size_t netascii_decode(tftp_netascii_t* state, const char* in, size_t in_len, char* out) {
+    size_t i = 0;
+    size_t n = 0;
+
+    while (i < in_len) {
+        if (state->cr_seen) {
+            state->cr_seen = 0;
+            if (in[i] == '\n') {
+                out[n++] = '\n';                         // CR LF -> LF
+                i++;
+            } else if (in[i] == '\0') {
+                out[n++] = '\r';                         // CR NUL -> CR
+                i++;
+            } else {
+                out[n++] = '\r';                         // 不合规的裸CR原样保留
+            }
+            continue;
+        }
+
+        size_t run = netascii_scan(in + i, in_len - i, 0);
+        memcpy(out + n, in + i, run);
+        n += run;
+        i += run;
+        if (i < in_len) {
+            state->cr_seen = 1;                          // CR的含义由下一个字节决定
+            i++;
+        }
+    }
+    return n;
+}
+
+/**
+ * 传输结束：最后一块以CR结尾时补出这个CR
+ *
+ * 返回值：
+ * - 写入out的字节数（0或1）
+ */
+size_t netascii_decode_end(tftp_netascii_t* state, char* out) {
+    if (!state->cr_seen) {
+        return 0;
+    }
+    state->cr_seen = 0;
+    out[0] = '\r';
+    return 1;
+}
@@ -0,0 +1,171 @@
+#include "../include/tftp.h"
+
+/*
+ * TFTP数据包解析（单线程和多线程版本服务器共用）
+ *
+ * 设计思路：
+ * - 解析结果是指向接收缓冲区的视图（tftp_packet_view_t），文件名、模式、
+ *   DATA数据和错误消息都不复制，使用期间接收缓冲区须保持有效
+ * - DATA/ACK只读取4字节头部，传输中的热路径不再触碰数据内容
+ * - 文件名和模式在缓冲区中原本就以null结尾，校验长度后直接作为C字符串使用；
+ *   只有RRQ/WRQ才解析模式之后的选项
+ * - 不依赖日志和套接字，基准测试工具（tools/parse_bench.c）可以单独链接
+ */
+
+/**
+ * 解析接收到的TFTP协议数据包
+ * 
+ * 功能说明：
+ * - 根据操作码解析不同类型的TFTP包，验证数据包格式的完整性和合法性
+ * - RRQ/WRQ: 文件名和模式指向缓冲区，并解析模式之后的选项
+ * - DATA: 块号和指向缓冲区的数据
+ * - ACK: 块号
+ * - ERROR: 错误码和指向缓冲区的错误消息
+ * 
+ * 参数：
+ * - buffer: 原始数据缓冲区
+ * - buffer_len: 缓冲区长度
+ * - packet: 解析结果（只设置该操作码用到的字段）
+ * 
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（包格式错误或长度不足）
+ */
+int parse_tftp_packet(const char* buffer, int buffer_len, tftp_packet_view_t* packet) {
+    // 检查数据包最小长度（至少包含2字节操作码）
+    if (buffer_len < 2) {
+        return -1; // 包长度不足
+    }
+    
+    // 提取操作码（网络字节序，按字节组合：不要求对齐，也不调用ntohs）
+    packet->opcode = (unsigned short)(((unsigned char)buffer[0] << 8) | (unsigned char)buffer[1]);
+    
+    switch (packet->opcode) {
+        case TFTP_DATA:             // 数据包：操作码(2) + 块号(2) + 数据(0-blksize字节)
+        case TFTP_ACK:              // 确认包：操作码(2) + 块号(2)
+        case TFTP_ERROR:            // 错误包：操作码(2) + 错误码(2) + 错误消息(变长) + 0
+            if (buffer_len < TFTP_HEADER_SIZE) {
+                return -1; // 头部不完整
+            }
+            packet->block_num = (unsigned short)(((unsigned char)buffer[2] << 8) | (unsigned char)buffer[3]);
+            packet->payload = buffer + TFTP_HEADER_SIZE;
+            packet->payload_len = buffer_len - TFTP_HEADER_SIZE;
+            
+            if (packet->opcode == TFTP_DATA && packet->payload_len > MAX_BLOCK_SIZE) {
+                return -1; // 数据长度超出TFTP协议限制
+            }
+            if (packet->opcode == TFTP_ACK && packet->payload_len != 0) {
+                return -1; // ACK包大小必须是4字节
+            }
+            if (packet->opcode == TFTP_ERROR) {
+                // 错误消息不含结尾的null
+                packet->payload_len = (int)strnlen(packet->payload, (size_t)packet->payload_len);
+            }
+            return 0;
+            
+        case TFTP_RRQ:              // 读请求（客户端下载文件）
+        case TFTP_WRQ: {            // 写请求（客户端上传文件）
+            // RRQ/WRQ包格式：操作码(2) + 文件名(变长) + 0 + 模式(变长) + 0 [+ 选项名 + 0 + 选项值 + 0 ...]
+            const char* ptr = buffer + 2;                // 跳过操作码
+            int remaining = buffer_len - 2;              // 剩余数据长度
+            
+            // 文件名（以null结尾的字符串），长度须能放入会话的文件名字段
+            int filename_len = (int)strnlen(ptr, (size_t)remaining);
+            if (filename_len >= remaining || filename_len >= MAX_FILENAME_LEN) {
+                return -1; // 文件名长度非法
+            }
+            packet->filename = ptr;
+            ptr += filename_len + 1;                     // 跳过文件名和null终止符
+            remaining -= filename_len + 1;
+            
+            // 传输模式（"netascii"或"octet"）
+            int mode_len = (int)strnlen(ptr, (size_t)remaining);
+            if (mode_len >= remaining || mode_len >= MAX_MODE_LEN) {
+                return -1; // 模式字符串格式错误
+            }
+            packet->mode = ptr;
+            ptr += mode_len + 1;                         // 跳过模式和null终止符
+            remaining -= mode_len + 1;
+            
+            // 模式之后的选项扩展（RFC 2347），没有选项时remaining为0
+            return parse_tftp_options(ptr, remaining, &packet->options);
+        }
+        
+        default:
+            return -1; // 未知的TFTP操作码
+    }
+}
+
+/**
+ * 解析RRQ/WRQ请求中模式字符串之后的选项扩展
+ * 
+ * 功能说明：
+ * - 选项格式为若干组"选项名\0选项值\0"（RFC 2347）
+ * - 选项名不区分大小写，未识别的选项直接忽略
+ * - 取值非法的选项视为未请求，由服务器按标准TFTP处理
+ * 
+ * 参数：
+ * - buffer: 指向第一个选项名的指针
+ * - buffer_len: 剩余数据长度
+ * - options: 解析结果（未出现的选项置0）
+ * 
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（选项未以null结尾）
+ */
+int parse_tftp_options(const char* buffer, int buffer_len, tftp_options_t* options) {
+    memset(options, 0, sizeof(*options));
+    
+    while (buffer_len > 0) {
+        // 解析选项名
+        int name_len = strnlen(buffer, buffer_len);
+        if (name_len >= buffer_len) {
+            return -1; // 选项名未以null结尾
+        }
+        const char* name = buffer;
+        buffer += name_len + 1;
+        buffer_len -= name_len + 1;
+        
+        // 解析选项值
+        int value_len = strnlen(buffer, buffer_len);
+        if (value_len >= buffer_len) {
+            return -1; // 选项值未以null结尾
+        }
+        const char* value = buffer;
+        buffer += value_len + 1;
+        buffer_len -= value_len + 1;
+        
+        if (strcasecmp(name, "blksize") == 0) {
+            // RFC 2348：块大小取值范围8-65464
+            long blksize = strtol(value, NULL, 10);
+            if (blksize >= MIN_BLOCK_SIZE && blksize <= MAX_BLOCK_SIZE) {
+                options->blksize = (int)blksize;
+            }
+        } else if (strcasecmp(name, "windowsize") == 0) {
+            // RFC 7440：窗口大小取值范围1-65535
+            long windowsize = strtol(value, NULL, 10);
+            if (windowsize >= 1 && windowsize <= 65535) {
+                options->windowsize = (int)windowsize;
+            }
+        } else if (strcasecmp(name, "timeout") == 0) {
+            // RFC 2349：超时秒数取值范围1-255
+            long timeout = strtol(value, NULL, 10);
+            if (timeout >= MIN_TIMEOUT_OPTION && timeout <= MAX_TIMEOUT_OPTION) {
+                options->timeout = (int)timeout;
+            }
+        } else if (strcasecmp(name, "multicast") == 0) {
+            // RFC 2090：请求中的值为空，由服务器在OACK中给出组地址
+            options->multicast = 1;
+        } else if (strcasecmp(name, "tsize") == 0) {
+            // RFC 2349：RRQ中为0，由服务器回复文件大小；WRQ中为要上传的文件大小
+            char* end;
+            unsigned long long tsize = strtoull(value, &end, 10);
+            if (value_len > 0 && *end == '\0' && value[0] != '-') {
+                options->tsize = 1;
+                options->tsize_value = (ULONGLONG)tsize;
+            }
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,317 @@
+#include "../include/tftp.h"
+
+/*
+ * 缓冲池：按尺寸级别复用会话的各类缓冲区（事件驱动引擎使用）
+ *
+ * 设计思路：
+ * - 窗口缓冲区、预读缓冲区、写缓冲环等按2的幂分为POOL_CLASS_COUNT个尺寸级别，
+ *   每块前面有一个16字节的块头记录所属级别，释放后挂到空闲链表复用
+ * - 每个引擎（工作线程）有自己的分配缓存（tftp_pool_cache_t），
+ *   分配和释放先在本线程的空闲链表上进行，不需要加锁
+ * - 本线程某一级别的空闲块超过上限时把一半交给进程级仓库，
+ *   缓存为空时从仓库一次取回一批，跨线程搬运按批进行，每批只加一次锁
+ * - 仓库中的空闲块超过POOL_DEPOT_BYTES时才真正释放，
+ *   稳定运行时会话的创建和结束不再调用malloc/free，内存占用等于并发传输的峰值需求
+ * - 超过最大级别的请求直接使用malloc/free（只有大blksize × 大窗口的下载窗口会用到）
+ * - 没有分配缓存的线程（如写后台化I/O线程）传入NULL，直接与仓库交换
+ */
+
+// 块头：位于返回给调用者的地址之前，16字节保证数据部分的对齐
+typedef union tftp_pool_block {
+    struct {
+        union tftp_pool_block* next;    // 空闲链表（块空闲时使用）
+        int size_class;                 // 尺寸级别（-1表示直接malloc的大块）
+    } header;
+    ULONGLONG align[2];
+} tftp_pool_block_t;
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护以下所有字段
+    tftp_pool_block_t* free_lists[POOL_CLASS_COUNT]; // 各级别的空闲块
+    int free_counts[POOL_CLASS_COUNT];  // 各级别的空闲块数
+    size_t free_bytes;                  // 仓库中空闲块的总大小
+    size_t heap_bytes;                  // 当前从堆上分配的总大小（含正在使用的）
+    unsigned long heap_allocs;          // 累计调用malloc的次数
+    int initialized;                    // 是否已初始化
+} tftp_pool_depot_t;
+
+static tftp_pool_depot_t pool_depot;
+
+/**
+ * 计算尺寸对应的级别（-1表示超过最大级别）
+ */
+static int pool_size_class(size_t size) {
+    int size_class = 0;
+    while (((size_t)1 << (POOL_MIN_SHIFT + size_class)) < size) {
+        size_class++;
+        if (size_class == POOL_CLASS_COUNT) {
+            return -1;
+        }
+    }
+    return size_class;
+}
+
+/**
+ * 级别的块大小（不含块头）
+ */
+static size_t pool_class_size(int size_class) {
+    return (size_t)1 << (POOL_MIN_SHIFT + size_class);
+}
+
+/**
+ * 线程缓存中每个级别最多保留的空闲块数：按POOL_CACHE_BYTES折算，至少4块
+ */
+static int pool_cache_limit(int size_class) {
+    size_t limit = POOL_CACHE_BYTES / pool_class_size(size_class);
+    if (limit < 4) {
+        return 4;
+    }
+    return (limit > POOL_CACHE_MAX_BLOCKS) ? POOL_CACHE_MAX_BLOCKS : (int)limit;
+}
+
+/**
+ * 从堆上分配一个块（调用时不持有锁，大块不计入heap_bytes）
+ */
+static tftp_pool_block_t* pool_heap_alloc(int size_class, size_t size) {
+    tftp_pool_block_t* block = (tftp_pool_block_t*)malloc(sizeof(tftp_pool_block_t) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->header.size_class = size_class;
+
+    EnterCriticalSection(&pool_depot.lock);
+    if (size_class >= 0) {
+        pool_depot.heap_bytes += size;
+    }
+    pool_depot.heap_allocs++;
+    LeaveCriticalSection(&pool_depot.lock);
+    return block;
+}
+
+/**
+ * 把块还给堆（调用时持有仓库锁）
+ */
+static void pool_heap_free(tftp_pool_block_t* block, size_t size) {
+    pool_depot.heap_bytes -= size;
+    free(block);
+}
+
+/**
+ * 把一条链表上的块放回仓库，超过仓库上限的部分还给堆
+ *
+ * 参数：
+ * - size_class: 级别
+ * - head: 链表头
+ */
+static void pool_depot_put(int size_class, tftp_pool_block_t* head) {
+    size_t size = pool_class_size(size_class);
+
+    EnterCriticalSection(&pool_depot.lock);
+    while (head != NULL) {
+        tftp_pool_block_t* block = head;
+        head = block->header.next;
+        if (pool_depot.free_bytes + size > POOL_DEPOT_BYTES) {
+            pool_heap_free(block, size);
+            continue;
+        }
+        block->header.next = pool_depot.free_lists[size_class];
+        pool_depot.free_lists[size_class] = block;
+        pool_depot.free_counts[size_class]++;
+        pool_depot.free_bytes += size;
+    }
+    LeaveCriticalSection(&pool_depot.lock);
+}
+
+/**
+ * 从仓库取回最多count个块
+ *
+ * 参数：
+ * - size_class: 级别
+ * - count: 最多取回的块数
+ * - taken: 输出，实际取回的块数
+ *
+ * 返回值：
+ * - 取回的块组成的链表（仓库为空时为NULL）
+ */
+static tftp_pool_block_t* pool_depot_take(int size_class, int count, int* taken) {
+    tftp_pool_block_t* head = NULL;
+    size_t size = pool_class_size(size_class);
+
+    *taken = 0;
+    EnterCriticalSection(&pool_depot.lock);
+    while (*taken < count && pool_depot.free_lists[size_class] != NULL) {
+        tftp_pool_block_t* block = pool_depot.free_lists[size_class];
+        pool_depot.free_lists[size_class] = block->header.next;
+        pool_depot.free_counts[size_class]--;
+        pool_depot.free_bytes -= size;
+        block->header.next = head;
+        head = block;
+        (*taken)++;
+    }
+    LeaveCriticalSection(&pool_depot.lock);
+    return head;
+}
+
+/**
+ * 初始化进程级仓库
+ */
+void pool_init(void) {
+    memset(&pool_depot, 0, sizeof(pool_depot));
+    InitializeCriticalSection(&pool_depot.lock);
+    pool_depot.initialized = 1;
+}
+
+/**
+ * 释放仓库中的所有空闲块（各线程缓存应已交回）
+ */
+void pool_cleanup(void) {
+    if (!pool_depot.initialized) {
+        return;
+    }
+
+    EnterCriticalSection(&pool_depot.lock);
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        while (pool_depot.free_lists[i] != NULL) {
+            tftp_pool_block_t* block = pool_depot.free_lists[i];
+            pool_depot.free_lists[i] = block->header.next;
+            pool_heap_free(block, pool_class_size(i));
+        }
+        pool_depot.free_counts[i] = 0;
+    }
+    pool_depot.free_bytes = 0;
+    LeaveCriticalSection(&pool_depot.lock);
+
+    DeleteCriticalSection(&pool_depot.lock);
+    pool_depot.initialized = 0;
+}
+
+/**
+ * 分配缓冲区
+ *
+ * 功能说明：
+ * - 依次尝试本线程缓存、进程级仓库（一次取回半个缓存上限的块），最后才从堆上分配
+ *
+ * 参数：
+ * - cache: 本线程的分配缓存（NULL表示直接使用仓库）
+ * - size: 字节数
+ *
+ * 返回值：
+ * - 成功：缓冲区（内容未初始化）
+ * - 失败：NULL（内存不足）
+ */
+void* pool_alloc(tftp_pool_cache_t* cache, size_t size) {
+    int size_class = pool_size_class(size);
+    tftp_pool_block_t* block;
+
+    if (size_class < 0) {
+        block = pool_heap_alloc(-1, size);
+        return (block != NULL) ? (void*)(block + 1) : NULL;
+    }
+
+    if (cache != NULL && cache->free_lists[size_class] == NULL) {
+        int taken;
+        cache->free_lists[size_class] = pool_depot_take(size_class, pool_cache_limit(size_class) / 2, &taken);
+        cache->free_counts[size_class] = taken;
+    }
+
+    if (cache != NULL && cache->free_lists[size_class] != NULL) {
+        block = cache->free_lists[size_class];
+        cache->free_lists[size_class] = block->header.next;
+        cache->free_counts[size_class]--;
+    } else {
+        int taken = 0;
+        block = (cache == NULL) ? pool_depot_take(size_class, 1, &taken) : NULL;
+        if (block == NULL) {
+            block = pool_heap_alloc(size_class, pool_class_size(size_class));
+            if (block == NULL) {
+                return NULL;
+            }
+        }
+    }
+    return block + 1;
+}
+
+/**
+ * 分配并清零缓冲区（参数和返回值同pool_alloc）
+ */
+void* pool_calloc(tftp_pool_cache_t* cache, size_t size) {
+    void* ptr = pool_alloc(cache, size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/**
+ * 释放缓冲区
+ *
+ * 参数：
+ * - cache: 本线程的分配缓存（NULL表示直接放回仓库，可以是分配时以外的线程）
+ * - ptr: pool_alloc返回的缓冲区（NULL时不做任何操作）
+ */
+void pool_free(tftp_pool_cache_t* cache, void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    tftp_pool_block_t* block = (tftp_pool_block_t*)ptr - 1;
+    int size_class = block->header.size_class;
+
+    if (size_class < 0) {
+        free(block);
+        return;
+    }
+
+    if (cache == NULL) {
+        block->header.next = NULL;
+        pool_depot_put(size_class, block);
+        return;
+    }
+
+    block->header.next = cache->free_lists[size_class];
+    cache->free_lists[size_class] = block;
+    cache->free_counts[size_class]++;
+
+    int limit = pool_cache_limit(size_class);
+    if (cache->free_counts[size_class] > limit) {
+        // 把一半空闲块交给仓库，供其他线程使用
+        tftp_pool_block_t* head = cache->free_lists[size_class];
+        tftp_pool_block_t* tail = head;
+        int moved = 1;
+        while (moved < limit / 2) {
+            tail = tail->header.next;
+            moved++;
+        }
+        cache->free_lists[size_class] = tail->header.next;
+        cache->free_counts[size_class] -= moved;
+        tail->header.next = NULL;
+        pool_depot_put(size_class, head);
+    }
+}
+
+/**
+ * 把线程缓存中的所有空闲块交回仓库（引擎退出时调用）
+ */
+void pool_cache_release(tftp_pool_cache_t* cache) {
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        if (cache->free_lists[i] != NULL) {
+            pool_depot_put(i, cache->free_lists[i]);
+            cache->free_lists[i] = NULL;
+            cache->free_counts[i] = 0;
+        }
+    }
+}
+
+/**
+ * 读取缓冲池统计
+ *
+ * 参数：
+ * - heap_bytes: 输出，当前从堆上分配的按级别块总大小（不含超过最大级别的大块）
+ * - heap_allocs: 输出，累计调用malloc的次数（稳定运行时不再增长）
+ */
+void pool_get_stats(size_t* heap_bytes, unsigned long* heap_allocs) {
+    EnterCriticalSection(&pool_depot.lock);
+    *heap_bytes = pool_depot.heap_bytes;
+    *heap_allocs = pool_depot.heap_allocs;
+    LeaveCriticalSection(&pool_depot.lock);
+}
@@ -0,0 +1,395 @@
+#include "../include/tftp.h"
+
+/*
+ * 进程级会话表（所有工作线程共享）
+ *
+ * 设计思路：
+ * - 以（客户端地址，客户端端口，服务器端口）为键的开放寻址哈希表，线性探测，
+ *   删除时后移后续条目（不留墓碑），装载率不超过1/2，查找和增删都是常数时间
+ * - 哈希只取客户端地址和端口：同一客户端TID的所有会话落在同一段探测序列中，
+ *   按客户端TID查找（服务器端口为0表示任意）同样是常数时间，
+ *   监听套接字据此识别客户端重发的RRQ/WRQ
+ * - 新会话在打开或加载文件之前先按客户端TID占位（session_table_claim，检查和登记是一次加锁），
+ *   借出传输套接字后再补上服务器端口；另一个工作线程在加载期间取到的重发请求占位失败，不会开始第二个传输
+ * - 会话结构从slab中分配：每个slab一次分配SESSION_SLAB_SIZE个会话，
+ *   回收的会话挂到空闲链表复用，稳定运行时不再为会话调用malloc/free；
+ *   每个引擎在自己的分配缓存中保留一批空闲会话，分配和回收通常不需要加锁，
+ *   只有缓存为空或超过SESSION_CACHE_SIZE时才与进程级空闲链表成批交换
+ * - 所有工作线程共用一个监听套接字，重发的请求可能被另一个线程取到，
+ *   因此会话表是进程级的，由一个锁保护；会话的其他字段仍只由所属工作线程访问
+ * - 监控代码可以通过session_table_foreach枚举所有活动会话
+ */
+
+// 哈希表条目（session为NULL表示空槽位）
+typedef struct {
+    ULONG client_ip;                    // 客户端地址（网络字节序）
+    unsigned short client_port;         // 客户端端口（网络字节序）
+    unsigned short server_port;         // 服务器端口（网络字节序）
+    tftp_session_t* session;            // 会话
+} tftp_session_entry_t;
+
+// 会话slab：一次分配的一组会话
+typedef struct tftp_session_slab {
+    struct tftp_session_slab* next;     // slab链表
+    tftp_session_t sessions[SESSION_SLAB_SIZE];
+} tftp_session_slab_t;
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护以下所有字段
+    tftp_session_entry_t* entries;      // 哈希表槽位
+    int capacity;                       // 槽位数（2的幂）
+    int count;                          // 已登记的会话数
+    tftp_session_slab_t* slabs;         // 已分配的slab
+    tftp_session_t* free_list;          // 空闲会话
+    int initialized;                    // 是否已初始化
+} tftp_session_table_t;
+
+static tftp_session_table_t session_table;
+
+/**
+ * 计算客户端TID的起始槽位（Fibonacci哈希）
+ */
+static int session_table_slot(ULONG client_ip, unsigned short client_port, int capacity) {
+    unsigned int key = (unsigned int)client_ip ^ ((unsigned int)client_port * 0x9E3779B1u);
+    return (int)((key * 2654435761u) >> 7) & (capacity - 1);
+}
+
+/**
+ * 把条目放入哈希表（调用时持有锁，且表中有空槽位）
+ */
+static void session_table_place(tftp_session_entry_t* entries, int capacity, const tftp_session_entry_t* entry) {
+    int slot = session_table_slot(entry->client_ip, entry->client_port, capacity);
+    while (entries[slot].session != NULL) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    entries[slot] = *entry;
+}
+
+/**
+ * 哈希表扩容为两倍（调用时持有锁）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（内存不足）
+ */
+static int session_table_grow(void) {
+    int capacity = session_table.capacity * 2;
+    tftp_session_entry_t* entries = (tftp_session_entry_t*)calloc((size_t)capacity, sizeof(tftp_session_entry_t));
+    if (entries == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < session_table.capacity; i++) {
+        if (session_table.entries[i].session != NULL) {
+            session_table_place(entries, capacity, &session_table.entries[i]);
+        }
+    }
+    free(session_table.entries);
+    session_table.entries = entries;
+    session_table.capacity = capacity;
+    return 0;
+}
+
+/**
+ * 初始化会话表
+ */
+void session_table_init(void) {
+    memset(&session_table, 0, sizeof(session_table));
+    InitializeCriticalSection(&session_table.lock);
+    session_table.entries = (tftp_session_entry_t*)calloc(SESSION_TABLE_MIN_CAPACITY, sizeof(tftp_session_entry_t));
+    session_table.capacity = (session_table.entries != NULL) ? SESSION_TABLE_MIN_CAPACITY : 0;
+    session_table.initialized = 1;
+}
+
+/**
+ * 释放会话表和所有slab
+ */
+void session_table_cleanup(void) {
+    if (!session_table.initialized) {
+        return;
+    }
+
+    while (session_table.slabs != NULL) {
+        tftp_session_slab_t* slab = session_table.slabs;
+        session_table.slabs = slab->next;
+        free(slab);
+    }
+    free(session_table.entries);
+    DeleteCriticalSection(&session_table.lock);
+    session_table.initialized = 0;
+}
+
+/**
+ * 分配一个会话结构
+ *
+ * 功能说明：
+ * - 引擎缓存中有空闲会话时直接取用；否则加锁从进程级空闲链表
+ *   一次取回SESSION_CACHE_SIZE / 2个（不足时先分配新的slab）
+ *
+ * 参数：
+ * - cache: 所属引擎的分配缓存
+ *
+ * 返回值：
+ * - 成功：已清零的会话
+ * - 失败：NULL（内存不足）
+ */
+tftp_session_t* session_table_alloc(tftp_pool_cache_t* cache) {
+    if (cache->free_sessions == NULL) {
+        EnterCriticalSection(&session_table.lock);
+        while (cache->free_session_count < SESSION_CACHE_SIZE / 2) {
+            if (session_table.free_list == NULL) {
+                tftp_session_slab_t* slab = (tftp_session_slab_t*)malloc(sizeof(tftp_session_slab_t));
+                if (slab == NULL) {
+                    break;
+                }
+                slab->next = session_table.slabs;
+                session_table.slabs = slab;
+                for (int i = SESSION_SLAB_SIZE - 1; i >= 0; i--) {
+                    slab->sessions[i].next_free = session_table.free_list;
+                    session_table.free_list = &slab->sessions[i];
+                }
+            }
+
+            tftp_session_t* session = session_table.free_list;
+            session_table.free_list = session->next_free;
+            session->next_free = cache->free_sessions;
+            cache->free_sessions = session;
+            cache->free_session_count++;
+        }
+        LeaveCriticalSection(&session_table.lock);
+
+        if (cache->free_sessions == NULL) {
+            return NULL;
+        }
+    }
+
+    tftp_session_t* session = cache->free_sessions;
+    cache->free_sessions = session->next_free;
+    cache->free_session_count--;
+
+    memset(session, 0, sizeof(*session));
+    return session;
+}
+
+/**
+ * 把会话结构还给引擎缓存（调用前必须已从哈希表中删除）
+ *
+ * 说明：
+ * - 缓存超过SESSION_CACHE_SIZE时把一半交回进程级空闲链表，供其他引擎使用
+ */
+void session_table_free(tftp_pool_cache_t* cache, tftp_session_t* session) {
+    session->next_free = cache->free_sessions;
+    cache->free_sessions = session;
+    cache->free_session_count++;
+
+    if (cache->free_session_count > SESSION_CACHE_SIZE) {
+        EnterCriticalSection(&session_table.lock);
+        while (cache->free_session_count > SESSION_CACHE_SIZE / 2) {
+            tftp_session_t* spare = cache->free_sessions;
+            cache->free_sessions = spare->next_free;
+            cache->free_session_count--;
+            spare->next_free = session_table.free_list;
+            session_table.free_list = spare;
+        }
+        LeaveCriticalSection(&session_table.lock);
+    }
+}
+
+/**
+ * 把引擎缓存中的所有空闲会话交回进程级空闲链表（引擎退出时调用）
+ */
+void session_table_release_cache(tftp_pool_cache_t* cache) {
+    EnterCriticalSection(&session_table.lock);
+    while (cache->free_sessions != NULL) {
+        tftp_session_t* session = cache->free_sessions;
+        cache->free_sessions = session->next_free;
+        session->next_free = session_table.free_list;
+        session_table.free_list = session;
+    }
+    cache->free_session_count = 0;
+    LeaveCriticalSection(&session_table.lock);
+}
+
+/**
+ * 查找客户端TID的第一个登记条目（调用时持有锁，server_port为0表示任意）
+ *
+ * 返回值：
+ * - 找到：条目指针
+ * - 未找到：NULL
+ */
+static tftp_session_entry_t* session_table_find(ULONG client_ip, unsigned short client_port,
+                                                unsigned short server_port) {
+    if (session_table.capacity == 0) {
+        return NULL;
+    }
+    int mask = session_table.capacity - 1;
+    int slot = session_table_slot(client_ip, client_port, session_table.capacity);
+    for (; session_table.entries[slot].session != NULL; slot = (slot + 1) & mask) {
+        tftp_session_entry_t* entry = &session_table.entries[slot];
+        if (entry->client_ip == client_ip && entry->client_port == client_port &&
+            (server_port == 0 || entry->server_port == server_port)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 登记条目（调用时持有锁）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（内存不足）
+ */
+static int session_table_add_locked(tftp_session_t* session) {
+    tftp_session_entry_t entry;
+    entry.client_ip = session->client_addr.sin_addr.s_addr;
+    entry.client_port = session->client_addr.sin_port;
+    entry.server_port = session->server_port;
+    entry.session = session;
+
+    if ((session_table.count + 1) * 2 > session_table.capacity && session_table_grow() < 0) {
+        return -1;
+    }
+    session_table_place(session_table.entries, session_table.capacity, &entry);
+    session_table.count++;
+    session->registered = 1;
+    return 0;
+}
+
+/**
+ * 按客户端TID为新会话占位（client_addr必须已设置，服务器端口留空）
+ *
+ * 功能说明：
+ * - 检查同一客户端TID是否已有会话并登记，在同一次加锁中完成，
+ *   两个工作线程同时处理同一请求（客户端重发）时只有一个能占位成功
+ *
+ * 返回值：
+ * - 成功：0
+ * - 已有会话：1
+ * - 失败：-1（内存不足）
+ */
+int session_table_claim(tftp_session_t* session) {
+    EnterCriticalSection(&session_table.lock);
+    int result = 1;
+    if (session_table_find(session->client_addr.sin_addr.s_addr, session->client_addr.sin_port, 0) == NULL) {
+        session->server_port = 0;
+        result = session_table_add_locked(session);
+    }
+    LeaveCriticalSection(&session_table.lock);
+    return result;
+}
+
+/**
+ * 登记会话（client_addr和server_port必须已设置）
+ *
+ * 说明：
+ * - 已通过session_table_claim占位时只补上服务器端口（哈希只取客户端TID，条目位置不变）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（内存不足）
+ */
+int session_table_insert(tftp_session_t* session) {
+    int result = 0;
+
+    EnterCriticalSection(&session_table.lock);
+    if (session->registered) {
+        int mask = session_table.capacity - 1;
+        int slot = session_table_slot(session->client_addr.sin_addr.s_addr, session->client_addr.sin_port,
+                                      session_table.capacity);
+        while (session_table.entries[slot].session != session) {
+            slot = (slot + 1) & mask;
+        }
+        session_table.entries[slot].server_port = session->server_port;
+    } else {
+        result = session_table_add_locked(session);
+    }
+    LeaveCriticalSection(&session_table.lock);
+    return result;
+}
+
+/**
+ * 删除会话的登记（未登记时不做任何操作）
+ *
+ * 说明：
+ * - 线性探测删除后，把同一探测序列中后面的条目前移填补空位，
+ *   保证查找遇到空槽位即可停止
+ */
+void session_table_remove(tftp_session_t* session) {
+    if (!session->registered) {
+        return;
+    }
+
+    EnterCriticalSection(&session_table.lock);
+    int mask = session_table.capacity - 1;
+    int slot = session_table_slot(session->client_addr.sin_addr.s_addr, session->client_addr.sin_port,
+                                  session_table.capacity);
+    while (session_table.entries[slot].session != NULL && session_table.entries[slot].session != session) {
+        slot = (slot + 1) & mask;
+    }
+
+    if (session_table.entries[slot].session == session) {
+        int hole = slot;
+        session_table.entries[hole].session = NULL;
+        session_table.count--;
+
+        for (int next = (hole + 1) & mask; session_table.entries[next].session != NULL; next = (next + 1) & mask) {
+            int home = session_table_slot(session_table.entries[next].client_ip,
+                                          session_table.entries[next].client_port, session_table.capacity);
+            // home不在(hole, next]区间内时，该条目可以前移到空位
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                session_table.entries[hole] = session_table.entries[next];
+                session_table.entries[next].session = NULL;
+                hole = next;
+            }
+        }
+    }
+    LeaveCriticalSection(&session_table.lock);
+    session->registered = 0;
+}
+
+/**
+ * 查询客户端TID是否有已登记的会话
+ *
+ * 参数：
+ * - client_addr: 客户端地址和端口
+ * - server_port: 服务器端口（网络字节序），0表示任意
+ *
+ * 返回值：
+ * - 1：存在
+ * - 0：不存在
+ */
+int session_table_contains(const struct sockaddr_in* client_addr, unsigned short server_port) {
+    EnterCriticalSection(&session_table.lock);
+    int found = (session_table_find(client_addr->sin_addr.s_addr, client_addr->sin_port, server_port) != NULL);
+    LeaveCriticalSection(&session_table.lock);
+    return found;
+}
+
+/**
+ * 已登记的会话数
+ */
+int session_table_count(void) {
+    EnterCriticalSection(&session_table.lock);
+    int count = session_table.count;
+    LeaveCriticalSection(&session_table.lock);
+    return count;
+}
+
+/**
+ * 枚举所有已登记的会话（监控用）
+ *
+ * 说明：
+ * - 回调在持有锁时调用，会话在此期间不会被回收；
+ *   但其传输状态仍由所属工作线程修改，回调读到的计数可能略有滞后
+ */
+void session_table_foreach(void (*visit)(const tftp_session_t* session, void* context), void* context) {
+    EnterCriticalSection(&session_table.lock);
+    for (int i = 0; i < session_table.capacity; i++) {
+        if (session_table.entries[i].session != NULL) {
+            visit(session_table.entries[i].session, context);
+        }
+    }
+    LeaveCriticalSection(&session_table.lock);
+}
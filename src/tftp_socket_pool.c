@@ -0,0 +1,280 @@
+#include "../include/tftp.h"
+
+/*
+ * 预绑定传输套接字池（多线程版本使用）
+ *
+ * 设计思路：
+ * - 每个传输都需要一个新的服务器端TID。原来每次RRQ/WRQ都要socket()、bind(端口0)、
+ *   ioctlsocket、setsockopt，传输结束再closesocket；PXE批量启动时这些系统调用和
+ *   临时端口分配集中在请求接纳路径上
+ * - 启动时预先创建并绑定一批非阻塞UDP套接字（发送缓冲区已扩大），会话借出时只需
+ *   connect()到客户端（内核随即丢弃其他地址发来的数据报，也是TransmitPackets的要求），
+ *   结束时还回池中，套接字和端口都不释放
+ * - 空闲套接字先进先出：刚还回的套接字最后才再次借出，旧传输迟到的数据包有足够时间到达，
+ *   借出并connect()到新客户端后，接收队列中残留的数据报被丢弃
+ * - 指定端口范围（-ports LOW-HIGH，便于防火墙放行）时，启动时绑定范围内的所有端口，
+ *   传输只使用这些端口，池空时拒绝新的传输；未指定时预绑定SOCKET_POOL_PREBIND个
+ *   系统分配的端口，池空时临时创建，空闲数超过SOCKET_POOL_CAPACITY时多余的关闭
+ * - 借出和归还在每个传输中各一次，由一个锁保护；未初始化时（单线程版本）退化为
+ *   每次创建和关闭
+ */
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护以下所有字段
+    SOCKET* idle;                       // 空闲套接字（环形队列，先进先出）
+    int capacity;                       // 环的容量
+    int head;                           // 最早归还的空闲套接字位置
+    int count;                          // 空闲套接字数
+    unsigned short port_low;            // 端口范围下限（主机字节序，0表示由系统分配端口）
+    unsigned short port_high;           // 端口范围上限（主机字节序）
+    int initialized;                    // 是否已初始化
+} tftp_socket_pool_t;
+
+static tftp_socket_pool_t socket_pool;
+
+/**
+ * 创建一个非阻塞、已绑定的传输套接字
+ *
+ * 参数：
+ * - port: 绑定的端口（主机字节序，0表示由系统分配）
+ *
+ * 返回值：
+ * - 成功：套接字描述符
+ * - 失败：INVALID_SOCKET
+ */
+static SOCKET socket_pool_create(unsigned short port) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    struct sockaddr_in data_addr;
+    memset(&data_addr, 0, sizeof(data_addr));
+    data_addr.sin_family = AF_INET;
+    data_addr.sin_addr.s_addr = INADDR_ANY;
+    data_addr.sin_port = htons(port);
+
+    if (bind(sock, (struct sockaddr*)&data_addr, sizeof(data_addr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    unsigned long non_blocking = 1;
+    if (ioctlsocket(sock, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    // 发送缓冲区扩大到窗口上限，避免整窗发送时被丢弃
+    int send_buffer = MAX_WINDOW_BYTES;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&send_buffer, sizeof(send_buffer));
+
+    return sock;
+}
+
+/**
+ * 把空闲套接字放到队尾（调用时持有锁）
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（池已满）
+ */
+static int socket_pool_push(SOCKET sock) {
+    if (socket_pool.count >= socket_pool.capacity) {
+        return -1;
+    }
+    socket_pool.idle[(socket_pool.head + socket_pool.count) % socket_pool.capacity] = sock;
+    socket_pool.count++;
+    return 0;
+}
+
+/**
+ * 丢弃接收队列中残留的数据报（旧传输迟到的数据包、ICMP端口不可达错误）
+ */
+static void socket_pool_drain(SOCKET sock) {
+    char scratch[TFTP_HEADER_SIZE];
+
+    // 缓冲区小于数据报时recv返回WSAEMSGSIZE，数据报同样被取出
+    for (int i = 0; i < SOCKET_POOL_DRAIN_LIMIT; i++) {
+        if (recv(sock, scratch, sizeof(scratch), 0) == SOCKET_ERROR) {
+            int error = WSAGetLastError();
+            if (error != WSAEMSGSIZE && error != WSAECONNRESET) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * 初始化套接字池并预先绑定套接字
+ *
+ * 参数：
+ * - port_low, port_high: 端口范围（0表示不限制，由系统分配端口）
+ *
+ * 返回值：
+ * - 成功：预先绑定的套接字数
+ * - 失败：-1（指定了端口范围但一个端口也无法绑定，或内存不足）
+ */
+int socket_pool_init(int port_low, int port_high) {
+    memset(&socket_pool, 0, sizeof(socket_pool));
+
+    int use_range = (port_low > 0 && port_high >= port_low && port_high <= 65535);
+    socket_pool.capacity = use_range ? (port_high - port_low + 1) : SOCKET_POOL_CAPACITY;
+    socket_pool.idle = (SOCKET*)malloc((size_t)socket_pool.capacity * sizeof(SOCKET));
+    if (socket_pool.idle == NULL) {
+        return -1;
+    }
+    if (use_range) {
+        socket_pool.port_low = (unsigned short)port_low;
+        socket_pool.port_high = (unsigned short)port_high;
+    }
+    InitializeCriticalSection(&socket_pool.lock);
+    socket_pool.initialized = 1;
+
+    if (use_range) {
+        for (int port = port_low; port <= port_high; port++) {
+            SOCKET sock = socket_pool_create((unsigned short)port);
+            if (sock == INVALID_SOCKET) {
+                thread_safe_log("WARNING", "Transfer port %d is unavailable, skipped", port);
+                continue;
+            }
+            socket_pool_push(sock);
+        }
+        if (socket_pool.count == 0) {
+            socket_pool_cleanup();
+            return -1;
+        }
+    } else {
+        for (int i = 0; i < SOCKET_POOL_PREBIND; i++) {
+            SOCKET sock = socket_pool_create(0);
+            if (sock == INVALID_SOCKET) {
+                break;
+            }
+            socket_pool_push(sock);
+        }
+    }
+    return socket_pool.count;
+}
+
+/**
+ * 借出一个传输套接字并连接到客户端
+ *
+ * 功能说明：
+ * - 从池中取出最早归还的套接字；池空时，未指定端口范围则临时创建一个
+ * - connect()到客户端地址：批量发送（TransmitPackets）要求数据报套接字已连接，
+ *   内核也会丢弃其他地址发来的数据报
+ * - 连接后丢弃接收队列中残留的数据报
+ *
+ * 参数：
+ * - client_addr: 客户端地址（客户端TID）
+ *
+ * 返回值：
+ * - 成功：套接字描述符
+ * - 失败：INVALID_SOCKET（端口范围已用完，或创建、连接失败）
+ */
+SOCKET socket_pool_acquire(const struct sockaddr_in* client_addr) {
+    SOCKET sock = INVALID_SOCKET;
+
+    if (socket_pool.initialized) {
+        EnterCriticalSection(&socket_pool.lock);
+        if (socket_pool.count > 0) {
+            sock = socket_pool.idle[socket_pool.head];
+            socket_pool.head = (socket_pool.head + 1) % socket_pool.capacity;
+            socket_pool.count--;
+        }
+        LeaveCriticalSection(&socket_pool.lock);
+    }
+    if (sock == INVALID_SOCKET) {
+        if (socket_pool.port_low != 0) {
+            return INVALID_SOCKET;                       // 端口范围内的套接字都在使用中
+        }
+        sock = socket_pool_create(0);
+        if (sock == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+    }
+
+    if (connect(sock, (const struct sockaddr*)client_addr, sizeof(*client_addr)) == SOCKET_ERROR) {
+        socket_pool_release(sock, 0);
+        return INVALID_SOCKET;
+    }
+    socket_pool_drain(sock);
+    return sock;
+}
+
+/**
+ * 归还传输套接字
+ *
+ * 功能说明：
+ * - 套接字仍连接着上一个客户端，空闲期间只会收到它迟到的数据包，下次借出时丢弃
+ * - 池已满（未指定端口范围）或套接字不可复用时关闭；端口范围内不可复用的套接字
+ *   关闭后在同一端口重新创建，范围内的端口不会流失
+ *
+ * 参数：
+ * - sock: 传输套接字
+ * - reusable: 套接字状态是否已恢复（为0时不再复用该套接字）
+ */
+void socket_pool_release(SOCKET sock, int reusable) {
+    if (!socket_pool.initialized) {
+        closesocket(sock);
+        return;
+    }
+
+    if (!reusable) {
+        struct sockaddr_in local_addr;
+        int local_addr_len = sizeof(local_addr);
+        unsigned short port = 0;
+        if (socket_pool.port_low != 0 &&
+            getsockname(sock, (struct sockaddr*)&local_addr, &local_addr_len) != SOCKET_ERROR) {
+            port = ntohs(local_addr.sin_port);
+        }
+        closesocket(sock);
+        if (port == 0) {
+            return;
+        }
+        sock = socket_pool_create(port);
+        if (sock == INVALID_SOCKET) {
+            thread_safe_log("WARNING", "Failed to rebind transfer port %d", port);
+            return;
+        }
+    }
+
+    EnterCriticalSection(&socket_pool.lock);
+    int result = socket_pool_push(sock);
+    LeaveCriticalSection(&socket_pool.lock);
+    if (result < 0) {
+        closesocket(sock);
+    }
+}
+
+/**
+ * 当前空闲的传输套接字数（监控用）
+ */
+int socket_pool_idle_count(void) {
+    if (!socket_pool.initialized) {
+        return 0;
+    }
+    EnterCriticalSection(&socket_pool.lock);
+    int count = socket_pool.count;
+    LeaveCriticalSection(&socket_pool.lock);
+    return count;
+}
+
+/**
+ * 关闭池中所有空闲套接字（所有引擎退出后调用）
+ */
+void socket_pool_cleanup(void) {
+    if (!socket_pool.initialized) {
+        return;
+    }
+
+    while (socket_pool.count > 0) {
+        closesocket(socket_pool.idle[socket_pool.head]);
+        socket_pool.head = (socket_pool.head + 1) % socket_pool.capacity;
+        socket_pool.count--;
+    }
+    free(socket_pool.idle);
+    socket_pool.idle = NULL;
+    DeleteCriticalSection(&socket_pool.lock);
+    socket_pool.initialized = 0;
+}
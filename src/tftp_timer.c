@@ -0,0 +1,226 @@
+#include "../include/tftp.h"
+
+/*
+ * 分层时间轮：统一管理所有会话的重传截止时间
+ *
+ * 设计思路：
+ * - 时间刻度为1毫秒，共TIMER_WHEEL_LEVELS层，每层TIMER_WHEEL_SLOTS个槽位，
+ *   第0层覆盖未来256毫秒，第1层覆盖65秒，第2层覆盖4.6小时，第3层覆盖约49天
+ * - 定时器节点嵌入在会话结构中，每个槽位是带哨兵的双向循环链表，
+ *   插入和取消都是O(1)且不分配内存
+ * - 推进时间时逐刻度处理第0层槽位，第0层转完一圈时把上一层对应槽位的
+ *   定时器重新分配到下层（级联），每个定时器最多级联TIMER_WHEEL_LEVELS-1次
+ * - 整个事件循环每轮只读取一次时钟，会话设置超时不需要任何系统调用
+ */
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/**
+ * 初始化链表哨兵节点（指向自身表示空链表）
+ */
+static void timer_list_init(tftp_timer_t* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+/**
+ * 将定时器节点追加到链表尾部
+ */
+static void timer_list_append(tftp_timer_t* head, tftp_timer_t* timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/**
+ * 从所在链表中摘除定时器节点
+ */
+static void timer_list_unlink(tftp_timer_t* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/**
+ * 根据到期时间把定时器放入合适的层和槽位
+ *
+ * 说明：
+ * - 距离当前刻度不足256毫秒的放入第0层，按到期时间低8位选槽
+ * - 更远的放入能容纳该距离的最低一层，按对应的8位选槽
+ * - 已经过期的放入当前刻度的槽位，下次推进时立即触发
+ */
+static void timer_wheel_place(tftp_timer_wheel_t* wheel, tftp_timer_t* timer) {
+    ULONGLONG expires = timer->expires;
+    ULONGLONG delta;
+
+    if (expires < wheel->current) {
+        expires = wheel->current;
+    }
+    delta = expires - wheel->current;
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= ((ULONGLONG)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    // 超出最高层范围的定时器先放在最高层最远的槽位，级联时再重新分配
+    if (delta >= ((ULONGLONG)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+        expires = wheel->current + ((ULONGLONG)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    int slot = (int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    timer_list_append(&wheel->slots[level][slot], timer);
+}
+
+/**
+ * 初始化时间轮
+ *
+ * 参数：
+ * - wheel: 时间轮结构
+ * - now: 当前时间（GetTickCount64毫秒）
+ */
+void timer_wheel_init(tftp_timer_wheel_t* wheel, ULONGLONG now) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_list_init(&wheel->slots[level][slot]);
+        }
+    }
+    wheel->current = now;
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+/**
+ * 更新时间轮看到的当前时间（事件循环每轮调用一次）
+ */
+void timer_wheel_set_time(tftp_timer_wheel_t* wheel, ULONGLONG now) {
+    if (now > wheel->now) {
+        wheel->now = now;
+    }
+}
+
+/**
+ * 设置定时器在delay_ms毫秒后到期
+ *
+ * 功能说明：
+ * - 定时器已在轮中时先取消再重新插入，相当于重置截止时间
+ * - 到期时间以最近一次timer_wheel_set_time的时间为基准
+ */
+void timer_wheel_schedule(tftp_timer_wheel_t* wheel, tftp_timer_t* timer, ULONGLONG delay_ms) {
+    timer_wheel_cancel(wheel, timer);
+    timer->expires = wheel->now + delay_ms;
+    timer_wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+/**
+ * 取消定时器（未在轮中时不做任何操作）
+ */
+void timer_wheel_cancel(tftp_timer_wheel_t* wheel, tftp_timer_t* timer) {
+    if (timer->next != NULL) {
+        timer_list_unlink(timer);
+        wheel->count--;
+    }
+}
+
+/**
+ * 把某一层某个槽位的定时器重新分配到更低的层
+ */
+static void timer_wheel_cascade(tftp_timer_wheel_t* wheel, int level, int slot) {
+    tftp_timer_t pending;
+    tftp_timer_t* head = &wheel->slots[level][slot];
+
+    // 先把整条链表转移到临时哨兵，再逐个重新放置
+    timer_list_init(&pending);
+    if (head->next != head) {
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        timer_list_init(head);
+    }
+
+    while (pending.next != &pending) {
+        tftp_timer_t* timer = pending.next;
+        timer_list_unlink(timer);
+        timer_wheel_place(wheel, timer);
+    }
+}
+
+/**
+ * 推进时间轮到当前时间，触发所有到期的定时器
+ *
+ * 参数：
+ * - wheel: 时间轮结构
+ * - on_expire: 到期回调，调用前定时器已从轮中摘除，回调内可以重新设置
+ * - context: 传给回调的上下文
+ */
+void timer_wheel_advance(tftp_timer_wheel_t* wheel,
+                         void (*on_expire)(tftp_timer_t* timer, void* context), void* context) {
+    // 没有定时器时直接跳到当前时间，避免空转
+    if (wheel->count == 0) {
+        wheel->current = wheel->now + 1;
+        return;
+    }
+
+    while (wheel->current <= wheel->now) {
+        int index = (int)(wheel->current & TIMER_WHEEL_MASK);
+
+        // 第0层转完一圈，从上层级联；上层槽位号不为0时无需继续向上
+        if (index == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                int slot = (int)((wheel->current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+                timer_wheel_cascade(wheel, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+
+        tftp_timer_t* head = &wheel->slots[0][index];
+        while (head->next != head) {
+            tftp_timer_t* timer = head->next;
+            timer_list_unlink(timer);
+            wheel->count--;
+            on_expire(timer, context);
+        }
+
+        wheel->current++;
+    }
+}
+
+/**
+ * 计算距离下一个定时器到期还需等待的毫秒数
+ *
+ * 功能说明：
+ * - 只扫描第0层（最多256个槽位），找到非空槽位即返回其距离
+ * - 遇到第0层的一圈边界（槽位0）时返回到边界的距离，届时级联后再计算，
+ *   上层定时器不会因此被推迟
+ * - 结果不超过max_wait_ms，用作WSAPoll的超时参数
+ */
+int timer_wheel_next_timeout(tftp_timer_wheel_t* wheel, int max_wait_ms) {
+    if (wheel->count == 0) {
+        return max_wait_ms;
+    }
+    if (wheel->current <= wheel->now) {
+        return 0;                                        // 有未处理的刻度
+    }
+
+    ULONGLONG tick = wheel->current;
+    for (;;) {
+        int index = (int)(tick & TIMER_WHEEL_MASK);
+        tftp_timer_t* head = &wheel->slots[0][index];
+
+        // 非空槽位，或需要级联的一圈边界
+        if (head->next != head || index == 0) {
+            break;
+        }
+        tick++;
+    }
+
+    ULONGLONG wait = tick - wheel->now;
+    return (wait < (ULONGLONG)max_wait_ms) ? (int)wait : max_wait_ms;
+}
@@ -0,0 +1,159 @@
+#include "../include/tftp.h"
+
+/*
+ * 高精度计时与延迟直方图（两个版本共用）
+ *
+ * 设计思路：
+ * - 传输起止时间和ACK延迟都使用QueryPerformanceCounter换算的单调纳秒时间，
+ *   不受系统时间调整影响，不到一秒的传输也能得到准确的耗时和吞吐量
+ * - 延迟直方图采用HDR（High Dynamic Range）式的对数-线性分桶：
+ *   小于2^HISTOGRAM_SUB_BITS纳秒的值每纳秒一个桶，之后每个2的幂区间再等分为
+ *   HISTOGRAM_SUB_BUCKETS个桶，任意量级的相对误差都不超过1/16（约6%）
+ * - 记录一个样本只是一次分桶计算和一次自增，不分配内存；
+ *   各会话、各引擎的直方图可以直接相加得到全局分布
+ * - 百分位数返回所在桶的上界，不会低估尾延迟
+ */
+
+static LONGLONG timing_frequency = 0;   // QueryPerformanceFrequency（每秒计数），第一次调用时读取
+
+/**
+ * 读取单调时钟
+ *
+ * 返回值：
+ * - 当前时间（纳秒，起点任意，只用于计算时间差）
+ */
+ULONGLONG timing_now_ns(void) {
+    LARGE_INTEGER counter;
+
+    if (timing_frequency == 0) {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        timing_frequency = frequency.QuadPart;
+    }
+    QueryPerformanceCounter(&counter);
+
+    // 先分出整秒再换算余数，避免计数乘以10^9溢出
+    ULONGLONG ticks = (ULONGLONG)counter.QuadPart;
+    ULONGLONG frequency = (ULONGLONG)timing_frequency;
+    return (ticks / frequency) * 1000000000ULL + (ticks % frequency) * 1000000000ULL / frequency;
+}
+
+/**
+ * 最高有效位的位置（value必须大于0）
+ */
+static int histogram_msb(ULONGLONG value) {
+    int msb = 0;
+
+    if (value >> 32) { value >>= 32; msb += 32; }
+    if (value >> 16) { value >>= 16; msb += 16; }
+    if (value >> 8)  { value >>= 8;  msb += 8; }
+    if (value >> 4)  { value >>= 4;  msb += 4; }
+    if (value >> 2)  { value >>= 2;  msb += 2; }
+    if (value >> 1)  { msb += 1; }
+    return msb;
+}
+
+/**
+ * 计算值所在的桶
+ *
+ * 分桶方式：
+ * - 第0组：0到HISTOGRAM_SUB_BUCKETS-1，每个值一个桶
+ * - 第g组（g >= 1）：[2^(g+SUB_BITS-1), 2^(g+SUB_BITS))，等分为HISTOGRAM_SUB_BUCKETS个桶
+ */
+static int histogram_bucket(ULONGLONG value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)) {
+        value = (1ULL << HISTOGRAM_MAX_BITS) - 1;     // 超出范围的样本计入最后一个桶
+    }
+
+    int msb = histogram_msb(value);
+    int group = msb - HISTOGRAM_SUB_BITS + 1;
+    int sub = (int)(value >> (msb - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_BUCKETS;
+    return group * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/**
+ * 桶的上界（桶内的最大值）
+ */
+static ULONGLONG histogram_bucket_value(int bucket) {
+    int group = bucket / HISTOGRAM_SUB_BUCKETS;
+    ULONGLONG sub = (ULONGLONG)(bucket % HISTOGRAM_SUB_BUCKETS);
+
+    if (group == 0) {
+        return sub;
+    }
+    ULONGLONG width = 1ULL << (group - 1);
+    return (HISTOGRAM_SUB_BUCKETS + sub) * width + width - 1;
+}
+
+/**
+ * 记录一个延迟样本
+ *
+ * 参数：
+ * - histogram: 直方图（全零即为空直方图）
+ * - value_ns: 延迟（纳秒）
+ */
+void histogram_record(tftp_histogram_t* histogram, ULONGLONG value_ns) {
+    histogram->counts[histogram_bucket(value_ns)]++;
+    if (histogram->count == 0 || value_ns < histogram->min_ns) {
+        histogram->min_ns = value_ns;
+    }
+    if (value_ns > histogram->max_ns) {
+        histogram->max_ns = value_ns;
+    }
+    histogram->sum_ns += value_ns;
+    histogram->count++;
+}
+
+/**
+ * 把一个直方图累加到另一个（汇总各会话或各引擎的分布）
+ */
+void histogram_merge(tftp_histogram_t* target, const tftp_histogram_t* source) {
+    if (source->count == 0) {
+        return;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        target->counts[i] += source->counts[i];
+    }
+    if (target->count == 0 || source->min_ns < target->min_ns) {
+        target->min_ns = source->min_ns;
+    }
+    if (source->max_ns > target->max_ns) {
+        target->max_ns = source->max_ns;
+    }
+    target->sum_ns += source->sum_ns;
+    target->count += source->count;
+}
+
+/**
+ * 计算百分位数
+ *
+ * 参数：
+ * - histogram: 直方图
+ * - quantile: 分位点（0到1之间，如0.99）
+ *
+ * 返回值：
+ * - 至少quantile比例的样本不超过的值（纳秒，所在桶的上界且不超过最大样本），没有样本时为0
+ */
+ULONGLONG histogram_percentile(const tftp_histogram_t* histogram, double quantile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    ULONGLONG rank = (ULONGLONG)(quantile * (double)histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    ULONGLONG seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            ULONGLONG value = histogram_bucket_value(i);
+            return (value < histogram->max_ns) ? value : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
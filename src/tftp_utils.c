@@ -1,8 +1,28 @@
 #include "../include/tftp.h"
+#include <io.h>
 
 // 全局变量：日志文件指针，用于记录服务器运行日志
 static FILE* log_file = NULL;
 
+// 日志转发目标：多线程版本把共用函数中的log_message转入异步日志（NULL表示直接写文件）
+static void (*log_redirect)(const char* level, const char* message, va_list args) = NULL;
+
+// 全进程热路径日志令牌桶：所有会话共用，多个工作线程通过原子操作更新
+static volatile LONG global_log_tokens = LOG_GLOBAL_BURST;
+static volatile LONG global_log_refill = 0;     // 上次补充令牌的时间（GetTickCount）
+static volatile LONG global_log_suppressed = 0; // 上次输出摘要以来被全局限速抑制的条数
+static volatile LONG total_log_suppressed = 0;  // 累计被抑制的热路径日志条数
+
+// 所有传输累计的ACK延迟分布（print_throughput汇总，单线程版本使用）
+static tftp_histogram_t all_ack_latency;
+
+// 热路径日志事件类别名称（与tftp_log_event_t对应）
+static const char* const log_event_names[LOG_EVENT_COUNT] = {
+    "retransmission",
+    "duplicate packet",
+    "invalid packet"
+};
+
 /**
  * 初始化Windows Socket库
  * 
@@ -98,6 +118,7 @@ int create_tftp_socket(void) {
  * - 同时输出到控制台和日志文件
  * - 自动添加时间戳和日志级别
  * - 如果日志文件不存在会自动创建
+ * - 设置了转发目标时（多线程版本）改由转发目标处理
  * 
  * 参数：
  * - level: 日志级别（如"INFO", "ERROR", "DEBUG"等）
@@ -105,6 +126,16 @@ int create_tftp_socket(void) {
  * - ...: 可变参数列表
  */
 void log_message(const char* level, const char* message, ...) {
+    va_list args;
+    
+    // 多线程版本：交给异步日志，按级别过滤后写入其日志文件
+    if (log_redirect != NULL) {
+        va_start(args, message);
+        log_redirect(level, message, args);
+        va_end(args);
+        return;
+    }
+    
     // 如果日志文件还未打开，则以追加模式打开
     if (log_file == NULL) {
         log_file = fopen("logs/tftp_server.log", "a");
@@ -121,22 +152,172 @@ void log_message(const char* level, const char* message, ...) {
     // 格式化时间字符串：YYYY-MM-DD HH:MM:SS
     strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
 
-    // 处理可变参数列表
-    va_list args;
+    // 处理可变参数列表：只格式化一次（va_list不能重复使用）
+    char text[512];
     va_start(args, message);
+    vsnprintf(text, sizeof(text), message, args);
+    va_end(args);                        // 清理可变参数列表
     
     // 输出到控制台（带时间戳和级别）
-    printf("[%s] [%s] ", time_str, level);
-    vprintf(message, args);      // 使用vprintf处理可变参数
-    printf("\n");
+    printf("[%s] [%s] %s\n", time_str, level, text);
     
     // 输出到日志文件（格式相同）
-    fprintf(log_file, "[%s] [%s] ", time_str, level);
-    vfprintf(log_file, message, args);   // 使用vfprintf处理可变参数
-    fprintf(log_file, "\n");
+    fprintf(log_file, "[%s] [%s] %s\n", time_str, level, text);
     fflush(log_file);                    // 立即刷新缓冲区，确保日志及时写入
-    
-    va_end(args);                        // 清理可变参数列表
+}
+
+/**
+ * 设置log_message的转发目标
+ * 
+ * 参数：
+ * - redirect: 接收级别、格式化字符串和参数列表的函数（NULL表示恢复直接写文件）
+ */
+void log_set_redirect(void (*redirect)(const char* level, const char* message, va_list args)) {
+    log_redirect = redirect;
+}
+
+/**
+ * 从会话（或监听套接字）的某类令牌桶中取一个令牌，只由拥有它的线程调用
+ *
+ * 返回值：
+ * - 1：允许输出
+ * - 0：令牌已用完
+ */
+static int log_limiter_take(tftp_log_limiter_t* limiter) {
+    DWORD now = GetTickCount();
+    DWORD elapsed = now - limiter->refill_time;
+
+    if (limiter->refill_time == 0 || elapsed >= (DWORD)(LOG_EVENT_BURST * 1000 / LOG_EVENT_RATE)) {
+        // 第一次使用或空闲了足够久：令牌桶装满
+        limiter->tokens = LOG_EVENT_BURST;
+        limiter->refill_time = now;
+    } else if (elapsed >= 1000 / LOG_EVENT_RATE) {
+        int added = (int)(elapsed * LOG_EVENT_RATE / 1000);
+        limiter->tokens = (limiter->tokens + added > LOG_EVENT_BURST) ? LOG_EVENT_BURST : limiter->tokens + added;
+        limiter->refill_time += (DWORD)(added * 1000 / LOG_EVENT_RATE);  // 保留不足一个令牌的时间
+    }
+
+    if (limiter->tokens == 0) {
+        return 0;
+    }
+    limiter->tokens--;
+    return 1;
+}
+
+/**
+ * 从全进程令牌桶中取一个令牌（多个线程并发调用）
+ *
+ * 功能说明：
+ * - 只有把补充时间向前推进成功的线程负责补充这段时间的令牌，其他线程直接取令牌
+ * - 令牌数的上限在并发下是近似的，只用于限制日志量
+ *
+ * 返回值：
+ * - 1：允许输出
+ * - 0：令牌已用完
+ */
+static int log_global_take(void) {
+    LONG last = global_log_refill;
+    LONG now = (LONG)GetTickCount();
+    DWORD elapsed = (DWORD)now - (DWORD)last;
+
+    if (elapsed >= 1000 / LOG_GLOBAL_RATE) {
+        LONG added = (elapsed >= (DWORD)(LOG_GLOBAL_BURST * 1000 / LOG_GLOBAL_RATE))
+                   ? LOG_GLOBAL_BURST : (LONG)(elapsed * LOG_GLOBAL_RATE / 1000);
+        if (InterlockedCompareExchange(&global_log_refill, now, last) == last) {
+            LONG tokens = InterlockedExchangeAdd(&global_log_tokens, added) + added;
+            if (tokens > LOG_GLOBAL_BURST) {
+                InterlockedExchangeAdd(&global_log_tokens, LOG_GLOBAL_BURST - tokens);
+            }
+        }
+    }
+
+    if (InterlockedDecrement(&global_log_tokens) < 0) {
+        InterlockedIncrement(&global_log_tokens);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * 记录限速的热路径日志（重传、重复数据包、无效数据包等）
+ *
+ * 功能说明：
+ * - 先按会话的该类事件令牌桶限速，再按全进程令牌桶限速，
+ *   异常客户端或丢包严重的链路无论产生多少事件，日志量都有上限
+ * - 被会话限速抑制的条数附在该类事件下一条输出的日志后面："(N similar events suppressed)"
+ * - 被全局限速抑制的条数在下一条通过的热路径日志之前单独汇总输出
+ * - 日志内容只在允许输出时才格式化
+ *
+ * 参数：
+ * - limits: 会话（或监听套接字）的按类别令牌桶数组，长度为LOG_EVENT_COUNT
+ * - event: 事件类别
+ * - level: 日志级别
+ * - message: 格式化字符串
+ * - ...: 可变参数列表
+ */
+void log_message_limited(tftp_log_limiter_t* limits, tftp_log_event_t event,
+                         const char* level, const char* message, ...) {
+    tftp_log_limiter_t* limiter = &limits[event];
+
+    if (!log_limiter_take(limiter)) {
+        limiter->suppressed++;
+        InterlockedIncrement(&total_log_suppressed);
+        return;
+    }
+    if (!log_global_take()) {
+        InterlockedIncrement(&global_log_suppressed);
+        InterlockedIncrement(&total_log_suppressed);
+        return;
+    }
+
+    LONG global_suppressed = InterlockedExchange(&global_log_suppressed, 0);
+    if (global_suppressed > 0) {
+        log_message("WARNING", "%ld log events suppressed by the global rate limit", (long)global_suppressed);
+    }
+
+    char text[400];
+    va_list args;
+    va_start(args, message);
+    vsnprintf(text, sizeof(text), message, args);
+    va_end(args);
+
+    if (limiter->suppressed > 0) {
+        log_message(level, "%s (%d similar events suppressed)", text, limiter->suppressed);
+        limiter->suppressed = 0;
+    } else {
+        log_message(level, "%s", text);
+    }
+}
+
+/**
+ * 输出会话结束时仍未报告的被抑制日志条数（每类事件一条摘要）
+ *
+ * 参数：
+ * - limits: 按类别令牌桶数组，长度为LOG_EVENT_COUNT
+ * - client_addr: 客户端地址（NULL表示监听套接字）
+ */
+void log_limits_report(tftp_log_limiter_t* limits, const struct sockaddr_in* client_addr) {
+    for (int i = 0; i < LOG_EVENT_COUNT; i++) {
+        if (limits[i].suppressed == 0) {
+            continue;
+        }
+        if (client_addr != NULL) {
+            log_message("INFO", "Client %s:%d: %d similar %s events suppressed",
+                       inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port),
+                       limits[i].suppressed, log_event_names[i]);
+        } else {
+            log_message("INFO", "Listener: %d similar %s events suppressed",
+                       limits[i].suppressed, log_event_names[i]);
+        }
+        limits[i].suppressed = 0;
+    }
+}
+
+/**
+ * 累计被限速抑制的热路径日志条数（会话限速和全局限速之和）
+ */
+unsigned long log_suppressed_count(void) {
+    return (unsigned long)total_log_suppressed;
 }
 
 /**
@@ -344,32 +525,231 @@ int send_data_packet(SOCKET sock, struct sockaddr_in* client_addr,
     return 0;
 }
 
+/**
+ * 在数据包缓冲区的前4字节填写DATA包头部（操作码和块号）
+ */
+void write_data_header(char* packet, unsigned short block_num) {
+    unsigned short opcode = htons(TFTP_DATA);
+    unsigned short block = htons(block_num);
+    
+    memcpy(packet, &opcode, 2);                          // 填写操作码
+    memcpy(packet + 2, &block, 2);                       // 填写块号
+}
+
+/**
+ * 原地发送TFTP数据包（不复制数据）
+ * 
+ * 功能说明：
+ * - packet缓冲区前4字节预留给头部，数据紧随其后存放
+ * - 在缓冲区中直接填写操作码和块号后整体发送
+ * - 用于协商了blksize的大数据块，避免再复制到固定大小的栈缓冲区
+ * 
+ * 参数：
+ * - sock: 发送套接字
+ * - client_addr: 客户端地址结构
+ * - block_num: 数据块号
+ * - packet: 长度至少为TFTP_HEADER_SIZE + data_len的缓冲区
+ * - data_len: 数据长度（0到协商的blksize）
+ * 
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+int send_data_block(SOCKET sock, struct sockaddr_in* client_addr, 
+                   unsigned short block_num, char* packet, int data_len) {
+    write_data_header(packet, block_num);
+    
+    int result = sendto(sock, packet, TFTP_HEADER_SIZE + data_len, 0, 
+                       (struct sockaddr*)client_addr, sizeof(*client_addr));
+    
+    if (result == SOCKET_ERROR) {
+        log_message("ERROR", "Failed to send data packet: %d", WSAGetLastError());
+        return -1;
+    }
+
+    log_message("DEBUG", "Sent data packet, block number: %d, size: %d bytes", block_num, data_len);
+    return 0;
+}
+
+/**
+ * 根据客户端请求的选项确定服务器接受的选项值
+ * 
+ * 功能说明：
+ * - blksize上传下载均可协商，取客户端请求值与MAX_BLOCK_SIZE中的较小者
+ * - windowsize仅用于下载，取客户端请求值与MAX_WINDOW_SIZE中的较小者，
+ *   并限制窗口缓冲区（blksize × windowsize）不超过MAX_WINDOW_BYTES
+ * - 上传时不确认windowsize，客户端按RFC 7440回退到逐块确认
+ * - timeout（RFC 2349）原样接受，接受后该传输使用固定超时，不做RTT自适应
+ * - multicast（RFC 2090）不在这里确认，由多线程版本的引擎为组播下载填写组地址
+ * - tsize（RFC 2349）上传时回显客户端声明的大小；下载时调用者把tsize_value改为文件大小，
+ *   无法确定大小时撤销该选项
+ * 
+ * 参数：
+ * - requested: 客户端请求的选项
+ * - is_upload: 是否为写请求
+ * - accepted: 服务器接受的选项（未接受的选项置0）
+ * 
+ * 返回值：
+ * - 接受的选项个数，为0时无需发送OACK
+ */
+int negotiate_options(const tftp_options_t* requested, int is_upload, tftp_options_t* accepted) {
+    int count = 0;
+    memset(accepted, 0, sizeof(*accepted));
+    
+    if (requested->blksize > 0) {
+        accepted->blksize = (requested->blksize < MAX_BLOCK_SIZE) ? 
+                            requested->blksize : MAX_BLOCK_SIZE;
+        count++;
+    }
+    
+    if (requested->windowsize > 0 && !is_upload) {
+        int block_size = (accepted->blksize > 0) ? accepted->blksize : DATA_SIZE;
+        int max_window = MAX_WINDOW_BYTES / block_size;
+        if (max_window > MAX_WINDOW_SIZE) {
+            max_window = MAX_WINDOW_SIZE;
+        }
+        if (max_window < 1) {
+            max_window = 1;
+        }
+        accepted->windowsize = (requested->windowsize < max_window) ? 
+                               requested->windowsize : max_window;
+        count++;
+    }
+    
+    // timeout选项不能修改，接受时原样回显，双方都按该值重传
+    if (requested->timeout > 0) {
+        accepted->timeout = requested->timeout;
+        count++;
+    }
+    
+    if (requested->tsize) {
+        accepted->tsize = 1;
+        accepted->tsize_value = requested->tsize_value;
+        count++;
+    }
+    
+    return count;
+}
+
+/**
+ * 发送TFTP选项确认（OACK）包给客户端
+ * 
+ * TFTP OACK包格式：
+ * |操作码(2字节)|选项名|0|选项值|0|...|
+ * 
+ * 参数：
+ * - sock: 发送套接字
+ * - client_addr: 客户端地址结构
+ * - options: 服务器接受的选项（值为0的选项不写入，tsize按tsize标志写入）
+ * 
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+int send_oack_packet(SOCKET sock, struct sockaddr_in* client_addr, 
+                    const tftp_options_t* options) {
+    char buffer[OPTION_BUFFER_SIZE];
+    unsigned short opcode = htons(TFTP_OACK);
+    int packet_size = 2;
+    
+    memcpy(buffer, &opcode, 2);                          // 复制操作码
+    
+    if (options->blksize > 0) {
+        packet_size += snprintf(buffer + packet_size, sizeof(buffer) - packet_size, 
+                                "blksize%c%d", '\0', options->blksize) + 1;
+    }
+    if (options->windowsize > 0) {
+        packet_size += snprintf(buffer + packet_size, sizeof(buffer) - packet_size, 
+                                "windowsize%c%d", '\0', options->windowsize) + 1;
+    }
+    if (options->timeout > 0) {
+        packet_size += snprintf(buffer + packet_size, sizeof(buffer) - packet_size, 
+                                "timeout%c%d", '\0', options->timeout) + 1;
+    }
+    if (options->multicast_value[0] != '\0') {
+        packet_size += snprintf(buffer + packet_size, sizeof(buffer) - packet_size, 
+                                "multicast%c%s", '\0', options->multicast_value) + 1;
+    }
+    if (options->tsize) {
+        packet_size += snprintf(buffer + packet_size, sizeof(buffer) - packet_size, 
+                                "tsize%c%llu", '\0', options->tsize_value) + 1;
+    }
+    
+    int result = sendto(sock, buffer, packet_size, 0, 
+                       (struct sockaddr*)client_addr, sizeof(*client_addr));
+    
+    if (result == SOCKET_ERROR) {
+        log_message("ERROR", "Failed to send OACK packet: %d", WSAGetLastError());
+        return -1;
+    }
+
+    log_message("DEBUG", "Sent OACK packet, blksize: %d, windowsize: %d, timeout: %d", 
+               options->blksize, options->windowsize, options->timeout);
+    return 0;
+}
+
+/**
+ * 检查磁盘剩余空间能否容纳客户端声明的上传大小（WRQ的tsize选项）
+ * 
+ * 返回值：
+ * - 1：能容纳，或无法查询剩余空间（按原有方式接收，写满时再报错）
+ * - 0：剩余空间不足，应在创建文件前拒绝上传
+ */
+int upload_space_available(ULONGLONG size) {
+    ULARGE_INTEGER available;
+    
+    if (!GetDiskFreeSpaceExA("tftp_root/", &available, NULL, NULL)) {
+        return 1;
+    }
+    return size <= available.QuadPart;
+}
+
+/**
+ * 按客户端声明的上传大小为文件预先分配磁盘空间
+ * 
+ * 功能说明：
+ * - 只设置分配大小，不改变文件长度；顺序写入时不再逐次扩展文件，碎片也更少
+ * - netascii解码后的文件比声明的大小短，未用完的预分配空间在关闭文件时释放
+ * - 文件系统不支持时忽略，不影响上传
+ */
+void reserve_file_space(FILE* file, ULONGLONG size) {
+    FILE_ALLOCATION_INFO allocation;
+    
+    allocation.AllocationSize.QuadPart = (LONGLONG)size;
+    if (!SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(file)), FileAllocationInfo,
+                                    &allocation, sizeof(allocation))) {
+        log_message("DEBUG", "Failed to preallocate %llu bytes: %lu", size, GetLastError());
+    }
+}
+
 /**
  * 计算并显示文件传输吞吐量统计信息
  * 
  * 功能说明：
- * - 计算文件传输的总耗时
+ * - 按纳秒时间戳计算文件传输的总耗时，不到一秒的传输也能得到吞吐量
  * - 计算平均传输速度（字节/秒）
  * - 显示重传次数（如果有）
+ * - 显示本次传输的ACK延迟百分位数，并累计到进程级直方图后显示所有传输的百分位数
  * - 输出详细的传输统计报告
  * 
  * 参数：
  * - stats: 传输统计信息结构指针，包含：
  *   - bytes_transferred: 总传输字节数
- *   - start_time: 传输开始时间
- *   - end_time: 传输结束时间
+ *   - start_ns: 传输开始时间（纳秒）
+ *   - end_ns: 传输结束时间（纳秒）
  *   - retransmissions: 重传次数
+ *   - ack_latency: ACK延迟直方图
  */
 void print_throughput(tftp_stats_t* stats) {
     // 计算传输总耗时（秒）
-    double duration = difftime(stats->end_time, stats->start_time);
+    double duration = (stats->end_ns > stats->start_ns) ? (double)(stats->end_ns - stats->start_ns) / 1e9 : 0;
     
     if (duration > 0) {
         // 计算平均吞吐量（字节/秒）
         double throughput = (double)stats->bytes_transferred / duration;
         
         // 输出传输统计信息
-        log_message("INFO", "Transfer statistics: %zu bytes, duration: %.2f seconds, throughput: %.2f bytes/second", 
+        log_message("INFO", "Transfer statistics: %zu bytes, duration: %.3f seconds, throughput: %.2f bytes/second", 
                    stats->bytes_transferred, duration, throughput);
         
         // 如果有重传，单独显示重传次数
@@ -377,4 +757,107 @@ void print_throughput(tftp_stats_t* stats) {
             log_message("INFO", "Retransmissions: %d", stats->retransmissions);
         }
     }
-}
\ No newline at end of file
+    
+    if (stats->rtt_samples > 0) {
+        log_message("INFO", "RTT: samples %d, min %d ms, max %d ms, smoothed %d ms",
+                   stats->rtt_samples, stats->rtt_min_ms, stats->rtt_max_ms, stats->srtt_ms);
+    }
+    
+    if (stats->ack_latency.count > 0) {
+        const tftp_histogram_t* latency = &stats->ack_latency;
+        log_message("INFO", "ACK latency: samples %llu, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms",
+                   latency->count, histogram_percentile(latency, 0.50) / 1e6,
+                   histogram_percentile(latency, 0.99) / 1e6, histogram_percentile(latency, 0.999) / 1e6,
+                   latency->max_ns / 1e6);
+        
+        // 单线程版本逐个处理传输，进程级直方图不需要加锁
+        histogram_merge(&all_ack_latency, latency);
+        log_message("INFO", "ACK latency (all transfers): samples %llu, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms",
+                   all_ack_latency.count, histogram_percentile(&all_ack_latency, 0.50) / 1e6,
+                   histogram_percentile(&all_ack_latency, 0.99) / 1e6,
+                   histogram_percentile(&all_ack_latency, 0.999) / 1e6);
+    }
+}
+/**
+ * 初始化RTT估计器
+ * 
+ * 参数：
+ * - rtt: RTT估计器
+ * - timeout_option: 协商的timeout选项（秒），为0时使用自适应超时
+ */
+void rtt_init(tftp_rtt_t* rtt, int timeout_option) {
+    memset(rtt, 0, sizeof(*rtt));
+    if (timeout_option > 0) {
+        rtt->rto = timeout_option * 1000;
+        rtt->fixed = 1;
+    } else {
+        rtt->rto = RTO_INITIAL_MS;
+    }
+}
+
+/**
+ * 用一个RTT样本更新估计值并重新计算重传超时
+ * 
+ * 功能说明：
+ * - Jacobson/Karels算法：SRTT += (R - SRTT) / 8，RTTVAR += (|R - SRTT| - RTTVAR) / 4，
+ *   RTO = SRTT + 4 × RTTVAR，并限制在[RTO_MIN_MS, RTO_MAX_MS]之间
+ * - 调用者须遵循Karn算法：重传过的包不产生样本
+ * - 新样本同时清除此前的指数退避
+ * - 使用固定timeout选项时只记录统计，不修改超时
+ * 
+ * 参数：
+ * - rtt: RTT估计器
+ * - stats: 传输统计（记录样本数和最小/最大/平滑RTT）
+ * - sample_ms: 测得的往返时间（毫秒）
+ */
+void rtt_update(tftp_rtt_t* rtt, tftp_stats_t* stats, int sample_ms) {
+    if (sample_ms < 0) {
+        sample_ms = 0;
+    }
+    
+    if (rtt->srtt == 0) {
+        // 第一个样本：SRTT = R，RTTVAR = R / 2
+        rtt->srtt = sample_ms << 3;
+        rtt->rttvar = sample_ms << 1;
+    } else {
+        int delta = sample_ms - (rtt->srtt >> 3);
+        rtt->srtt += delta;                              // srtt以8倍定点保存，相当于增加delta/8
+        if (delta < 0) {
+            delta = -delta;
+        }
+        rtt->rttvar += delta - (rtt->rttvar >> 2);       // rttvar以4倍定点保存
+    }
+    if (rtt->srtt == 0) {
+        rtt->srtt = 1;                                   // 保持"已有样本"状态
+    }
+    
+    if (!rtt->fixed) {
+        int rto = (rtt->srtt >> 3) + rtt->rttvar;
+        if (rto < RTO_MIN_MS) {
+            rto = RTO_MIN_MS;
+        } else if (rto > RTO_MAX_MS) {
+            rto = RTO_MAX_MS;
+        }
+        rtt->rto = rto;
+    }
+    
+    if (stats->rtt_samples == 0 || sample_ms < stats->rtt_min_ms) {
+        stats->rtt_min_ms = sample_ms;
+    }
+    if (sample_ms > stats->rtt_max_ms) {
+        stats->rtt_max_ms = sample_ms;
+    }
+    stats->rtt_samples++;
+    stats->srtt_ms = rtt->srtt >> 3;
+}
+
+/**
+ * 超时后对重传超时做指数退避（翻倍，不超过RTO_MAX_MS）
+ * 使用固定timeout选项时不退避
+ */
+void rtt_backoff(tftp_rtt_t* rtt) {
+    if (rtt->fixed) {
+        return;
+    }
+    rtt->rto = (rtt->rto < RTO_MAX_MS / 2) ? rtt->rto * 2 : RTO_MAX_MS;
+}
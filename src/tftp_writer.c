@@ -0,0 +1,390 @@
+#include "../include/tftp.h"
+#include <process.h>
+
+/*
+ * 上传写后台化（write-behind，事件驱动引擎使用）
+ *
+ * 设计思路：
+ * - 上传会话收到DATA后只把数据复制进自己的写缓冲环并立即回复ACK，
+ *   磁盘写入延迟不再出现在每个块的关键路径上
+ * - 进程中一个专用I/O线程负责所有写缓冲环：相邻槽位在内存中首尾相接，
+ *   除最后一块外每块都是满块，因此一段连续槽位就是文件中的一段连续数据，
+ *   合并为一次fwrite顺序写入（文件设为无缓冲，不再经过stdio缓冲区复制）
+ * - 写缓冲环满时事件循环暂停读取该会话的套接字，数据报留在内核接收缓冲区，
+ *   客户端在等待ACK时自然降速（背压）
+ * - 长度不定的数据（netascii解码后的块）按字节追加：先填满tail处的槽位，
+ *   满一个槽位才入队，同样只有最后一个槽位不满，照样合并写入
+ * - 最后一块入队后会话等待I/O线程写完并关闭文件，确认写入成功后才发送最终ACK；
+ *   写入失败时向客户端回复磁盘错误
+ * - 写缓冲环的索引和状态由一个锁保护，槽位数据在入队前由事件循环独占、
+ *   入队后到写完前由I/O线程独占，复制数据时不持有锁
+ */
+
+typedef struct {
+    CRITICAL_SECTION lock;              // 保护所有写缓冲环的索引、状态和待处理链表
+    CONDITION_VARIABLE work_ready;      // 有写缓冲环待处理或需要退出
+    tftp_write_ring_t* pending_head;    // 待处理链表头
+    tftp_write_ring_t* pending_tail;    // 待处理链表尾
+    HANDLE thread;                      // I/O线程句柄
+    int stopping;                       // 通知I/O线程退出
+    int initialized;                    // 是否已初始化
+} tftp_write_behind_t;
+
+static tftp_write_behind_t write_behind;
+
+/**
+ * 把写缓冲环加入I/O线程的待处理链表（调用时持有锁）
+ */
+static void write_behind_enqueue(tftp_write_ring_t* ring) {
+    if (ring->pending) {
+        return;
+    }
+    ring->pending = 1;
+    ring->next_pending = NULL;
+    if (write_behind.pending_tail != NULL) {
+        write_behind.pending_tail->next_pending = ring;
+    } else {
+        write_behind.pending_head = ring;
+    }
+    write_behind.pending_tail = ring;
+    WakeConditionVariable(&write_behind.work_ready);
+}
+
+/**
+ * 释放写缓冲环的内存
+ *
+ * 说明：
+ * - 可能在I/O线程中调用，内存直接放回缓冲池的进程级仓库
+ */
+static void write_ring_free(tftp_write_ring_t* ring) {
+    pool_free(NULL, ring->buffer);
+    pool_free(NULL, ring->lengths);
+    pool_free(NULL, ring);
+}
+
+/**
+ * 把写缓冲环中[head, tail)的数据写入文件（不持有锁时调用）
+ *
+ * 功能说明：
+ * - 槽位在环中连续的部分合并为一次fwrite，环回绕处拆成两次
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1
+ */
+static int write_ring_drain(tftp_write_ring_t* ring, unsigned long head, unsigned long tail) {
+    while (head != tail) {
+        int first = (int)(head % (unsigned long)ring->slots);
+        int count = 0;
+        size_t bytes = 0;
+
+        // 合并到环末尾或遇到不满的块（只可能是最后一块）为止
+        while (head + (unsigned long)count != tail && first + count < ring->slots) {
+            bytes += (size_t)ring->lengths[first + count];
+            count++;
+            if (ring->lengths[first + count - 1] < ring->slot_size) {
+                break;
+            }
+        }
+
+        if (bytes > 0 &&
+            fwrite(ring->buffer + (size_t)first * ring->slot_size, 1, bytes, ring->file) != bytes) {
+            return -1;
+        }
+        head += (unsigned long)count;
+    }
+    return 0;
+}
+
+/**
+ * I/O线程：依次处理待处理链表中的写缓冲环
+ */
+static unsigned __stdcall write_behind_thread(void* param) {
+    (void)param;
+
+    EnterCriticalSection(&write_behind.lock);
+    while (!write_behind.stopping || write_behind.pending_head != NULL) {
+        tftp_write_ring_t* ring = write_behind.pending_head;
+        if (ring == NULL) {
+            SleepConditionVariableCS(&write_behind.work_ready, &write_behind.lock, INFINITE);
+            continue;
+        }
+        write_behind.pending_head = ring->next_pending;
+        if (write_behind.pending_head == NULL) {
+            write_behind.pending_tail = NULL;
+        }
+        ring->pending = 0;
+
+        unsigned long head = ring->head;
+        unsigned long tail = ring->tail;
+        int skip = ring->error || (ring->released && ring->remove_file);
+        LeaveCriticalSection(&write_behind.lock);
+
+        // 写盘期间不持有锁，事件循环可以继续向环中追加数据
+        int result = (skip || ring->file == NULL) ? 0 : write_ring_drain(ring, head, tail);
+
+        EnterCriticalSection(&write_behind.lock);
+        if (result < 0) {
+            thread_safe_log("ERROR", "Failed to write data to file: %s", ring->path);
+            ring->error = 1;
+        }
+        ring->head = tail;
+
+        // 没有新数据且不会再有新数据时关闭文件
+        if (ring->head == ring->tail && (ring->closing || ring->released || ring->error) && ring->file != NULL) {
+            if (fclose(ring->file) != 0 && !skip) {
+                thread_safe_log("ERROR", "Failed to close file: %s", ring->path);
+                ring->error = 1;
+            }
+            ring->file = NULL;
+            ring->finished = 1;
+        }
+
+        if (ring->released && ring->file == NULL) {
+            if (ring->pending) {
+                continue;                                // 写盘期间会话放弃了该环，已重新入队，由那一轮释放
+            }
+            if (ring->remove_file) {
+                remove(ring->path);
+                thread_safe_log("INFO", "Deleted incomplete file: %s", ring->path);
+            }
+            write_ring_free(ring);
+        } else if (ring->head != ring->tail) {
+            write_behind_enqueue(ring);                  // 写盘期间又有新数据
+        }
+    }
+    LeaveCriticalSection(&write_behind.lock);
+    return 0;
+}
+
+/**
+ * 启动写后台化I/O线程
+ *
+ * 返回值：
+ * - 成功：0
+ * - 失败：-1（引擎回退为在事件循环中直接fwrite）
+ */
+int write_behind_init(void) {
+    memset(&write_behind, 0, sizeof(write_behind));
+    InitializeCriticalSection(&write_behind.lock);
+    InitializeConditionVariable(&write_behind.work_ready);
+
+    write_behind.thread = (HANDLE)_beginthreadex(NULL, 0, write_behind_thread, NULL, 0, NULL);
+    if (write_behind.thread == 0) {
+        DeleteCriticalSection(&write_behind.lock);
+        return -1;
+    }
+    write_behind.initialized = 1;
+    return 0;
+}
+
+/**
+ * 写完所有待处理数据后停止I/O线程
+ */
+void write_behind_cleanup(void) {
+    if (!write_behind.initialized) {
+        return;
+    }
+
+    EnterCriticalSection(&write_behind.lock);
+    write_behind.stopping = 1;
+    WakeConditionVariable(&write_behind.work_ready);
+    LeaveCriticalSection(&write_behind.lock);
+
+    WaitForSingleObject(write_behind.thread, INFINITE);
+    CloseHandle(write_behind.thread);
+    DeleteCriticalSection(&write_behind.lock);
+    write_behind.initialized = 0;
+}
+
+/**
+ * 为上传会话创建写缓冲环，文件的写入和关闭从此交给I/O线程
+ *
+ * 参数：
+ * - cache: 调用线程（引擎）的分配缓存
+ * - file: 已打开的目标文件
+ * - path: 文件路径
+ * - block_size: 协商的块大小
+ *
+ * 返回值：
+ * - 成功：写缓冲环
+ * - 失败：NULL（I/O线程未启动或内存不足，调用者继续直接fwrite）
+ */
+tftp_write_ring_t* write_ring_create(tftp_pool_cache_t* cache, FILE* file, const char* path, int block_size) {
+    if (!write_behind.initialized) {
+        return NULL;
+    }
+
+    int slots = WRITE_RING_BYTES / block_size;
+    if (slots < WRITE_RING_MIN_SLOTS) {
+        slots = WRITE_RING_MIN_SLOTS;
+    }
+    if (slots > WRITE_RING_MAX_SLOTS) {
+        slots = WRITE_RING_MAX_SLOTS;
+    }
+
+    tftp_write_ring_t* ring = (tftp_write_ring_t*)pool_calloc(cache, sizeof(tftp_write_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->buffer = (char*)pool_alloc(cache, (size_t)slots * (size_t)block_size);
+    ring->lengths = (int*)pool_alloc(cache, (size_t)slots * sizeof(int));
+    if (ring->buffer == NULL || ring->lengths == NULL) {
+        write_ring_free(ring);
+        return NULL;
+    }
+
+    // 写入已在I/O线程中合并为大块，不再需要stdio缓冲
+    setvbuf(file, NULL, _IONBF, 0);
+    ring->file = file;
+    strncpy(ring->path, path, sizeof(ring->path) - 1);
+    ring->slot_size = block_size;
+    ring->slots = slots;
+    return ring;
+}
+
+/**
+ * 写缓冲环是否已满（满时事件循环暂停读取该会话的套接字）
+ */
+int write_ring_full(tftp_write_ring_t* ring) {
+    EnterCriticalSection(&write_behind.lock);
+    int full = (ring->tail - ring->head + (ring->fill > 0 ? 1 : 0) >= (unsigned long)ring->slots);
+    LeaveCriticalSection(&write_behind.lock);
+    return full;
+}
+
+/**
+ * 把一个数据块追加到写缓冲环并通知I/O线程
+ *
+ * 参数：
+ * - ring: 写缓冲环
+ * - data: 数据块内容
+ * - length: 数据块长度（不超过块大小）
+ *
+ * 返回值：
+ * - 成功：0（数据已安全入队，可以确认该块）
+ * - 失败：-1（环已满或之前的写入已失败）
+ */
+int write_ring_push(tftp_write_ring_t* ring, const char* data, int length) {
+    EnterCriticalSection(&write_behind.lock);
+    unsigned long tail = ring->tail;
+    int available = !ring->error && (tail - ring->head < (unsigned long)ring->slots);
+    LeaveCriticalSection(&write_behind.lock);
+    if (!available) {
+        return -1;
+    }
+
+    // tail处的槽位在入队前只有事件循环访问
+    int slot = (int)(tail % (unsigned long)ring->slots);
+    memcpy(ring->buffer + (size_t)slot * ring->slot_size, data, (size_t)length);
+    ring->lengths[slot] = length;
+
+    EnterCriticalSection(&write_behind.lock);
+    ring->tail = tail + 1;
+    write_behind_enqueue(ring);
+    LeaveCriticalSection(&write_behind.lock);
+    return 0;
+}
+
+/**
+ * 按字节追加数据（长度不定的数据块，如netascii解码后的块）
+ *
+ * 功能说明：
+ * - 数据接在tail处槽位已有的字节之后，填满的槽位入队，不满的部分留在tail处槽位，
+ *   等后续数据填满或write_ring_close时入队
+ * - 放得下全部数据时才复制，放不下时不修改写缓冲环，调用者可以丢弃该块等客户端重传
+ *
+ * 参数：
+ * - ring: 写缓冲环
+ * - data: 数据
+ * - length: 数据长度（可以超过块大小）
+ *
+ * 返回值：
+ * - 成功：0（数据已安全入队或暂存，可以确认该块）
+ * - 失败：-1（环已满或之前的写入已失败）
+ */
+int write_ring_append(tftp_write_ring_t* ring, const char* data, int length) {
+    int total = ring->fill + length;
+    unsigned long needed = (unsigned long)(total / ring->slot_size) + (total % ring->slot_size > 0 ? 1 : 0);
+
+    EnterCriticalSection(&write_behind.lock);
+    unsigned long tail = ring->tail;
+    int available = !ring->error && (tail - ring->head + needed <= (unsigned long)ring->slots);
+    LeaveCriticalSection(&write_behind.lock);
+    if (!available) {
+        return -1;
+    }
+
+    // tail之后的槽位在入队前只有事件循环访问
+    unsigned long filled = 0;
+    while (length > 0) {
+        int slot = (int)((tail + filled) % (unsigned long)ring->slots);
+        int copy = ring->slot_size - ring->fill;
+        if (copy > length) {
+            copy = length;
+        }
+        memcpy(ring->buffer + (size_t)slot * ring->slot_size + ring->fill, data, (size_t)copy);
+        data += copy;
+        length -= copy;
+        ring->fill += copy;
+        if (ring->fill == ring->slot_size) {
+            ring->lengths[slot] = ring->slot_size;
+            ring->fill = 0;
+            filled++;
+        }
+    }
+
+    if (filled > 0) {
+        EnterCriticalSection(&write_behind.lock);
+        ring->tail = tail + filled;
+        write_behind_enqueue(ring);
+        LeaveCriticalSection(&write_behind.lock);
+    }
+    return 0;
+}
+
+/**
+ * 标记最后一块已入队：I/O线程写完剩余数据后关闭文件
+ * 按字节追加留在tail处槽位的不满部分在这里入队（追加时已预留该槽位）
+ */
+void write_ring_close(tftp_write_ring_t* ring) {
+    EnterCriticalSection(&write_behind.lock);
+    if (ring->fill > 0) {
+        ring->lengths[ring->tail % (unsigned long)ring->slots] = ring->fill;
+        ring->tail++;
+        ring->fill = 0;
+    }
+    ring->closing = 1;
+    write_behind_enqueue(ring);
+    LeaveCriticalSection(&write_behind.lock);
+}
+
+/**
+ * 查询写缓冲环状态
+ *
+ * 返回值：
+ * - 1：所有数据已写入且文件已关闭
+ * - 0：仍有数据在写入（或尚未关闭）
+ * - -1：写入失败
+ */
+int write_ring_status(tftp_write_ring_t* ring) {
+    EnterCriticalSection(&write_behind.lock);
+    int status = ring->error ? -1 : (ring->finished ? 1 : 0);
+    LeaveCriticalSection(&write_behind.lock);
+    return status;
+}
+
+/**
+ * 会话放弃写缓冲环，之后由I/O线程关闭文件并释放
+ *
+ * 参数：
+ * - ring: 写缓冲环
+ * - remove_file: 上传未完成时为1，I/O线程关闭文件后将其删除
+ */
+void write_ring_release(tftp_write_ring_t* ring, int remove_file) {
+    EnterCriticalSection(&write_behind.lock);
+    ring->released = 1;
+    ring->remove_file = remove_file;
+    write_behind_enqueue(ring);                          // I/O线程可能正在写该环，统一由它释放
+    LeaveCriticalSection(&write_behind.lock);
+}
@@ -0,0 +1,156 @@
+#include "../include/tftp.h"
+
+/*
+ * 数据包解析微基准测试：测量parse_tftp_packet对各类数据包的单包解析耗时，
+ * 并与旧的复制式解析（文件名strcpy、DATA数据memcpy进固定大小的数据包结构）对比。
+ * 实现思路：
+ *   1. 构造DATA（blksize字节数据）、ACK和带blksize/windowsize/timeout选项的RRQ三种数据包。
+ *   2. 每种数据包用两种解析方式各重复若干轮，用QueryPerformanceCounter计时，取最快一轮。
+ *   3. 解析结果累加到volatile变量，防止编译器把解析优化掉。
+ *
+ * 编译：gcc -O2 -Iinclude tools\parse_bench.c src\tftp_packet.c -o tools\parse_bench.exe -lws2_32
+ * 用法：parse_bench [每轮次数=10000000] [blksize=1428]
+ */
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define BENCH_ROUNDS 5
+
+// 旧的复制式解析结果：与原来的tftp_packet_t一样在结构中容纳文件名、模式和DATA数据
+typedef struct {
+    unsigned short opcode;
+    unsigned short block_num;
+    char filename[MAX_FILENAME_LEN];
+    char mode[MAX_MODE_LEN];
+    tftp_options_t options;
+    char data[MAX_BLOCK_SIZE];
+    int data_len;
+} copy_packet_t;
+
+static volatile unsigned long long sink;
+
+// 复制式解析：DATA数据和请求字符串都复制进结构
+static int parse_copy(const char* buffer, int buffer_len, copy_packet_t* packet) {
+    if (buffer_len < 4) {
+        return -1;
+    }
+    packet->opcode = ntohs(*(const unsigned short*)buffer);
+    switch (packet->opcode) {
+        case TFTP_RRQ:
+        case TFTP_WRQ: {
+            const char* ptr = buffer + 2;
+            int remaining = buffer_len - 2;
+            int filename_len = (int)strnlen(ptr, (size_t)remaining);
+            if (filename_len >= remaining || filename_len >= MAX_FILENAME_LEN) {
+                return -1;
+            }
+            strcpy(packet->filename, ptr);
+            ptr += filename_len + 1;
+            remaining -= filename_len + 1;
+            int mode_len = (int)strnlen(ptr, (size_t)remaining);
+            if (mode_len >= remaining || mode_len >= MAX_MODE_LEN) {
+                return -1;
+            }
+            strcpy(packet->mode, ptr);
+            ptr += mode_len + 1;
+            remaining -= mode_len + 1;
+            return parse_tftp_options(ptr, remaining, &packet->options);
+        }
+        case TFTP_DATA:
+            packet->block_num = ntohs(*(const unsigned short*)(buffer + 2));
+            packet->data_len = buffer_len - 4;
+            memcpy(packet->data, buffer + 4, (size_t)packet->data_len);
+            return 0;
+        case TFTP_ACK:
+            packet->block_num = ntohs(*(const unsigned short*)(buffer + 2));
+            return (buffer_len == 4) ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+// 构造RRQ：文件名、模式和三个选项
+static int build_rrq(char* buffer) {
+    static const char fields[] = "pxelinux.0\0octet\0blksize\0" "1428\0windowsize\0" "16\0timeout\0" "3";
+    buffer[0] = 0;
+    buffer[1] = TFTP_RRQ;
+    memcpy(buffer + 2, fields, sizeof(fields));
+    return 2 + (int)sizeof(fields);
+}
+
+static double now_seconds(void) {
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+// 零复制解析count次，返回最快一轮的单包耗时（纳秒）
+static double bench_view(const char* buffer, int length, long count) {
+    double best = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        tftp_packet_view_t packet;
+        double start = now_seconds();
+        for (long i = 0; i < count; i++) {
+            if (parse_tftp_packet(buffer, length, &packet) == 0) {
+                sink += packet.block_num + (unsigned long long)packet.payload_len;
+            }
+        }
+        double elapsed = (now_seconds() - start) * 1e9 / (double)count;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+// 复制式解析count次，返回最快一轮的单包耗时（纳秒）
+static double bench_copy(const char* buffer, int length, long count) {
+    static copy_packet_t packet;
+    double best = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double start = now_seconds();
+        for (long i = 0; i < count; i++) {
+            if (parse_copy(buffer, length, &packet) == 0) {
+                sink += packet.block_num + (unsigned long long)packet.data_len + (unsigned char)packet.data[0];
+            }
+        }
+        double elapsed = (now_seconds() - start) * 1e9 / (double)count;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    long count = (argc > 1) ? atol(argv[1]) : 10000000L;
+    int block_size = (argc > 2) ? atoi(argv[2]) : 1428;
+    if (count <= 0 || block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE) {
+        fprintf(stderr, "usage: parse_bench [count] [blksize %d-%d]\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    static char data_packet[TFTP_HEADER_SIZE + MAX_BLOCK_SIZE];
+    char ack_packet[TFTP_HEADER_SIZE] = {0, TFTP_ACK, 0x12, 0x34};
+    char rrq_packet[BUFFER_SIZE];
+
+    data_packet[1] = TFTP_DATA;
+    data_packet[2] = 0x12;
+    data_packet[3] = 0x34;
+    memset(data_packet + TFTP_HEADER_SIZE, 'x', (size_t)block_size);
+    int rrq_length = build_rrq(rrq_packet);
+
+    printf("Parse cost per packet (best of %d rounds x %ld packets)\n", BENCH_ROUNDS, count);
+    printf("%-22s %12s %12s\n", "packet", "view (ns)", "copy (ns)");
+    printf("%-15s%7d %12.2f %12.2f\n", "DATA blksize", block_size,
+           bench_view(data_packet, TFTP_HEADER_SIZE + block_size, count),
+           bench_copy(data_packet, TFTP_HEADER_SIZE + block_size, count));
+    printf("%-22s %12.2f %12.2f\n", "ACK",
+           bench_view(ack_packet, sizeof(ack_packet), count),
+           bench_copy(ack_packet, sizeof(ack_packet), count));
+    printf("%-22s %12.2f %12.2f\n", "RRQ + 3 options",
+           bench_view(rrq_packet, rrq_length, count / 10),
+           bench_copy(rrq_packet, rrq_length, count / 10));
+    return 0;
+}
@@ -0,0 +1,303 @@
+#define _WIN32_WINNT 0x0600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+/*
+ * 下载吞吐量基准测试：用多个并发的窗口化RRQ反复下载同一个文件，
+ * 统计吞吐量、收到的DATA包数以及服务器进程消耗的CPU时间。
+ * 实现思路：
+ *   1. 单线程用WSAPoll同时驱动sessions个下载，每个下载独立的套接字（客户端TID）。
+ *   2. 按协商的windowsize在每个窗口末尾发送累计ACK，乱序时确认最后一个按序块，
+ *      1秒无数据则重发请求或ACK。
+ *   3. 一个下载完成后立即开始下一个，直到达到指定的测试时长。
+ *   4. 指定服务器进程PID时，用GetProcessTimes统计测试期间服务器的CPU时间，
+ *      换算为每GB数据消耗的CPU秒数。
+ * 服务器每10秒在logs/tftp_server_mt.log中输出"Send batching"统计，
+ * 其中packets/call即每次发送系统调用平均发出的DATA包数。
+ *
+ * 用法：rrq_bench <文件名> [并发数=8] [windowsize=16] [blksize=1428] [秒数=10] [服务器PID] [服务器IP=127.0.0.1]
+ */
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define MAX_SESSIONS 256
+#define MAX_PACKET_SIZE (4 + 65464)
+#define RESEND_TIMEOUT_MS 1000
+
+typedef struct {
+    SOCKET sock;                        // 客户端套接字
+    struct sockaddr_in server_tid;      // 服务器传输端口（收到第一个包后确定）
+    int has_tid;                        // 是否已确定服务器TID
+    unsigned short expected;            // 期望的下一块号
+    int window;                         // 服务器接受的windowsize（无OACK时为1）
+    int blksize;                        // 服务器接受的blksize（无OACK时为512）
+    ULONGLONG last_rx;                  // 最近一次收到数据包的时间
+} bench_session_t;
+
+static struct sockaddr_in server_addr;
+static const char* filename;
+static int window_size = 16;           // 请求的windowsize
+static int block_size = 1428;          // 请求的blksize
+static char request[512];
+static int request_len;
+
+static unsigned long long total_bytes = 0;
+static unsigned long long data_packets = 0;
+static unsigned long long recv_calls = 0;
+static unsigned long long downloads = 0;
+
+static void die(const char* msg) {
+    fprintf(stderr, "%s (error=%d)\n", msg, WSAGetLastError());
+    WSACleanup();
+    exit(EXIT_FAILURE);
+}
+
+static ULONGLONG filetime_to_100ns(const FILETIME* ft) {
+    return ((ULONGLONG)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+}
+
+// 返回进程累计的内核态+用户态CPU时间（秒），失败返回-1
+static double process_cpu_seconds(HANDLE process) {
+    FILETIME creation, exit_time, kernel, user;
+    if (!GetProcessTimes(process, &creation, &exit_time, &kernel, &user)) {
+        return -1.0;
+    }
+    return (double)(filetime_to_100ns(&kernel) + filetime_to_100ns(&user)) / 1e7;
+}
+
+static void send_ack(bench_session_t* s, unsigned short block) {
+    char ack[4];
+    unsigned short ack_opcode = htons(4);
+    unsigned short ack_block = htons(block);
+    memcpy(ack, &ack_opcode, 2);
+    memcpy(ack + 2, &ack_block, 2);
+    sendto(s->sock, ack, sizeof(ack), 0, (struct sockaddr*)&s->server_tid, sizeof(s->server_tid));
+}
+
+// 开始一次新的下载：新建套接字并发送带blksize/windowsize选项的RRQ
+static void start_download(bench_session_t* s) {
+    s->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s->sock == INVALID_SOCKET) {
+        die("socket failed");
+    }
+    unsigned long non_blocking = 1;
+    ioctlsocket(s->sock, FIONBIO, &non_blocking);
+    int recv_buffer = 4 * 1024 * 1024;
+    setsockopt(s->sock, SOL_SOCKET, SO_RCVBUF, (char*)&recv_buffer, sizeof(recv_buffer));
+
+    s->has_tid = 0;
+    s->expected = 1;
+    s->window = 1;
+    s->blksize = 512;
+    s->last_rx = GetTickCount64();
+    if (sendto(s->sock, request, request_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        die("sendto RRQ failed");
+    }
+}
+
+// 处理一个收到的数据包，返回1表示本次下载完成
+static int handle_packet(bench_session_t* s, char* buffer, int len, struct sockaddr_in* from) {
+    if (len < 4) {
+        return 0;
+    }
+    if (!s->has_tid) {
+        s->server_tid = *from;
+        s->has_tid = 1;
+    } else if (from->sin_port != s->server_tid.sin_port) {
+        return 0;                                        // 其他TID发来的包
+    }
+    s->last_rx = GetTickCount64();
+
+    unsigned short opcode = ntohs(*(unsigned short*)buffer);
+    unsigned short block = ntohs(*(unsigned short*)(buffer + 2));
+
+    if (opcode == 6) {                                   // OACK：按服务器接受的选项值确认
+        char* ptr = buffer + 2;
+        char* limit = buffer + len;
+        while (ptr < limit) {
+            char* name = ptr;
+            ptr += strnlen(ptr, (size_t)(limit - ptr)) + 1;
+            if (ptr >= limit) {
+                break;
+            }
+            char* value = ptr;
+            ptr += strnlen(ptr, (size_t)(limit - ptr)) + 1;
+            if (_stricmp(name, "windowsize") == 0) {
+                s->window = atoi(value);
+            } else if (_stricmp(name, "blksize") == 0) {
+                s->blksize = atoi(value);
+            }
+        }
+        send_ack(s, 0);
+        return 0;
+    }
+    if (opcode == 5) {                                   // ERROR
+        fprintf(stderr, "Server error %u: %.*s\n", block, len - 4, buffer + 4);
+        exit(EXIT_FAILURE);
+    }
+    if (opcode != 3) {
+        return 0;
+    }
+
+    data_packets++;
+    if (block != s->expected) {
+        send_ack(s, (unsigned short)(s->expected - 1));  // 乱序：确认最后一个按序块，触发回退重传
+        return 0;
+    }
+
+    int data_len = len - 4;
+    total_bytes += (unsigned long long)data_len;
+    s->expected++;
+
+    if (data_len < s->blksize) {
+        send_ack(s, block);
+        return 1;
+    }
+    if (block % s->window == 0) {
+        send_ack(s, block);                              // 窗口末尾的累计ACK
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [sessions=8] [windowsize=16] [blksize=1428] [seconds=10] [server_pid] [server_ip=127.0.0.1]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    filename = argv[1];
+    int session_count = (argc > 2) ? atoi(argv[2]) : 8;
+    window_size = (argc > 3) ? atoi(argv[3]) : 16;
+    block_size = (argc > 4) ? atoi(argv[4]) : 1428;
+    int seconds = (argc > 5) ? atoi(argv[5]) : 10;
+    DWORD server_pid = (argc > 6) ? (DWORD)strtoul(argv[6], NULL, 10) : 0;
+    const char* server_ip = (argc > 7) ? argv[7] : "127.0.0.1";
+
+    if (session_count < 1 || session_count > MAX_SESSIONS || window_size < 1 || block_size < 8 || seconds < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        fprintf(stderr, "WSAStartup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(69);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) != 1) {
+        die("inet_pton failed");
+    }
+
+    // 构造RRQ请求: opcode(01) + filename + 0 + "octet" + 0 + blksize + 0 + N + 0 + windowsize + 0 + N + 0
+    unsigned short opcode = htons(1);
+    memcpy(request, &opcode, 2);
+    request_len = 2;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "%s", filename) + 1;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "octet") + 1;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "blksize") + 1;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "%d", block_size) + 1;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "windowsize") + 1;
+    request_len += snprintf(request + request_len, sizeof(request) - request_len, "%d", window_size) + 1;
+
+    HANDLE server_process = NULL;
+    if (server_pid != 0) {
+        server_process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, server_pid);
+        if (server_process == NULL) {
+            fprintf(stderr, "Warning: cannot open server process %lu, server CPU will not be measured\n",
+                    (unsigned long)server_pid);
+        }
+    }
+
+    static bench_session_t sessions[MAX_SESSIONS];
+    static WSAPOLLFD poll_fds[MAX_SESSIONS];
+    static char buffer[MAX_PACKET_SIZE];
+
+    printf("Benchmark: %s, %d sessions, windowsize %d, blksize %d, %d seconds\n",
+           filename, session_count, window_size, block_size, seconds);
+
+    double server_cpu_start = (server_process != NULL) ? process_cpu_seconds(server_process) : -1.0;
+    double client_cpu_start = process_cpu_seconds(GetCurrentProcess());
+    ULONGLONG start = GetTickCount64();
+    ULONGLONG end = start + (ULONGLONG)seconds * 1000;
+
+    for (int i = 0; i < session_count; i++) {
+        start_download(&sessions[i]);
+    }
+
+    while (GetTickCount64() < end) {
+        for (int i = 0; i < session_count; i++) {
+            poll_fds[i].fd = sessions[i].sock;
+            poll_fds[i].events = POLLRDNORM;
+            poll_fds[i].revents = 0;
+        }
+
+        int ready = WSAPoll(poll_fds, (ULONG)session_count, 100);
+        if (ready == SOCKET_ERROR) {
+            die("WSAPoll failed");
+        }
+
+        ULONGLONG now = GetTickCount64();
+        for (int i = 0; i < session_count; i++) {
+            bench_session_t* s = &sessions[i];
+
+            if (poll_fds[i].revents != 0) {
+                for (;;) {
+                    struct sockaddr_in from;
+                    int from_len = sizeof(from);
+                    int received = recvfrom(s->sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &from_len);
+                    recv_calls++;
+                    if (received == SOCKET_ERROR) {
+                        break;
+                    }
+                    if (handle_packet(s, buffer, received, &from)) {
+                        closesocket(s->sock);
+                        downloads++;
+                        start_download(s);
+                        break;
+                    }
+                }
+            } else if (now - s->last_rx > RESEND_TIMEOUT_MS) {
+                // 超时：尚未收到任何回应则重发RRQ，否则重发最后一个ACK
+                if (!s->has_tid) {
+                    sendto(s->sock, request, request_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+                } else {
+                    send_ack(s, (unsigned short)(s->expected - 1));
+                }
+                s->last_rx = now;
+            }
+        }
+    }
+
+    double elapsed = (double)(GetTickCount64() - start) / 1000.0;
+    double client_cpu = process_cpu_seconds(GetCurrentProcess()) - client_cpu_start;
+    double gigabytes = (double)total_bytes / 1e9;
+
+    printf("\n=== Results ===\n");
+    printf("Completed downloads:      %llu\n", downloads);
+    printf("Bytes received:           %llu\n", total_bytes);
+    printf("DATA packets received:    %llu\n", data_packets);
+    printf("Elapsed:                  %.2f s\n", elapsed);
+    printf("Throughput:               %.2f MB/s, %.0f packets/s\n",
+           (double)total_bytes / elapsed / 1e6, (double)data_packets / elapsed);
+    printf("Client packets/recv call: %.2f\n", recv_calls ? (double)data_packets / (double)recv_calls : 0.0);
+    printf("Client CPU:               %.2f s (%.2f s/GB)\n", client_cpu, gigabytes > 0 ? client_cpu / gigabytes : 0.0);
+    if (server_process != NULL && server_cpu_start >= 0) {
+        double server_cpu = process_cpu_seconds(server_process) - server_cpu_start;
+        printf("Server CPU:               %.2f s (%.2f s/GB)\n", server_cpu, gigabytes > 0 ? server_cpu / gigabytes : 0.0);
+        CloseHandle(server_process);
+    }
+    printf("Server packets/send call: see \"Send batching\" lines in logs/tftp_server_mt.log\n");
+
+    for (int i = 0; i < session_count; i++) {
+        closesocket(sessions[i].sock);
+    }
+    WSACleanup();
+    return 0;
+}